@@ -0,0 +1,51 @@
+#ifndef Bounds_hpp
+#define Bounds_hpp
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace gps {
+
+    //axis aligned bounding box; starts out empty (inverted) so expand() can grow it from nothing
+    struct AABB {
+        glm::vec3 minCorner;
+        glm::vec3 maxCorner;
+
+        AABB() : minCorner(FLT_MAX), maxCorner(-FLT_MAX) {}
+        AABB(glm::vec3 minCorner, glm::vec3 maxCorner) : minCorner(minCorner), maxCorner(maxCorner) {}
+
+        bool isValid() const {
+            return minCorner.x <= maxCorner.x && minCorner.y <= maxCorner.y && minCorner.z <= maxCorner.z;
+        }
+
+        void expand(const glm::vec3& p) {
+            minCorner = glm::min(minCorner, p);
+            maxCorner = glm::max(maxCorner, p);
+        }
+
+        void expand(const AABB& b) {
+            minCorner = glm::min(minCorner, b.minCorner);
+            maxCorner = glm::max(maxCorner, b.maxCorner);
+        }
+
+        glm::vec3 center() const { return (minCorner + maxCorner) * 0.5f; }
+        glm::vec3 extents() const { return (maxCorner - minCorner) * 0.5f; }
+    };
+
+    //world space box enclosing the transformed box (Arvo's method, no corner loop)
+    inline AABB transformAABB(const AABB& b, const glm::mat4& M) {
+        if (!b.isValid())
+            return b;
+
+        glm::vec3 c = glm::vec3(M * glm::vec4(b.center(), 1.0f));
+        glm::vec3 e = b.extents();
+        glm::vec3 r(0.0f);
+        for (int col = 0; col < 3; col++) {
+            r += glm::abs(glm::vec3(M[col])) * e[col];
+        }
+        return AABB(c - r, c + r);
+    }
+}
+
+#endif /* Bounds_hpp */
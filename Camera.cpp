@@ -65,5 +65,13 @@ namespace gps {
 
         cameraTarget = cameraPosition + cameraFrontDirection;
     }
+
+    glm::vec3 Camera::getRayDirection(glm::vec2 ndc, const glm::mat4& projection) {
+        //the point on the near plane in eye space, then out of the eye basis (looking down -z)
+        glm::vec4 eye = glm::inverse(projection) * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+        eye /= eye.w;
+        glm::vec3 direction = cameraRightDirection * eye.x + cameraUpDirection * eye.y - cameraFrontDirection * eye.z;
+        return glm::normalize(direction);
+    }
     
 }
@@ -21,6 +21,9 @@ namespace gps {
         //yaw - camera rotation around the y axis
         //pitch - camera rotation around the x axis
         void rotate(float pitch, float yaw);
+        //world space direction from the camera position through a point of the screen, given in
+        //normalized device coordinates (-1..1, y up) of the projection it is drawn with
+        glm::vec3 getRayDirection(glm::vec2 ndc, const glm::mat4& projection);
         
 
         glm::vec3 cameraPosition;
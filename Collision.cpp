@@ -0,0 +1,445 @@
+#include "Collision.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    static bool overlaps(const AABB& a, const AABB& b) {
+        return a.minCorner.x <= b.maxCorner.x && a.maxCorner.x >= b.minCorner.x
+            && a.minCorner.y <= b.maxCorner.y && a.maxCorner.y >= b.minCorner.y
+            && a.minCorner.z <= b.maxCorner.z && a.maxCorner.z >= b.minCorner.z;
+    }
+
+    static AABB capsuleBounds(const Capsule& c, const glm::vec3& offset) {
+        AABB box;
+        box.expand(c.a + offset);
+        box.expand(c.b + offset);
+        box.minCorner -= glm::vec3(c.radius);
+        box.maxCorner += glm::vec3(c.radius);
+        return box;
+    }
+
+    //closest point of triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+    static glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return a;
+
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+            return b;
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return a + ab * (d1 / (d1 - d3));
+
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+            return c;
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return a + ac * (d2 / (d2 - d6));
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denom = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    //closest points of the segments p1-q1 and p2-q2 (Ericson 5.1.9)
+    static void closestOnSegments(const glm::vec3& p1, const glm::vec3& q1, const glm::vec3& p2, const glm::vec3& q2,
+        glm::vec3& c1, glm::vec3& c2) {
+        glm::vec3 d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+        float a = glm::dot(d1, d1), e = glm::dot(d2, d2), f = glm::dot(d2, r);
+        float s = 0.0f, t = 0.0f;
+        const float EPSILON = 1e-12f;
+
+        if (a <= EPSILON && e <= EPSILON) {
+            c1 = p1;
+            c2 = p2;
+            return;
+        }
+        if (a <= EPSILON) {
+            t = std::clamp(f / e, 0.0f, 1.0f);
+        }
+        else {
+            float c = glm::dot(d1, r);
+            if (e <= EPSILON) {
+                s = std::clamp(-c / a, 0.0f, 1.0f);
+            }
+            else {
+                float b = glm::dot(d1, d2);
+                float denom = a * e - b * b;
+                s = denom != 0.0f ? std::clamp((b * f - c * e) / denom, 0.0f, 1.0f) : 0.0f;
+                t = (b * s + f) / e;
+                if (t < 0.0f) {
+                    t = 0.0f;
+                    s = std::clamp(-c / a, 0.0f, 1.0f);
+                }
+                else if (t > 1.0f) {
+                    t = 1.0f;
+                    s = std::clamp((b - c) / a, 0.0f, 1.0f);
+                }
+            }
+        }
+        c1 = p1 + d1 * s;
+        c2 = p2 + d2 * t;
+    }
+
+    //signed distance of a point from a box centered at the origin, negative inside
+    static float boxDistance(const glm::vec3& p, const glm::vec3& halfSize) {
+        glm::vec3 q = glm::abs(p) - halfSize;
+        return glm::length(glm::max(q, glm::vec3(0.0f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+    }
+
+    void CollisionWorld::addBox(const glm::mat4& transform, const AABB& localBox, EntityId entity) {
+        if (!localBox.isValid())
+            return;
+
+        Box box;
+        box.center = glm::vec3(transform * glm::vec4(localBox.center(), 1.0f));
+        glm::vec3 extents = localBox.extents();
+        for (int i = 0; i < 3; i++) {
+            glm::vec3 column = glm::vec3(transform[i]);
+            float length = glm::length(column);
+            box.axes[i] = length > 0.0f ? column / length : glm::vec3(i == 0, i == 1, i == 2);
+            box.halfSize[i] = extents[i] * length;
+        }
+
+        shapes.push_back((uint32_t)boxes.size());
+        bounds.push_back(transformAABB(localBox, transform));
+        entities.push_back(entity);
+        boxes.push_back(box);
+    }
+
+    void CollisionWorld::addTriangles(const std::vector<glm::vec3>& vertices, EntityId entity) {
+        for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+            AABB box;
+            box.expand(vertices[i]);
+            box.expand(vertices[i + 1]);
+            box.expand(vertices[i + 2]);
+            shapes.push_back(TRIANGLE_SHAPE | (uint32_t)(triangles.size() / 3));
+            bounds.push_back(box);
+            entities.push_back(entity);
+            triangles.insert(triangles.end(), vertices.begin() + i, vertices.begin() + i + 3);
+        }
+    }
+
+    void CollisionWorld::addEntities(const Scene& scene, uint32_t required, uint32_t excluded) {
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            if (!scene.hasFlags(id, required) || (scene.flags[id] & excluded) != 0)
+                continue;
+
+            const MeshRef& mesh = scene.meshes[id];
+            if (mesh.kind == MESH_QUAD || mesh.kind == MESH_CUBE)
+                addBox(scene.worldTransforms[id], scene.localBounds[id], id);
+            else if (mesh.kind == MESH_MODEL && mesh.model)
+                addTriangles(mesh.model->getTriangles(scene.worldTransforms[id]), id);
+        }
+    }
+
+    void CollisionWorld::clear() {
+        boxes.clear();
+        triangles.clear();
+        shapes.clear();
+        bounds.clear();
+        entities.clear();
+        cells.clear();
+        cellColliders.clear();
+    }
+
+    glm::ivec3 CollisionWorld::cellOf(const glm::vec3& p) const {
+        return glm::ivec3(glm::floor(p * inverseCellSize));
+    }
+
+    //21 bits a coordinate: a million cells each way around the origin
+    uint64_t CollisionWorld::cellKey(int x, int y, int z) {
+        const uint64_t MASK = (1u << 21) - 1;
+        return ((uint64_t)(x & MASK) << 42) | ((uint64_t)(y & MASK) << 21) | (uint64_t)(z & MASK);
+    }
+
+    void CollisionWorld::build(float size) {
+        cellSize = size;
+        inverseCellSize = 1.0f / size;
+        cells.clear();
+        cellColliders.clear();
+
+        //(cell, collider) pairs sorted by cell, so every cell's colliders end up side by side
+        std::vector<std::pair<uint64_t, uint32_t>> pairs;
+        pairs.reserve(bounds.size() * 2);
+        for (uint32_t id = 0; id < (uint32_t)bounds.size(); id++) {
+            glm::ivec3 lo = cellOf(bounds[id].minCorner), hi = cellOf(bounds[id].maxCorner);
+            for (int x = lo.x; x <= hi.x; x++)
+                for (int y = lo.y; y <= hi.y; y++)
+                    for (int z = lo.z; z <= hi.z; z++)
+                        pairs.push_back({ cellKey(x, y, z), id });
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        cellColliders.resize(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++) {
+            cellColliders[i] = pairs[i].second;
+            if (i == 0 || pairs[i].first != pairs[i - 1].first)
+                cells[pairs[i].first] = { (uint32_t)i, 0 };
+            cells[pairs[i].first].count++;
+        }
+    }
+
+    //the colliders whose bounds overlap box, each once
+    void CollisionWorld::query(const AABB& box, std::vector<uint32_t>& out) const {
+        out.clear();
+        glm::ivec3 lo = cellOf(box.minCorner), hi = cellOf(box.maxCorner);
+        glm::ivec3 span = hi - lo + glm::ivec3(1);
+
+        if ((int64_t)span.x * span.y * span.z > MAX_QUERY_CELLS) {
+            for (uint32_t id = 0; id < (uint32_t)bounds.size(); id++) {
+                if (overlaps(bounds[id], box))
+                    out.push_back(id);
+            }
+            return;
+        }
+
+        for (int x = lo.x; x <= hi.x; x++) {
+            for (int y = lo.y; y <= hi.y; y++) {
+                for (int z = lo.z; z <= hi.z; z++) {
+                    auto found = cells.find(cellKey(x, y, z));
+                    if (found == cells.end())
+                        continue;
+                    const Cell& cell = found->second;
+                    for (uint32_t i = cell.first; i < cell.first + cell.count; i++) {
+                        if (overlaps(bounds[cellColliders[i]], box))
+                            out.push_back(cellColliders[i]);
+                    }
+                }
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    float CollisionWorld::separation(uint32_t id, const glm::vec3& a, const glm::vec3& b, glm::vec3& normal) const {
+        uint32_t shape = shapes[id];
+        if (shape & TRIANGLE_SHAPE)
+            return triangleSeparation(&triangles[(shape & ~TRIANGLE_SHAPE) * 3], a, b, normal);
+        return boxSeparation(boxes[shape], a, b, normal);
+    }
+
+    //the signed distance is convex along the segment, so a golden section search finds its
+    //deepest (or nearest) point
+    float CollisionWorld::boxSeparation(const Box& box, const glm::vec3& a, const glm::vec3& b, glm::vec3& normal) const {
+        auto toLocal = [&box](const glm::vec3& p) {
+            glm::vec3 r = p - box.center;
+            return glm::vec3(glm::dot(r, box.axes[0]), glm::dot(r, box.axes[1]), glm::dot(r, box.axes[2]));
+        };
+        glm::vec3 la = toLocal(a), lb = toLocal(b);
+
+        const float GOLDEN = 0.618034f;
+        float lo = 0.0f, hi = 1.0f;
+        float s1 = hi - GOLDEN * (hi - lo), s2 = lo + GOLDEN * (hi - lo);
+        float f1 = boxDistance(la + (lb - la) * s1, box.halfSize);
+        float f2 = boxDistance(la + (lb - la) * s2, box.halfSize);
+        for (int i = 0; i < 24; i++) {
+            if (f1 <= f2) {
+                hi = s2;
+                s2 = s1;
+                f2 = f1;
+                s1 = hi - GOLDEN * (hi - lo);
+                f1 = boxDistance(la + (lb - la) * s1, box.halfSize);
+            }
+            else {
+                lo = s1;
+                s1 = s2;
+                f1 = f2;
+                s2 = lo + GOLDEN * (hi - lo);
+                f2 = boxDistance(la + (lb - la) * s2, box.halfSize);
+            }
+        }
+
+        //the ends too: the search only brackets interior minima
+        float s = (lo + hi) * 0.5f;
+        float distance = boxDistance(la + (lb - la) * s, box.halfSize);
+        for (float end : { 0.0f, 1.0f }) {
+            float d = boxDistance(la + (lb - la) * end, box.halfSize);
+            if (d < distance) {
+                distance = d;
+                s = end;
+            }
+        }
+
+        glm::vec3 p = la + (lb - la) * s;
+        glm::vec3 local;
+        if (distance > 0.0f) {
+            local = p - glm::clamp(p, -box.halfSize, box.halfSize);
+        }
+        else {
+            //inside: out through the nearest face
+            glm::vec3 q = glm::abs(p) - box.halfSize;
+            int axis = q.x > q.y ? (q.x > q.z ? 0 : 2) : (q.y > q.z ? 1 : 2);
+            local = glm::vec3(0.0f);
+            local[axis] = p[axis] < 0.0f ? -1.0f : 1.0f;
+        }
+        normal = glm::normalize(box.axes[0] * local.x + box.axes[1] * local.y + box.axes[2] * local.z);
+        return distance;
+    }
+
+    float CollisionWorld::triangleSeparation(const glm::vec3* v, const glm::vec3& a, const glm::vec3& b,
+        glm::vec3& normal) const {
+        glm::vec3 n = glm::cross(v[1] - v[0], v[2] - v[0]);
+        float area = glm::length(n);
+
+        //a segment through the triangle: out on the side that takes the shorter push
+        if (area > 0.0f) {
+            n /= area;
+            float da = glm::dot(n, a - v[0]), db = glm::dot(n, b - v[0]);
+            if (da * db <= 0.0f && da != db) {
+                glm::vec3 x = a + (b - a) * (da / (da - db));
+                glm::vec3 d = closestOnTriangle(x, v[0], v[1], v[2]) - x;
+                if (glm::dot(d, d) < 1e-12f) {
+                    normal = std::abs(da) > std::abs(db) ? (da > 0.0f ? n : -n) : (db > 0.0f ? n : -n);
+                    return -std::min(std::abs(da), std::abs(db));
+                }
+            }
+        }
+
+        //otherwise the closest pair is at an end of the segment or on an edge of the triangle
+        glm::vec3 onSegment = a, onTriangle = closestOnTriangle(a, v[0], v[1], v[2]);
+        float best = glm::dot(onSegment - onTriangle, onSegment - onTriangle);
+
+        glm::vec3 t = closestOnTriangle(b, v[0], v[1], v[2]);
+        float d = glm::dot(b - t, b - t);
+        if (d < best) {
+            best = d;
+            onSegment = b;
+            onTriangle = t;
+        }
+        for (int e = 0; e < 3; e++) {
+            glm::vec3 c1, c2;
+            closestOnSegments(a, b, v[e], v[(e + 1) % 3], c1, c2);
+            d = glm::dot(c1 - c2, c1 - c2);
+            if (d < best) {
+                best = d;
+                onSegment = c1;
+                onTriangle = c2;
+            }
+        }
+
+        float distance = std::sqrt(best);
+        if (distance > 0.0f)
+            normal = (onSegment - onTriangle) / distance;
+        else
+            normal = area > 0.0f ? (glm::dot(n, (a + b) * 0.5f - v[0]) >= 0.0f ? n : -n) : glm::vec3(0.0f, 1.0f, 0.0f);
+        return distance;
+    }
+
+    //conservative advancement: the capsule's separation f(t) from a convex collider is convex
+    //along the motion, so it stays above its tangent and f / -f' never steps past the contact
+    bool CollisionWorld::timeOfImpact(uint32_t id, const Capsule& capsule, const glm::vec3& motion, float tLimit,
+        float& t, glm::vec3& normal) const {
+        t = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            glm::vec3 offset = motion * t;
+            float f = separation(id, capsule.a + offset, capsule.b + offset, normal) - capsule.radius;
+
+            //not closing in (f' >= 0): convexity says it never will
+            float approach = -glm::dot(motion, normal);
+            if (approach <= 1e-6f)
+                return false;
+            if (f <= SKIN)
+                return true;
+
+            t += (f - SKIN) / approach;
+            if (t >= tLimit)
+                return false;
+        }
+        return true;
+    }
+
+    bool CollisionWorld::sweep(const Capsule& capsule, const glm::vec3& motion, SweepHit& hit) const {
+        if (glm::dot(motion, motion) == 0.0f)
+            return false;
+
+        AABB reach = capsuleBounds(capsule, glm::vec3(0.0f));
+        reach.expand(capsuleBounds(capsule, motion));
+        reach.minCorner -= glm::vec3(SKIN);
+        reach.maxCorner += glm::vec3(SKIN);
+
+        std::vector<uint32_t> candidates;
+        query(reach, candidates);
+
+        bool found = false;
+        hit = SweepHit();
+        for (uint32_t id : candidates) {
+            float t;
+            glm::vec3 normal;
+            if (timeOfImpact(id, capsule, motion, hit.t, t, normal) && (!found || t < hit.t)) {
+                found = true;
+                hit.t = t;
+                hit.normal = normal;
+                hit.entity = entities[id];
+            }
+        }
+        return found;
+    }
+
+    //a few rounds of pushing out of the deepest overlap; what is left is at most SKIN deep
+    glm::vec3 CollisionWorld::depenetrate(const Capsule& capsule) const {
+        glm::vec3 offset(0.0f);
+        std::vector<uint32_t> candidates;
+        for (int round = 0; round < 4; round++) {
+            query(capsuleBounds(capsule, offset), candidates);
+
+            float deepest = 0.0f;
+            glm::vec3 push(0.0f);
+            for (uint32_t id : candidates) {
+                glm::vec3 normal;
+                float f = separation(id, capsule.a + offset, capsule.b + offset, normal) - capsule.radius;
+                if (f < deepest) {
+                    deepest = f;
+                    push = normal;
+                }
+            }
+            if (deepest >= -SKIN)
+                break;
+            offset += push * (SKIN - deepest);
+        }
+        return offset;
+    }
+
+    glm::vec3 CollisionWorld::move(const Capsule& capsule, const glm::vec3& motion) const {
+        glm::vec3 offset(0.0f);
+        glm::vec3 remaining = motion;
+        glm::vec3 lastNormal(0.0f);
+
+        for (int i = 0; i < MAX_SLIDES && glm::dot(remaining, remaining) > 1e-12f; i++) {
+            Capsule moved = { capsule.a + offset, capsule.b + offset, capsule.radius };
+            SweepHit hit;
+            if (!sweep(moved, remaining, hit)) {
+                offset += remaining;
+                break;
+            }
+
+            //up to the contact, then what is left of the motion along the surface
+            offset += remaining * hit.t;
+            remaining *= 1.0f - hit.t;
+            remaining -= hit.normal * glm::dot(remaining, hit.normal);
+
+            //in a corner the slide along one face runs into the other: follow the crease
+            if (i > 0 && glm::dot(remaining, lastNormal) < 0.0f) {
+                glm::vec3 crease = glm::cross(lastNormal, hit.normal);
+                float length2 = glm::dot(crease, crease);
+                remaining = length2 > 1e-12f ? crease * (glm::dot(remaining, crease) / length2) : glm::vec3(0.0f);
+            }
+            lastNormal = hit.normal;
+        }
+
+        Capsule moved = { capsule.a + offset, capsule.b + offset, capsule.radius };
+        return offset + depenetrate(moved);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef Collision_hpp
+#define Collision_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    //the points within radius of the segment a-b; a standing character is a vertical one
+    struct Capsule {
+        glm::vec3 a;
+        glm::vec3 b;
+        float radius;
+    };
+
+    struct SweepHit {
+        float t = 1.0f;                             // fraction of the motion made before the contact
+        glm::vec3 normal = glm::vec3(0.0f);         // away from the collider, towards the capsule
+        EntityId entity = NO_ENTITY;
+    };
+
+    //static colliders of the scene for moving capsules against: oriented boxes (quads, cubes) and
+    //triangles (models), registered in a spatial hash of uniform cells so a query only looks at
+    //the colliders near the motion, however many rooms there are
+    //motions are swept with conservative advancement: the separation of a capsule from a convex
+    //collider is convex along a straight motion, so stepping by separation / approach speed never
+    //passes the contact and a fast move can't tunnel through a thin wall
+    //queries only read the world; add colliders, then build() once before using it
+    class CollisionWorld {
+
+    public:
+        //an oriented box: localBox under transform (rotation and scale, no shear); flat boxes are fine
+        void addBox(const glm::mat4& transform, const AABB& localBox, EntityId entity = NO_ENTITY);
+        //three vertices per triangle, world space
+        void addTriangles(const std::vector<glm::vec3>& vertices, EntityId entity = NO_ENTITY);
+        //the entities with all of the required flags and none of the excluded ones, at their
+        //current world transforms: quads and cubes as boxes, models as their triangles
+        void addEntities(const Scene& scene, uint32_t required, uint32_t excluded);
+
+        //hashes the colliders into cells of cellSize meters
+        void build(float cellSize = 2.0f);
+        void clear();
+
+        //first contact of the capsule moving by motion; false if it gets all the way
+        bool sweep(const Capsule& capsule, const glm::vec3& motion, SweepHit& hit) const;
+
+        //the displacement the capsule can actually make of motion: it stops at a contact and slides
+        //on along the surface, then is pushed out of anything it still overlaps
+        glm::vec3 move(const Capsule& capsule, const glm::vec3& motion) const;
+
+        size_t getColliderCount() const { return bounds.size(); }
+        size_t getCellCount() const { return cells.size(); }
+
+    private:
+        static constexpr float SKIN = 0.01f;        // gap kept between a capsule and a contact
+        static const int MAX_SLIDES = 4;
+        static const int MAX_QUERY_CELLS = 4096;    // larger queries scan every collider
+        static const uint32_t TRIANGLE_SHAPE = 0x80000000u;
+
+        struct Box {
+            glm::vec3 center;
+            glm::vec3 axes[3];                      // unit length
+            glm::vec3 halfSize;
+        };
+
+        struct Cell {
+            uint32_t first;
+            uint32_t count;
+        };
+
+        std::vector<Box> boxes;
+        std::vector<glm::vec3> triangles;           // three vertices each
+        std::vector<uint32_t> shapes;               // per collider, index into boxes or TRIANGLE_SHAPE | triangle
+        std::vector<AABB> bounds;                   // per collider, world space
+        std::vector<EntityId> entities;             // per collider
+
+        float cellSize = 2.0f;
+        float inverseCellSize = 0.5f;
+        std::unordered_map<uint64_t, Cell> cells;
+        std::vector<uint32_t> cellColliders;        // the colliders of every cell, cell after cell
+
+        glm::ivec3 cellOf(const glm::vec3& p) const;
+        static uint64_t cellKey(int x, int y, int z);
+        void query(const AABB& box, std::vector<uint32_t>& out) const;
+
+        //signed distance of the segment a-b from collider id (negative: penetration depth) and the
+        //direction to push the segment out along
+        float separation(uint32_t id, const glm::vec3& a, const glm::vec3& b, glm::vec3& normal) const;
+        float boxSeparation(const Box& box, const glm::vec3& a, const glm::vec3& b, glm::vec3& normal) const;
+        float triangleSeparation(const glm::vec3* v, const glm::vec3& a, const glm::vec3& b, glm::vec3& normal) const;
+
+        bool timeOfImpact(uint32_t id, const Capsule& capsule, const glm::vec3& motion, float tLimit,
+            float& t, glm::vec3& normal) const;
+        glm::vec3 depenetrate(const Capsule& capsule) const;
+    };
+}
+
+#endif /* Collision_hpp */
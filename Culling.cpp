@@ -0,0 +1,161 @@
+#include "Culling.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+    //half size given to entities without bounds so no plane can reject them
+    static const float UNBOUNDED_EXTENT = 1e30f;
+
+    Frustum Frustum::fromMatrix(const glm::mat4& m) {
+        //rows of the matrix (glm is column major)
+        glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum f;
+        f.planes[0] = r3 + r0;  // left
+        f.planes[1] = r3 - r0;  // right
+        f.planes[2] = r3 + r1;  // bottom
+        f.planes[3] = r3 - r1;  // top
+        f.planes[4] = r3 + r2;  // near
+        f.planes[5] = r3 - r2;  // far
+        return f;
+    }
+
+    void CullingBounds::set(size_t i, const AABB& box) {
+        if (box.isValid()) {
+            glm::vec3 c = box.center();
+            glm::vec3 e = box.extents();
+            centerX[i] = c.x; centerY[i] = c.y; centerZ[i] = c.z;
+            extentX[i] = e.x; extentY[i] = e.y; extentZ[i] = e.z;
+        }
+        else {
+            centerX[i] = centerY[i] = centerZ[i] = 0.0f;
+            extentX[i] = extentY[i] = extentZ[i] = UNBOUNDED_EXTENT;
+        }
+    }
+
+    void CullingBounds::sync(const Scene& scene) {
+        if (scene.size() != count) {
+            count = scene.size();
+            //padded to whole AVX2 steps; the padding lanes are never read back
+            size_t padded = (count + 7) & ~(size_t)7;
+            for (simd::FloatArray* a : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+                a->assign(padded, 0.0f);
+
+            for (size_t i = 0; i < count; i++)
+                set(i, scene.worldBounds[i]);
+            return;
+        }
+
+        for (EntityId id : scene.getLastUpdated())
+            set(id, scene.worldBounds[id]);
+    }
+
+    void CullingBounds::testFrustum(const Frustum& frustum, std::vector<uint8_t>& visible) const {
+        visible.resize(count);
+        if (count == 0)
+            return;
+
+#if defined(GPS_SIMD_X86)
+        if (simd::hasAVX2())
+            testRangeAVX2(frustum, 0, count, visible.data());
+        else
+            testRangeSSE(frustum, 0, count, visible.data());
+#else
+        testRangeScalar(frustum, 0, count, visible.data());
+#endif
+    }
+
+    void CullingBounds::testRangeScalar(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const {
+        for (size_t i = begin; i < end; i++) {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+                const glm::vec4& pl = frustum.planes[p];
+                //signed distance of the box corner furthest along the plane normal
+                float d = pl.x * centerX[i] + pl.y * centerY[i] + pl.z * centerZ[i] + pl.w
+                    + std::fabs(pl.x) * extentX[i] + std::fabs(pl.y) * extentY[i] + std::fabs(pl.z) * extentZ[i];
+                inside = d >= 0.0f;
+            }
+            visible[i] = inside ? 1 : 0;
+        }
+    }
+
+#if defined(GPS_SIMD_X86)
+
+    void CullingBounds::testRangeSSE(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const {
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128 cx = _mm_load_ps(&centerX[i]);
+            __m128 cy = _mm_load_ps(&centerY[i]);
+            __m128 cz = _mm_load_ps(&centerZ[i]);
+            __m128 ex = _mm_load_ps(&extentX[i]);
+            __m128 ey = _mm_load_ps(&extentY[i]);
+            __m128 ez = _mm_load_ps(&extentZ[i]);
+
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& pl = frustum.planes[p];
+                __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.x), cx), _mm_set1_ps(pl.w));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl.y), cy));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl.z), cz));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(pl.x)), ex));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(pl.y)), ey));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(std::fabs(pl.z)), ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(outside);
+            for (int lane = 0; lane < 4; lane++)
+                visible[i + lane] = (mask & (1 << lane)) ? 0 : 1;
+        }
+
+        testRangeScalar(frustum, i, end, visible);
+    }
+
+    GPS_TARGET_AVX2 void CullingBounds::testRangeAVX2(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const {
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 cx = _mm256_load_ps(&centerX[i]);
+            __m256 cy = _mm256_load_ps(&centerY[i]);
+            __m256 cz = _mm256_load_ps(&centerZ[i]);
+            __m256 ex = _mm256_load_ps(&extentX[i]);
+            __m256 ey = _mm256_load_ps(&extentY[i]);
+            __m256 ez = _mm256_load_ps(&extentZ[i]);
+
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& pl = frustum.planes[p];
+                __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(pl.x), cx, _mm256_set1_ps(pl.w));
+                d = _mm256_fmadd_ps(_mm256_set1_ps(pl.y), cy, d);
+                d = _mm256_fmadd_ps(_mm256_set1_ps(pl.z), cz, d);
+                d = _mm256_fmadd_ps(_mm256_set1_ps(std::fabs(pl.x)), ex, d);
+                d = _mm256_fmadd_ps(_mm256_set1_ps(std::fabs(pl.y)), ey, d);
+                d = _mm256_fmadd_ps(_mm256_set1_ps(std::fabs(pl.z)), ez, d);
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(outside);
+            for (int lane = 0; lane < 8; lane++)
+                visible[i + lane] = (mask & (1 << lane)) ? 0 : 1;
+        }
+
+        testRangeScalar(frustum, i, end, visible);
+    }
+
+#endif
+
+    void filterVisible(const std::vector<EntityId>& candidates, const std::vector<uint8_t>& visible,
+        std::vector<EntityId>& out, CullStats& stats) {
+
+        for (EntityId id : candidates) {
+            if (visible[id])
+                out.push_back(id);
+            else
+                stats.culled++;
+        }
+        stats.submitted += (unsigned)candidates.size();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef Culling_hpp
+#define Culling_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "Scene.hpp"
+#include "SimdUtils.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //six planes (a, b, c, d) of a view volume; a point is inside when dot(abc, p) + d >= 0 for all
+    //the normals are not normalized, box tests only need the sign
+    struct Frustum {
+        glm::vec4 planes[6];
+
+        //Gribb/Hartmann extraction, works for perspective and orthographic matrices alike
+        static Frustum fromMatrix(const glm::mat4& viewProjection);
+    };
+
+    //entities handed to a pass and how many of them the culling dropped
+    struct CullStats {
+        unsigned submitted = 0;
+        unsigned culled = 0;       // outside the view volume
+        unsigned occluded = 0;     // inside, but hidden behind occluders
+    };
+
+    //world bounds of the scene entities as SoA center/extent streams, so one SIMD step tests
+    //4 (SSE2) or 8 (AVX2) boxes against a plane
+    class CullingBounds {
+
+    public:
+        //mirrors the scene's world bounds: everything on the first call (or when the scene grew),
+        //afterwards only the entities moved by the last Scene::updateTransforms()
+        void sync(const Scene& scene);
+
+        //visible[id] = 1 if the box of entity id intersects the frustum, 0 otherwise
+        //entities without valid bounds always pass
+        void testFrustum(const Frustum& frustum, std::vector<uint8_t>& visible) const;
+
+        size_t size() const { return count; }
+
+    private:
+        simd::FloatArray centerX, centerY, centerZ;
+        simd::FloatArray extentX, extentY, extentZ;
+        size_t count = 0;
+
+        void set(size_t i, const AABB& box);
+
+        void testRangeScalar(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const;
+#if defined(GPS_SIMD_X86)
+        void testRangeSSE(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const;
+        void testRangeAVX2(const Frustum& frustum, size_t begin, size_t end, uint8_t* visible) const;
+#endif
+    };
+
+    //appends the candidates flagged visible to out and counts them into stats
+    void filterVisible(const std::vector<EntityId>& candidates, const std::vector<uint8_t>& visible,
+        std::vector<EntityId>& out, CullStats& stats);
+}
+
+#endif /* Culling_hpp */
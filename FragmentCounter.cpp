@@ -0,0 +1,47 @@
+#include "FragmentCounter.hpp"
+
+namespace gps {
+
+    void FragmentCounter::init() {
+        target = GLEW_ARB_pipeline_statistics_query ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED;
+        glGenQueries(RING_SIZE, queries);
+        resetStats();
+    }
+
+    void FragmentCounter::destroy() {
+        glDeleteQueries(RING_SIZE, queries);
+        for (int i = 0; i < RING_SIZE; i++) {
+            queries[i] = 0;
+            pending[i] = false;
+        }
+    }
+
+    void FragmentCounter::begin() {
+        //the query about to be reused is RING_SIZE frames old and almost always done
+        if (pending[next]) {
+            GLuint64 count = 0;
+            glGetQueryObjectui64v(queries[next], GL_QUERY_RESULT, &count);
+            if (!discard[next]) {
+                total += count;
+                frames++;
+            }
+            pending[next] = false;
+        }
+
+        glBeginQuery(target, queries[next]);
+    }
+
+    void FragmentCounter::end() {
+        glEndQuery(target);
+        pending[next] = true;
+        discard[next] = false;
+        next = (next + 1) % RING_SIZE;
+    }
+
+    void FragmentCounter::resetStats() {
+        total = 0;
+        frames = 0;
+        for (int i = 0; i < RING_SIZE; i++)
+            discard[i] = pending[i];
+    }
+}
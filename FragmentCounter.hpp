@@ -0,0 +1,53 @@
+#ifndef FragmentCounter_hpp
+#define FragmentCounter_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstdint>
+
+namespace gps {
+
+    //fragments shaded by one pass per frame, summed over frames
+    //counts fragment shader invocations (ARB_pipeline_statistics_query) when available,
+    //otherwise samples that passed the depth test, which is the same number for a pass
+    //without discard
+    //results are read RING_SIZE frames late, so the cpu doesn't wait for them
+    class FragmentCounter {
+
+    public:
+        static const int RING_SIZE = 3;
+
+        //needs a current GL context
+        void init();
+        void destroy();
+
+        //bracket the pass, once per frame
+        void begin();
+        void end();
+
+        bool countsInvocations() const { return target != GL_SAMPLES_PASSED; }
+
+        //since the last resetStats(): fragments counted and frames they were counted over
+        uint64_t getTotal() const { return total; }
+        unsigned getFrames() const { return frames; }
+        void resetStats();
+
+    private:
+        GLenum target = GL_SAMPLES_PASSED;
+        GLuint queries[RING_SIZE] = { 0, 0, 0 };
+        bool pending[RING_SIZE] = { false, false, false };
+        bool discard[RING_SIZE] = { false, false, false };   // issued before the last reset
+        int next = 0;
+
+        uint64_t total = 0;
+        unsigned frames = 0;
+    };
+}
+
+#endif /* FragmentCounter_hpp */
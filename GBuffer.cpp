@@ -0,0 +1,121 @@
+#include "GBuffer.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        GLuint createTarget(GLint internalFormat, GLenum format, GLenum type, GLsizei width, GLsizei height) {
+            GLuint texture = 0;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+            //read with texelFetch, one texel per pixel
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return texture;
+        }
+
+        void checkComplete(const char* name) {
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "G-buffer: " << name << " framebuffer incomplete" << std::endl;
+        }
+    }
+
+    void GBuffer::init(GLsizei width, GLsizei height) {
+        glGenFramebuffers(1, &geometryFBO);
+        glGenFramebuffers(1, &lightingFBO);
+        glGenFramebuffers(1, &forwardFBO);
+        glGenVertexArrays(1, &emptyVAO);
+        resize(width, height);
+    }
+
+    void GBuffer::destroy() {
+        deleteTargets();
+        glDeleteFramebuffers(1, &geometryFBO);
+        glDeleteFramebuffers(1, &lightingFBO);
+        glDeleteFramebuffers(1, &forwardFBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        geometryFBO = lightingFBO = forwardFBO = emptyVAO = 0;
+    }
+
+    void GBuffer::resize(GLsizei width, GLsizei height) {
+        this->width = width > 0 ? width : 1;
+        this->height = height > 0 ? height : 1;
+        deleteTargets();
+        createTargets();
+    }
+
+    void GBuffer::createTargets() {
+        targets[TARGET_ALBEDO] = createTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        targets[TARGET_NORMAL] = createTarget(GL_RG16F, GL_RG, GL_FLOAT, width, height);
+        targets[TARGET_MATERIAL] = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        targets[TARGET_DEPTH] = createTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, width, height);
+        lightTexture = createTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        const GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+
+        glBindFramebuffer(GL_FRAMEBUFFER, geometryFBO);
+        for (int i = 0; i < 3; i++)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, targets[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, targets[TARGET_DEPTH], 0);
+        glDrawBuffers(3, drawBuffers);
+        checkComplete("geometry");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+        checkComplete("lighting");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, forwardFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, targets[TARGET_DEPTH], 0);
+        checkComplete("forward");
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void GBuffer::deleteTargets() {
+        glDeleteTextures(TARGET_COUNT, targets);
+        glDeleteTextures(1, &lightTexture);
+        for (int i = 0; i < TARGET_COUNT; i++)
+            targets[i] = 0;
+        lightTexture = 0;
+    }
+
+    void GBuffer::beginGeometry() {
+        glBindFramebuffer(GL_FRAMEBUFFER, geometryFBO);
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void GBuffer::beginLighting(GLuint firstUnit) {
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (GLuint i = 0; i < TARGET_COUNT; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_2D, targets[i]);
+        }
+    }
+
+    void GBuffer::drawFullscreen() {
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+    }
+
+    void GBuffer::beginForward() {
+        glBindFramebuffer(GL_FRAMEBUFFER, forwardFBO);
+    }
+
+    void GBuffer::present() {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, lightingFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+}
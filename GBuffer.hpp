@@ -0,0 +1,69 @@
+#ifndef GBuffer_hpp
+#define GBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    //render targets of the deferred path
+    //the geometry pass writes a compact G-buffer: albedo (SRGB8_ALPHA8, a = lit), an octahedral
+    //view space normal (RG16F), specular map and roughness (RGBA8) and depth (24 bit texture)
+    //the full screen resolve reads it into the light target (SRGB8_ALPHA8), then the transparent
+    //entities go on top forward, tested against the same depth, and the light target is
+    //blitted to the window
+    //three framebuffers, so no pass samples a texture attached to the one it draws into
+    class GBuffer {
+
+    public:
+        enum Target {
+            TARGET_ALBEDO,
+            TARGET_NORMAL,
+            TARGET_MATERIAL,
+            TARGET_DEPTH,
+            TARGET_COUNT
+        };
+
+        //needs a current GL context
+        void init(GLsizei width, GLsizei height);
+        void destroy();
+        //new storage for every target; the contents are lost
+        void resize(GLsizei width, GLsizei height);
+
+        //geometry framebuffer, all three color targets drawn, everything cleared
+        void beginGeometry();
+        //light target alone, cleared to the clear color; the G-buffer on units firstUnit ..
+        //firstUnit + TARGET_COUNT - 1 in Target order
+        void beginLighting(GLuint firstUnit);
+        //one triangle over the viewport, for the resolve shader in use (fullscreen.vert)
+        void drawFullscreen();
+        //light target with the G-buffer depth, for the forward passes after the resolve
+        void beginForward();
+        //light target to the default framebuffer, which is bound afterwards
+        void present();
+
+        GLsizei getWidth() const { return width; }
+        GLsizei getHeight() const { return height; }
+
+    private:
+        GLsizei width = 0;
+        GLsizei height = 0;
+
+        GLuint targets[TARGET_COUNT] = { 0, 0, 0, 0 };
+        GLuint lightTexture = 0;
+        GLuint geometryFBO = 0;
+        GLuint lightingFBO = 0;
+        GLuint forwardFBO = 0;
+        GLuint emptyVAO = 0;
+
+        void createTargets();
+        void deleteTargets();
+    };
+}
+
+#endif /* GBuffer_hpp */
@@ -0,0 +1,209 @@
+#include "IndirectRenderer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace gps {
+
+    uint32_t IndirectRenderer::addGeometry(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+        GeometryRange range;
+        range.indexCount = (GLuint)indices.size();
+        range.firstIndex = (GLuint)this->indices.size();
+        range.baseVertex = (GLint)this->vertices.size();
+
+        this->vertices.insert(this->vertices.end(), vertices.begin(), vertices.end());
+        this->indices.insert(this->indices.end(), indices.begin(), indices.end());
+
+        geometry.push_back(range);
+        return (uint32_t)geometry.size() - 1;
+    }
+
+    uint32_t IndirectRenderer::modelFirstGeometry(Model3D* model) {
+        for (const ModelGeometry& m : modelGeometry) {
+            if (m.model == model)
+                return m.firstGeometry;
+        }
+
+        //first entity using this model: its meshes go into the shared buffers once
+        uint32_t first = (uint32_t)geometry.size();
+        for (Mesh& mesh : model->getMeshes())
+            addGeometry(mesh.vertices, mesh.indices);
+        modelGeometry.push_back({ model, first });
+        return first;
+    }
+
+    void IndirectRenderer::writeRecord(uint32_t draw, const glm::mat4& model) {
+        records[draw].model = model;
+        records[draw].normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+    }
+
+    void IndirectRenderer::setLightmap(EntityId id, const glm::vec4& rect, float cellStride) {
+        for (uint32_t d = entityFirstDraw[id]; d < entityFirstDraw[id] + entityDrawCount[id]; d++) {
+            records[d].lightmapRect = rect;
+            records[d].lightmapCellStride = cellStride;
+        }
+    }
+
+    void IndirectRenderer::build(const Scene& scene, const MaterialLibrary& materials, uint32_t quadGeometry, uint32_t cubeGeometry,
+        StreamBuffer* stream) {
+
+        this->stream = stream;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &recordAlignment);
+
+        entityFirstDraw.assign(scene.size(), 0);
+        entityDrawCount.assign(scene.size(), 0);
+
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            const MeshRef& mesh = scene.meshes[id];
+            entityFirstDraw[id] = (uint32_t)drawGeometry.size();
+
+            switch (mesh.kind) {
+            case MESH_QUAD:
+            case MESH_CUBE:
+                drawGeometry.push_back(mesh.kind == MESH_QUAD ? quadGeometry : cubeGeometry);
+                drawMaterial.push_back(scene.materials[id]);
+                break;
+            case MESH_MODEL: {
+                uint32_t first = modelFirstGeometry(mesh.model);
+                std::vector<Mesh>& meshes = mesh.model->getMeshes();
+                for (size_t i = 0; i < meshes.size(); i++) {
+                    drawGeometry.push_back(first + (uint32_t)i);
+                    drawMaterial.push_back(meshes[i].materialId);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+
+            entityDrawCount[id] = (uint32_t)drawGeometry.size() - entityFirstDraw[id];
+        }
+
+        size_t drawCount = drawGeometry.size();
+        records.assign(drawCount, DrawRecord());
+        drawGroup.resize(drawCount);
+        for (uint32_t d = 0; d < (uint32_t)drawCount; d++) {
+            records[d].material = drawMaterial[d];
+            drawGroup[d] = materials.getBindGroup(drawMaterial[d]);
+        }
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            for (uint32_t d = entityFirstDraw[id]; d < entityFirstDraw[id] + entityDrawCount[id]; d++)
+                writeRecord(d, scene.worldTransforms[id]);
+        }
+
+        groupCommands.assign(std::max<uint32_t>(materials.getBindGroupCount(), 1), std::vector<DrawElementsIndirectCommand>());
+        groupMaterial.assign(groupCommands.size(), 0);
+
+        //draw index attribute: 0, 1, 2, ... fetched once per instance, so baseInstance picks the record
+        std::vector<GLuint> drawIds(std::max<size_t>(drawCount, 1));
+        for (size_t i = 0; i < drawIds.size(); i++)
+            drawIds[i] = (GLuint)i;
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glGenBuffers(1, &drawIdBuffer);
+
+        glBindVertexArray(vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+
+        glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(DRAW_ID_LOCATION);
+        glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+        glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        //the cpu copies are in the gpu buffers now
+        vertices.clear();
+        vertices.shrink_to_fit();
+        indices.clear();
+        indices.shrink_to_fit();
+    }
+
+    void IndirectRenderer::update(const Scene& scene) {
+        for (EntityId id : scene.getLastUpdated()) {
+            uint32_t first = entityFirstDraw[id];
+            for (uint32_t d = first; d < first + entityDrawCount[id]; d++)
+                writeRecord(d, scene.worldTransforms[id]);
+        }
+
+        //the whole table goes out every frame: the region it lands in rotates
+        recordOffset = stream->upload(records.data(), (GLsizeiptr)(records.size() * sizeof(DrawRecord)), recordAlignment);
+    }
+
+    void IndirectRenderer::draw(const std::vector<EntityId>& entities, MaterialLibrary* materials,
+        const std::function<void(uint32_t)>& useProgram) {
+        callCount = 0;
+        meshCount = 0;
+
+        for (std::vector<DrawElementsIndirectCommand>& list : groupCommands)
+            list.clear();
+
+        for (EntityId id : entities) {
+            uint32_t first = entityFirstDraw[id];
+            for (uint32_t d = first; d < first + entityDrawCount[id]; d++) {
+                const GeometryRange& g = geometry[drawGeometry[d]];
+                uint32_t group = materials ? drawGroup[d] : 0;
+
+                groupCommands[group].push_back({ g.indexCount, 1, g.firstIndex, g.baseVertex, d });
+                groupMaterial[group] = drawMaterial[d];
+            }
+        }
+
+        commands.clear();
+        for (const std::vector<DrawElementsIndirectCommand>& list : groupCommands)
+            commands.insert(commands.end(), list.begin(), list.end());
+        if (commands.empty())
+            return;
+
+        GLsizeiptr bytes = (GLsizeiptr)(commands.size() * sizeof(DrawElementsIndirectCommand));
+        GLintptr commandOffset = stream->upload(commands.data(), bytes, sizeof(GLuint));
+        if (commandOffset < 0 || recordOffset < 0)
+            return;
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stream->getBuffer());
+
+        glBindVertexArray(vao);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_RECORD_BINDING, stream->getBuffer(),
+            recordOffset, (GLsizeiptr)(records.size() * sizeof(DrawRecord)));
+        if (materials)
+            materials->bindTable();
+
+        size_t offset = (size_t)commandOffset;
+        for (size_t group = 0; group < groupCommands.size(); group++) {
+            GLsizei count = (GLsizei)groupCommands[group].size();
+            if (count == 0)
+                continue;
+
+            if (materials && useProgram)
+                useProgram(groupMaterial[group]);
+            if (materials)
+                materials->bind(groupMaterial[group]);
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (const void*)offset, count, 0);
+
+            offset += count * sizeof(DrawElementsIndirectCommand);
+            callCount++;
+        }
+        meshCount = (unsigned)commands.size();
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef IndirectRenderer_hpp
+#define IndirectRenderer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+#include "Scene.hpp"
+#include "Material.hpp"
+#include "StreamBuffer.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    //layout fixed by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    //std430 image of DrawRecord in basic_indirect.vert / shadow_depth_indirect.vert
+    struct DrawRecord {
+        glm::mat4 model;
+        glm::mat4 normalMatrix;     // inverse transpose of model, upper 3x3 used
+        glm::vec4 lightmapRect;     // see setLightmap()
+        GLuint material;
+        GLfloat lightmapCellStride;
+        GLuint pad[2];
+    };
+
+    //storage buffer binding point of the draw records
+    const GLuint DRAW_RECORD_BINDING = 0;
+    //vertex attribute carrying the draw index (instanced, so it reads baseInstance)
+    const GLuint DRAW_ID_LOCATION = 3;
+
+    //GL 4.3 submission path: every mesh lives in one shared vertex/index buffer, every draw has a
+    //record (model matrix, material) in a storage buffer, and a pass goes out as
+    //glMultiDrawElementsIndirect calls instead of one draw per mesh
+    //the shaders find their record through a per-instance attribute sourced from baseInstance,
+    //which works without gl_DrawID (GL 4.6 / ARB_shader_draw_parameters)
+    class IndirectRenderer {
+
+    public:
+        //copies the geometry into the shared buffers and returns its id; only before build()
+        uint32_t addGeometry(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+
+        //creates one draw per quad/cube entity and per mesh of every model entity and uploads
+        //the geometry; model meshes must already have their material ids
+        //records and commands are streamed through the given buffer every frame
+        void build(const Scene& scene, const MaterialLibrary& materials, uint32_t quadGeometry, uint32_t cubeGeometry,
+            StreamBuffer* stream);
+
+        //rewrites the records of the entities moved by the last Scene::updateTransforms() and
+        //streams the record table into this frame's region; once per frame, after beginFrame()
+        void update(const Scene& scene);
+
+        //where the draws of an entity find their lightmap (LIGHTMAP shader variants): atlas uv of
+        //its first cell, xy corner and zw size, and the step to each next cell (cube faces)
+        void setLightmap(EntityId id, const glm::vec4& rect, float cellStride);
+
+        //draws every mesh of the given entities
+        //with materials: one multi-draw per material bind group (textures can't change inside a call)
+        //without (depth only passes): a single multi-draw
+        //useProgram, if given, is called with each group's material before its multi-draw and
+        //makes the program for it current (the group members share their fragment flags)
+        void draw(const std::vector<EntityId>& entities, MaterialLibrary* materials,
+            const std::function<void(uint32_t)>& useProgram = nullptr);
+
+        size_t getDrawCount() const { return drawGeometry.size(); }
+
+        //multi-draw calls / meshes issued by the last draw()
+        unsigned getCallCount() const { return callCount; }
+        unsigned getMeshCount() const { return meshCount; }
+
+    private:
+        struct GeometryRange {
+            GLuint indexCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+        };
+
+        struct ModelGeometry {
+            const Model3D* model;
+            uint32_t firstGeometry;
+        };
+
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        std::vector<GeometryRange> geometry;
+        std::vector<ModelGeometry> modelGeometry;
+
+        //per draw
+        std::vector<uint32_t> drawGeometry;
+        std::vector<uint32_t> drawMaterial;
+        std::vector<uint32_t> drawGroup;
+        std::vector<DrawRecord> records;
+
+        //per entity: its draws are [entityFirstDraw[id], entityFirstDraw[id] + entityDrawCount[id])
+        std::vector<uint32_t> entityFirstDraw;
+        std::vector<uint32_t> entityDrawCount;
+
+        //scratch for draw(), one command list per bind group
+        std::vector<std::vector<DrawElementsIndirectCommand>> groupCommands;
+        std::vector<uint32_t> groupMaterial;
+        std::vector<DrawElementsIndirectCommand> commands;
+
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        GLuint ebo = 0;
+        GLuint drawIdBuffer = 0;
+
+        StreamBuffer* stream = nullptr;
+        GLint recordAlignment = 256;
+        GLintptr recordOffset = -1;
+
+        unsigned callCount = 0;
+        unsigned meshCount = 0;
+
+        uint32_t modelFirstGeometry(Model3D* model);
+        void writeRecord(uint32_t draw, const glm::mat4& model);
+    };
+}
+
+#endif /* IndirectRenderer_hpp */
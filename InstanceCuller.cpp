@@ -0,0 +1,142 @@
+#include "InstanceCuller.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+
+namespace gps {
+
+    void InstanceCuller::init(GLsizei capacity, bool allowIndirect, GLuint meshBuffer, GLsizei meshStride, GLsizei meshVertexCount) {
+        this->capacity = capacity;
+        this->meshVertexCount = meshVertexCount;
+
+        //writing storage buffers and atomic counters from a vertex shader is optional even on 4.3
+        GLint vertexAtomics = 0, vertexStorageBlocks = 0;
+        if (allowIndirect) {
+            glGetIntegerv(GL_MAX_VERTEX_ATOMIC_COUNTERS, &vertexAtomics);
+            glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertexStorageBlocks);
+        }
+        path = (vertexAtomics > 0 && vertexStorageBlocks > 0) ? PATH_ATOMIC_INDIRECT : PATH_TRANSFORM_FEEDBACK;
+
+        if (path == PATH_ATOMIC_INDIRECT)
+            cullShader.loadShader("shaders/instance_cull_atomic.vert", "", "", {});
+        else
+            cullShader.loadShader("shaders/instance_cull.vert", "shaders/instance_cull.geom", "", { "culledInstance" });
+        planesLoc = glGetUniformLocation(cullShader.shaderProgram, "frustumPlanes");
+        radiusLoc = glGetUniformLocation(cullShader.shaderProgram, "instanceRadius");
+
+        glGenVertexArrays(1, &cullVAO);
+        glBindVertexArray(cullVAO);
+        for (GLuint loc = 0; loc < 3; loc++)
+            glEnableVertexAttribArray(loc);
+
+        glGenBuffers(1, &instanceBuffer);
+        glGenVertexArrays(1, &drawVAO);
+        glBindVertexArray(drawVAO);
+
+        if (path == PATH_ATOMIC_INDIRECT) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            glBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, meshStride, (void*)0);
+            glEnableVertexAttribArray(0);
+
+            DrawArraysIndirectCommand cmd = { (GLuint)meshVertexCount, 0, 0, 0 };
+            glGenBuffers(1, &commandBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(cmd), &cmd, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        else {
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+            glEnableVertexAttribArray(1);
+
+            glGenTransformFeedbacks(1, &feedback);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, instanceBuffer);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        }
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void InstanceCuller::destroy() {
+        if (cullShader.shaderProgram != 0)
+            glDeleteProgram(cullShader.shaderProgram);
+        glDeleteVertexArrays(1, &cullVAO);
+        glDeleteVertexArrays(1, &drawVAO);
+        glDeleteBuffers(1, &instanceBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteTransformFeedbacks(1, &feedback);
+
+        cullShader.shaderProgram = 0;
+        cullVAO = drawVAO = instanceBuffer = commandBuffer = feedback = 0;
+    }
+
+    void InstanceCuller::cull(const Frustum& frustum, GLuint sourceBuffer, const GLintptr offsets[3], GLsizei count, float radius) {
+        if (count > capacity)
+            count = capacity;
+
+        //normalized planes, so the signed distance compares straight against the radius
+        glm::vec4 planes[6];
+        for (int i = 0; i < 6; i++)
+            planes[i] = frustum.planes[i] / glm::length(glm::vec3(frustum.planes[i]));
+
+        cullShader.useShaderProgram();
+        glUniform4fv(planesLoc, 6, glm::value_ptr(planes[0]));
+        glUniform1f(radiusLoc, radius);
+
+        glBindVertexArray(cullVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, sourceBuffer);
+        for (GLuint loc = 0; loc < 3; loc++)
+            glVertexAttribPointer(loc, 1, GL_FLOAT, GL_FALSE, 0, (void*)offsets[loc]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnable(GL_RASTERIZER_DISCARD);
+
+        if (path == PATH_ATOMIC_INDIRECT) {
+            //instanceCount back to zero; the shader counts the survivors into it
+            const GLuint zero = 0;
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, commandBuffer);
+            glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, offsetof(DrawArraysIndirectCommand, instanceCount), sizeof(zero), &zero);
+            glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, commandBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULLED_INSTANCE_BINDING, instanceBuffer);
+
+            glDrawArrays(GL_POINTS, 0, count);
+        }
+        else {
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, count);
+            glEndTransformFeedback();
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        }
+
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(0);
+    }
+
+    void InstanceCuller::draw() {
+        glBindVertexArray(drawVAO);
+
+        if (path == PATH_ATOMIC_INDIRECT) {
+            //the command and the instances were written by shader invocations
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULLED_INSTANCE_BINDING, instanceBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glDrawArraysIndirect(GL_TRIANGLES, (void*)0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        else {
+            //vertex count comes from the feedback object, the cpu never learns it
+            glDrawTransformFeedback(GL_POINTS, feedback);
+        }
+
+        glBindVertexArray(0);
+    }
+}
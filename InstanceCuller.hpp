@@ -0,0 +1,81 @@
+#ifndef InstanceCuller_hpp
+#define InstanceCuller_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Culling.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    //storage buffer binding point of the surviving instances (GL 4.3 path)
+    const GLuint CULLED_INSTANCE_BINDING = 2;
+
+    //frustum culling of instances on the gpu, so the cpu cost of an instanced draw doesn't grow
+    //with the instance count
+    //an instance is a sphere of a shared radius whose center comes from three float streams
+    //(the SoA layout of gps::ParticleSystem); one point per instance goes through a vertex
+    //shader that tests it against the frustum planes
+    //GL 4.1: a geometry shader drops the failed points and the survivors (vec4 center) are
+    //captured by transform feedback, then drawn with glDrawTransformFeedback as points
+    //GL 4.3: the vertex shader appends survivors to a storage buffer through an atomic counter
+    //that is the instanceCount of an indirect command, drawn with glDrawArraysIndirect
+    class InstanceCuller {
+
+    public:
+        enum Path {
+            PATH_TRANSFORM_FEEDBACK,
+            PATH_ATOMIC_INDIRECT
+        };
+
+        //capacity: most instances per cull(); allowIndirect: the context is 4.3+
+        //mesh: drawn once per instance on the indirect path, positions at attribute 0
+        //needs a current GL context
+        void init(GLsizei capacity, bool allowIndirect, GLuint meshBuffer, GLsizei meshStride, GLsizei meshVertexCount);
+        void destroy();
+
+        //tests count instances whose centers are the floats at offsets[0..2] of sourceBuffer;
+        //no cpu work per instance and no readback
+        void cull(const Frustum& frustum, GLuint sourceBuffer, const GLintptr offsets[3], GLsizei count, float radius);
+
+        //draws the survivors of the last cull() with the program in use
+        //transform feedback path: GL_POINTS, one vertex per instance, vec4 center at attribute 1;
+        //the program expands each point
+        //indirect path: GL_TRIANGLES, the mesh per instance, centers in the CULLED_INSTANCE_BINDING
+        //storage buffer indexed by gl_InstanceID
+        void draw();
+
+        Path getPath() const { return path; }
+
+    private:
+        //layout fixed by glDrawArraysIndirect
+        struct DrawArraysIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint first;
+            GLuint baseInstance;
+        };
+
+        Path path = PATH_TRANSFORM_FEEDBACK;
+        GLsizei capacity = 0;
+        GLsizei meshVertexCount = 0;
+
+        Shader cullShader;
+        GLint planesLoc = -1;
+        GLint radiusLoc = -1;
+
+        GLuint cullVAO = 0;         // the three center streams, rebound every cull()
+        GLuint drawVAO = 0;         // captured centers (feedback path) or the mesh (indirect path)
+        GLuint instanceBuffer = 0;  // captured / appended centers
+        GLuint feedback = 0;        // transform feedback object, remembers the captured count
+        GLuint commandBuffer = 0;   // indirect command, doubles as the atomic counter buffer
+    };
+}
+
+#endif /* InstanceCuller_hpp */
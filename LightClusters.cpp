@@ -0,0 +1,218 @@
+#include "LightClusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        bool sphereTouchesBox(const glm::vec3& c, float r, const AABB& box) {
+            glm::vec3 closest = glm::clamp(c, box.minCorner, box.maxCorner);
+            glm::vec3 d = c - closest;
+            return glm::dot(d, d) <= r * r;
+        }
+
+        //cone (apex, direction, cos / sin of the half angle, length) against a sphere
+        bool coneTouchesSphere(const glm::vec3& apex, const glm::vec3& dir, float cosA, float sinA,
+            float length, const glm::vec3& c, float r) {
+            glm::vec3 v = c - apex;
+            float along = glm::dot(v, dir);
+            float across = std::sqrt(std::max(glm::dot(v, v) - along * along, 0.0f));
+            float distance = cosA * across - sinA * along;
+
+            return !(distance > r || along > length + r || along < -r);
+        }
+    }
+
+    void LightClusters::init() {
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i = 0; i < 3; i++) {
+            //never empty, a buffer texture over no storage is incomplete
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        grid.assign(CLUSTER_COUNT, glm::uvec2(0));
+        clusterCounts.assign(CLUSTER_COUNT, 0);
+        sliceIndices.assign(GRID_Z, std::vector<uint32_t>());
+    }
+
+    void LightClusters::destroy() {
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+        for (int i = 0; i < 3; i++)
+            textures[i] = buffers[i] = 0;
+    }
+
+    float LightClusters::sliceNear(int slice) const {
+        return nearPlane * std::pow(farPlane / nearPlane, (float)slice / (float)GRID_Z);
+    }
+
+    int LightClusters::sliceOf(float depth) const {
+        if (depth <= nearPlane)
+            return 0;
+        int z = (int)std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * (float)GRID_Z);
+        return std::min(z, GRID_Z - 1);
+    }
+
+    void LightClusters::setProjection(const glm::mat4& projection, float nearPlane, float farPlane) {
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        projX = projection[0][0];
+        projY = projection[1][1];
+
+        //the 4 tile corners at the slice's near and far depth (view space looks down -z)
+        clusterBounds.assign(CLUSTER_COUNT, AABB());
+        for (int z = 0; z < GRID_Z; z++) {
+            float depths[2] = { sliceNear(z), sliceNear(z + 1) };
+            for (int y = 0; y < GRID_Y; y++) {
+                for (int x = 0; x < GRID_X; x++) {
+                    AABB& box = clusterBounds[x + GRID_X * (y + GRID_Y * z)];
+                    for (float d : depths) {
+                        for (int c = 0; c < 4; c++) {
+                            float ndcX = -1.0f + 2.0f * (float)(x + (c & 1)) / (float)GRID_X;
+                            float ndcY = -1.0f + 2.0f * (float)(y + (c >> 1)) / (float)GRID_Y;
+                            box.expand(glm::vec3(ndcX * d / projX, ndcY * d / projY, -d));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void LightClusters::update(const std::vector<ClusterSpot>& lights, const glm::mat4& view, ThreadPool* pool) {
+        lightCount = lights.size();
+        viewLights.resize(lights.size());
+        lightTexels.resize(lights.size() * LIGHT_TEXELS);
+
+        for (size_t i = 0; i < lights.size(); i++) {
+            const ClusterSpot& s = lights[i];
+            ViewLight& v = viewLights[i];
+            v.position = glm::vec3(view * glm::vec4(s.position, 1.0f));
+            v.direction = glm::normalize(glm::vec3(view * glm::vec4(s.direction, 0.0f)));
+            v.cosOuter = s.cosOuter;
+            v.sinOuter = std::sqrt(std::max(1.0f - s.cosOuter * s.cosOuter, 0.0f));
+            v.range = s.range;
+
+            //smallest sphere around the cone: a wide cone's is centered on its cap
+            if (s.cosOuter < 0.7071f) {
+                v.sphereCenter = v.position + v.direction * (s.range * s.cosOuter);
+                v.sphereRadius = s.range * v.sinOuter;
+            }
+            else {
+                float half = s.range / (2.0f * s.cosOuter);
+                v.sphereCenter = v.position + v.direction * half;
+                v.sphereRadius = half;
+            }
+
+            glm::vec4* t = &lightTexels[i * LIGHT_TEXELS];
+            t[0] = glm::vec4(v.position, s.range);
+            t[1] = glm::vec4(v.direction, s.cosOuter);
+            t[2] = glm::vec4(s.color, s.cosInner);
+            t[3] = glm::vec4(s.constant, s.linear, s.quadratic, (float)s.shadow);
+        }
+
+        //slices are independent; each fills its own index list and its clusters' counts
+        if (pool)
+            pool->parallelFor(GRID_Z, 1, [this](size_t begin, size_t end) {
+                for (size_t z = begin; z < end; z++)
+                    assignSlice((int)z);
+            });
+        else
+            for (int z = 0; z < GRID_Z; z++)
+                assignSlice(z);
+
+        indices.clear();
+        maxClusterLights = 0;
+        for (int z = 0; z < GRID_Z; z++) {
+            uint32_t offset = (uint32_t)indices.size();
+            for (int c = 0; c < GRID_X * GRID_Y; c++) {
+                int cluster = c + GRID_X * GRID_Y * z;
+                grid[cluster] = glm::uvec2(offset, clusterCounts[cluster]);
+                offset += clusterCounts[cluster];
+                maxClusterLights = std::max(maxClusterLights, clusterCounts[cluster]);
+            }
+            indices.insert(indices.end(), sliceIndices[z].begin(), sliceIndices[z].end());
+        }
+
+        upload(buffers[0], lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+        upload(buffers[1], grid.data(), grid.size() * sizeof(glm::uvec2));
+        upload(buffers[2], indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    void LightClusters::assignSlice(int z) {
+        const int tiles = GRID_X * GRID_Y;
+        float d0 = sliceNear(z), d1 = sliceNear(z + 1);
+
+        //per tile lists of this slice, then flattened in cluster order
+        std::vector<uint32_t>& out = sliceIndices[z];
+        std::vector<std::vector<uint32_t>> tileLights(tiles);
+
+        for (uint32_t i = 0; i < (uint32_t)viewLights.size(); i++) {
+            const ViewLight& v = viewLights[i];
+            float nearest = -v.sphereCenter.z - v.sphereRadius;
+            float farthest = -v.sphereCenter.z + v.sphereRadius;
+            if (farthest < d0 || nearest > d1)
+                continue;
+
+            //tile range of the sphere's view space box, projected at whichever depth in the
+            //slice makes each edge widest
+            float dMin = std::max(std::max(nearest, d0), nearPlane);
+            float dMax = std::min(farthest, d1);
+            glm::vec2 lo = glm::vec2(v.sphereCenter.x, v.sphereCenter.y) - v.sphereRadius;
+            glm::vec2 hi = glm::vec2(v.sphereCenter.x, v.sphereCenter.y) + v.sphereRadius;
+            float x0 = projX * lo.x / (lo.x < 0.0f ? dMin : dMax);
+            float x1 = projX * hi.x / (hi.x > 0.0f ? dMin : dMax);
+            float y0 = projY * lo.y / (lo.y < 0.0f ? dMin : dMax);
+            float y1 = projY * hi.y / (hi.y > 0.0f ? dMin : dMax);
+
+            int tx0 = std::max(0, (int)std::floor((x0 * 0.5f + 0.5f) * GRID_X));
+            int tx1 = std::min(GRID_X - 1, (int)std::floor((x1 * 0.5f + 0.5f) * GRID_X));
+            int ty0 = std::max(0, (int)std::floor((y0 * 0.5f + 0.5f) * GRID_Y));
+            int ty1 = std::min(GRID_Y - 1, (int)std::floor((y1 * 0.5f + 0.5f) * GRID_Y));
+
+            for (int y = ty0; y <= ty1; y++) {
+                for (int x = tx0; x <= tx1; x++) {
+                    const AABB& box = clusterBounds[x + GRID_X * (y + GRID_Y * z)];
+                    if (!sphereTouchesBox(v.sphereCenter, v.sphereRadius, box))
+                        continue;
+                    glm::vec3 c = box.center();
+                    float r = glm::length(box.extents());
+                    if (!coneTouchesSphere(v.position, v.direction, v.cosOuter, v.sinOuter, v.range, c, r))
+                        continue;
+                    tileLights[x + GRID_X * y].push_back(i);
+                }
+            }
+        }
+
+        out.clear();
+        for (int t = 0; t < tiles; t++) {
+            clusterCounts[t + tiles * z] = (uint32_t)tileLights[t].size();
+            out.insert(out.end(), tileLights[t].begin(), tileLights[t].end());
+        }
+    }
+
+    void LightClusters::upload(GLuint buffer, const void* data, size_t bytes) {
+        //orphaned every frame; the texture keeps pointing at the buffer object
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)bytes, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::bind(GLuint firstUnit) const {
+        for (GLuint i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //a spotlight as clustered shading sees it, in world space
+    struct ClusterSpot {
+        glm::vec3 position;
+        glm::vec3 direction;        // where it points
+        glm::vec3 color;            // already scaled by the intensity
+        float cosInner;
+        float cosOuter;
+        float constant;
+        float linear;
+        float quadratic;
+        float range;                // no light past it (the falloff is windowed down to 0)
+        int shadow;                 // slot of its shadow, -1 if it has none
+    };
+
+    //clustered forward shading of spotlights
+    //the view frustum is cut into GRID_X x GRID_Y screen tiles and GRID_Z slices spaced
+    //logarithmically in depth; every frame the lights are moved to view space once and each
+    //cluster gets the list of lights whose cone touches it, so a fragment loops over the lights
+    //of its own cluster only
+    //the lists are built on the cpu, one depth slice per task, and read by the fragment shader
+    //from three buffer textures (GL 3.1, no storage buffers needed):
+    //  lights   RGBA32F, LIGHT_TEXELS per light (view space position / range, direction / cos
+    //           outer, color / cos inner, attenuation / shadow slot)
+    //  grid     RG32UI, per cluster the first index and the count
+    //  indices  R32UI, the light indices of all clusters back to back
+    class LightClusters {
+
+    public:
+        static const int GRID_X = 16;
+        static const int GRID_Y = 9;
+        static const int GRID_Z = 24;
+        static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+        static const int LIGHT_TEXELS = 4;
+
+        //needs a current GL context
+        void init();
+        void destroy();
+
+        //view space bounds of the clusters for a symmetric perspective projection; again
+        //whenever it changes
+        void setProjection(const glm::mat4& projection, float nearPlane, float farPlane);
+
+        //moves the lights to view space, assigns them to the clusters (spread over pool when
+        //given) and uploads the three buffers
+        void update(const std::vector<ClusterSpot>& lights, const glm::mat4& view, ThreadPool* pool);
+
+        //the lights, grid and index buffer textures on units firstUnit, firstUnit + 1, + 2
+        void bind(GLuint firstUnit) const;
+
+        float getNearPlane() const { return nearPlane; }
+        float getFarPlane() const { return farPlane; }
+
+        //last update(): lights, light / cluster pairs, most lights in one cluster
+        size_t getLightCount() const { return lightCount; }
+        size_t getIndexCount() const { return indices.size(); }
+        uint32_t getMaxClusterLights() const { return maxClusterLights; }
+
+    private:
+        struct ViewLight {
+            glm::vec3 position;
+            glm::vec3 direction;
+            float cosOuter;
+            float sinOuter;
+            float range;
+            glm::vec3 sphereCenter;     // bounding sphere of the cone
+            float sphereRadius;
+        };
+
+        float nearPlane = 0.1f;
+        float farPlane = 100.0f;
+        float projX = 1.0f;             // projection[0][0], ndc x = projX * x / depth
+        float projY = 1.0f;
+
+        std::vector<AABB> clusterBounds;
+        std::vector<ViewLight> viewLights;
+
+        std::vector<glm::vec4> lightTexels;
+        std::vector<glm::uvec2> grid;
+        std::vector<uint32_t> indices;
+        std::vector<std::vector<uint32_t>> sliceIndices;    // per slice, filled in parallel
+        std::vector<uint32_t> clusterCounts;
+
+        size_t lightCount = 0;
+        uint32_t maxClusterLights = 0;
+
+        GLuint buffers[3] = { 0, 0, 0 };
+        GLuint textures[3] = { 0, 0, 0 };
+
+        int sliceOf(float depth) const;
+        float sliceNear(int slice) const;
+        void assignSlice(int z);
+        static void upload(GLuint buffer, const void* data, size_t bytes);
+    };
+}
+
+#endif /* LightClusters_hpp */
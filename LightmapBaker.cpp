@@ -0,0 +1,388 @@
+#include "LightmapBaker.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace gps {
+
+    namespace {
+
+        const uint32_t LIGHTMAP_MAGIC = 0x314D4C47u;   // "GLM1"
+        const float RAY_OFFSET = 1e-3f;                 // off the surface, against self hits
+        const float PI = 3.14159265358979f;
+
+        //FNV-1a over raw bytes, chained through h
+        void hashBytes(uint64_t& h, const void* data, size_t size) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                h ^= bytes[i];
+                h *= 1099511628211ull;
+            }
+        }
+
+        template <typename T>
+        void hashValue(uint64_t& h, const T& value) {
+            hashBytes(h, &value, sizeof(value));
+        }
+
+        //small counter based generator, one stream per texel
+        struct Random {
+            uint32_t state;
+
+            explicit Random(uint32_t seed) : state(seed * 747796405u + 2891336453u) {}
+
+            float next() {
+                //pcg hash of the advancing state
+                state = state * 747796405u + 2891336453u;
+                uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+                word = (word >> 22u) ^ word;
+                return (word >> 8) * (1.0f / 16777216.0f);
+            }
+        };
+
+        //cosine weighted direction around n, so the estimate of the irradiance over pi is
+        //just the mean of the returned light
+        glm::vec3 sampleCosine(const glm::vec3& n, Random& random) {
+            float r = std::sqrt(random.next());
+            float phi = 2.0f * PI * random.next();
+            float x = r * std::cos(phi);
+            float y = r * std::sin(phi);
+            float z = std::sqrt(std::max(0.0f, 1.0f - x * x - y * y));
+
+            //orthonormal basis around n without a branch on the dominant axis (Duff et al.)
+            float sign = std::copysign(1.0f, n.z);
+            float a = -1.0f / (sign + n.z);
+            float b = n.x * n.y * a;
+            glm::vec3 t(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+            glm::vec3 bt(b, sign + n.y * n.y * a, -n.y);
+            return glm::normalize(t * x + bt * y + n * z);
+        }
+    }
+
+    void LightmapBaker::addOccluder(const std::vector<glm::vec3>& triangles, const glm::vec3& albedo) {
+        uint32_t surface = (uint32_t)surfaceAlbedo.size();
+        surfaceAlbedo.push_back(albedo);
+        vertices.insert(vertices.end(), triangles.begin(), triangles.end());
+        triangleSurface.insert(triangleSurface.end(), triangles.size() / 3, surface);
+    }
+
+    uint32_t LightmapBaker::addChart(const std::vector<LightmapFace>& faces, const glm::vec3& albedo) {
+        std::vector<glm::vec3> triangles;
+        for (const LightmapFace& f : faces) {
+            glm::vec3 p00 = f.origin, p10 = f.origin + f.axisS;
+            glm::vec3 p11 = p10 + f.axisT, p01 = f.origin + f.axisT;
+            triangles.insert(triangles.end(), { p00, p10, p11, p00, p11, p01 });
+        }
+        addOccluder(triangles, albedo);
+
+        Chart chart;
+        chart.firstFace = (uint32_t)this->faces.size();
+        chart.faceCount = (uint32_t)faces.size();
+        chart.surface = (uint32_t)surfaceAlbedo.size() - 1;
+
+        uint32_t id = (uint32_t)charts.size();
+        charts.push_back(chart);
+        this->faces.insert(this->faces.end(), faces.begin(), faces.end());
+        faceChart.insert(faceChart.end(), faces.size(), id);
+        return id;
+    }
+
+    void LightmapBaker::addLight(const BakeLight& light) {
+        lights.push_back(light);
+    }
+
+    bool LightmapBaker::pack(const LightmapSettings& settings) {
+        this->settings = settings;
+
+        //fewer texels per meter until everything fits; a quarter less each step
+        bool placed = false;
+        for (float density = settings.texelsPerMeter; density >= 1.0f && !placed; density *= 0.75f) {
+            placed = place(density);
+            texelsPerMeter = density;
+        }
+        if (!placed)
+            return false;
+
+        bvh.build(vertices, nullptr, 4);
+
+        key = 14695981039346656037ull;
+        hashValue(key, settings.atlasSize);
+        hashValue(key, settings.padding);
+        hashValue(key, settings.samples);
+        hashValue(key, settings.bounces);
+        hashValue(key, settings.aoDistance);
+        hashValue(key, settings.skyRadiance);
+        hashValue(key, texelsPerMeter);
+        hashBytes(key, faces.data(), faces.size() * sizeof(LightmapFace));
+        hashBytes(key, vertices.data(), vertices.size() * sizeof(glm::vec3));
+        hashBytes(key, triangleSurface.data(), triangleSurface.size() * sizeof(uint32_t));
+        hashBytes(key, surfaceAlbedo.data(), surfaceAlbedo.size() * sizeof(glm::vec3));
+        for (const BakeLight& l : lights) {
+            hashValue(key, l.kind);
+            hashValue(key, l.position);
+            hashValue(key, l.direction);
+            hashValue(key, l.color);
+            hashValue(key, l.cosInner);
+            hashValue(key, l.cosOuter);
+            hashValue(key, l.constant);
+            hashValue(key, l.linear);
+            hashValue(key, l.quadratic);
+            hashValue(key, l.range);
+            hashValue(key, l.direct);
+        }
+        return true;
+    }
+
+    bool LightmapBaker::place(float density) {
+        const int size = settings.atlasSize;
+        const int pad = settings.padding;
+
+        //cells as large as the chart's largest face, at least 2x2 texels
+        for (Chart& c : charts) {
+            float s = 0.0f, t = 0.0f;
+            for (uint32_t f = c.firstFace; f < c.firstFace + c.faceCount; f++) {
+                s = std::max(s, glm::length(faces[f].axisS));
+                t = std::max(t, glm::length(faces[f].axisT));
+            }
+            c.cellWidth = std::max(2, (int)std::ceil(s * density));
+            c.cellHeight = std::max(2, (int)std::ceil(t * density));
+        }
+
+        //shelves, tallest charts first so each shelf wastes little height
+        std::vector<uint32_t> byHeight(charts.size());
+        for (uint32_t i = 0; i < (uint32_t)charts.size(); i++)
+            byHeight[i] = i;
+        std::stable_sort(byHeight.begin(), byHeight.end(), [this](uint32_t a, uint32_t b) {
+            return charts[a].cellHeight > charts[b].cellHeight;
+            });
+
+        int x = 0, y = 0, shelfHeight = 0;
+        for (uint32_t id : byHeight) {
+            Chart& c = charts[id];
+            int w = (int)c.faceCount * (c.cellWidth + 2 * pad);
+            int h = c.cellHeight + 2 * pad;
+            if (w > size)
+                return false;
+            if (x + w > size) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (y + h > size)
+                return false;
+
+            c.x = x;
+            c.y = y;
+            x += w;
+            shelfHeight = std::max(shelfHeight, h);
+        }
+
+        texelFace.assign((size_t)size * size, -1);
+        for (const Chart& c : charts) {
+            for (uint32_t k = 0; k < c.faceCount; k++) {
+                int x0 = c.x + (int)k * (c.cellWidth + 2 * pad) + pad;
+                int y0 = c.y + pad;
+                for (int ty = y0; ty < y0 + c.cellHeight; ty++) {
+                    for (int tx = x0; tx < x0 + c.cellWidth; tx++)
+                        texelFace[(size_t)ty * size + tx] = (int32_t)(c.firstFace + k);
+                }
+            }
+        }
+        return true;
+    }
+
+    glm::vec4 LightmapBaker::getChartRect(uint32_t chart) const {
+        const Chart& c = charts[chart];
+        float size = (float)settings.atlasSize;
+        float pad = (float)settings.padding;
+        return glm::vec4((c.x + pad) / size, (c.y + pad) / size, c.cellWidth / size, c.cellHeight / size);
+    }
+
+    float LightmapBaker::getCellStride(uint32_t chart) const {
+        const Chart& c = charts[chart];
+        return c.faceCount > 1 ? (c.cellWidth + 2.0f * settings.padding) / settings.atlasSize : 0.0f;
+    }
+
+    //what max(dot(n, l), 0) * color sums to over the lights at p, with shadow rays
+    glm::vec3 LightmapBaker::directLight(const glm::vec3& p, const glm::vec3& n, bool bakedOnly) const {
+        glm::vec3 sum(0.0f);
+        glm::vec3 origin = p + n * RAY_OFFSET;
+
+        for (const BakeLight& light : lights) {
+            if (bakedOnly && !light.direct)
+                continue;
+
+            if (light.kind == BakeLight::DIRECTIONAL) {
+                glm::vec3 l = glm::normalize(light.direction);
+                float ndl = glm::dot(n, l);
+                if (ndl > 0.0f && !bvh.occluded({ origin, l, FLT_MAX }))
+                    sum += ndl * light.color;
+                continue;
+            }
+
+            glm::vec3 toLight = light.position - p;
+            float dist = glm::length(toLight);
+            if (dist >= light.range || dist <= 0.0f)
+                continue;
+            glm::vec3 l = toLight / dist;
+            float ndl = glm::dot(n, l);
+            if (ndl <= 0.0f)
+                continue;
+
+            float theta = glm::dot(l, -glm::normalize(light.direction));
+            float cone = glm::clamp((theta - light.cosOuter) / std::max(light.cosInner - light.cosOuter, 1e-6f), 0.0f, 1.0f);
+            if (cone <= 0.0f)
+                continue;
+
+            float att = 1.0f / (light.constant + light.linear * dist + light.quadratic * dist * dist);
+            float fade = glm::clamp(1.0f - std::pow(dist / light.range, 4.0f), 0.0f, 1.0f);
+            att *= fade * fade;
+
+            if (!bvh.occluded({ origin, toLight, 1.0f - RAY_OFFSET }))
+                sum += ndl * cone * att * light.color;
+        }
+        return sum;
+    }
+
+    glm::vec4 LightmapBaker::traceTexel(const glm::vec3& p, const glm::vec3& n, uint32_t seed) const {
+        Random random(seed);
+        glm::vec3 bounced(0.0f);
+        int open = 0;
+
+        for (int s = 0; s < settings.samples; s++) {
+            glm::vec3 origin = p + n * RAY_OFFSET;
+            glm::vec3 dir = sampleCosine(n, random);
+            glm::vec3 throughput(1.0f);
+
+            for (int bounce = 0; bounce < settings.bounces; bounce++) {
+                RayHit hit;
+                if (!bvh.intersect({ origin, dir, FLT_MAX }, hit)) {
+                    bounced += throughput * settings.skyRadiance;
+                    if (bounce == 0)
+                        open++;
+                    break;
+                }
+                if (bounce == 0 && hit.t > settings.aoDistance)
+                    open++;
+
+                //the lambert brdf over the cosine pdf leaves just the albedo
+                glm::vec3 y = origin + dir * hit.t;
+                glm::vec3 ny = bvh.getNormal(hit.triangle);
+                if (glm::dot(ny, dir) > 0.0f)
+                    ny = -ny;
+                glm::vec3 albedo = surfaceAlbedo[triangleSurface[hit.triangle]];
+
+                bounced += throughput * albedo * directLight(y, ny, false);
+                throughput *= albedo;
+
+                origin = y + ny * RAY_OFFSET;
+                dir = sampleCosine(ny, random);
+            }
+        }
+
+        float inv = settings.samples > 0 ? 1.0f / settings.samples : 0.0f;
+        glm::vec3 light = directLight(p, n, true) + bounced * inv;
+        return glm::vec4(light, settings.samples > 0 ? open * inv : 1.0f);
+    }
+
+    void LightmapBaker::bake(ThreadPool& pool) {
+        const int size = settings.atlasSize;
+        const int pad = settings.padding;
+        texels.assign((size_t)size * size, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+        pool.parallelFor((size_t)size, 1, [&](size_t begin, size_t end) {
+            for (int ty = (int)begin; ty < (int)end; ty++) {
+                for (int tx = 0; tx < size; tx++) {
+                    size_t index = (size_t)ty * size + tx;
+                    int32_t f = texelFace[index];
+                    if (f < 0)
+                        continue;
+
+                    //texel center in the face's own (s, t)
+                    const Chart& c = charts[faceChart[f]];
+                    int x0 = c.x + (int)(f - c.firstFace) * (c.cellWidth + 2 * pad) + pad;
+                    int y0 = c.y + pad;
+                    float s = (tx - x0 + 0.5f) / c.cellWidth;
+                    float t = (ty - y0 + 0.5f) / c.cellHeight;
+
+                    const LightmapFace& face = faces[f];
+                    glm::vec3 p = face.origin + s * face.axisS + t * face.axisT;
+                    texels[index] = traceTexel(p, glm::normalize(face.normal), (uint32_t)index);
+                }
+            }
+            });
+
+        dilate();
+    }
+
+    //grows every cell into its padding, one ring per pass, so bilinear lookups at a cell's
+    //edge never blend in the black between charts
+    void LightmapBaker::dilate() {
+        const int size = settings.atlasSize;
+        std::vector<uint8_t> filled(texels.size());
+        for (size_t i = 0; i < texels.size(); i++)
+            filled[i] = texelFace[i] >= 0;
+
+        for (int pass = 0; pass < settings.padding; pass++) {
+            std::vector<uint8_t> next = filled;
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    size_t i = (size_t)y * size + x;
+                    if (filled[i])
+                        continue;
+
+                    glm::vec4 sum(0.0f);
+                    int count = 0;
+                    const int dx[4] = { -1, 1, 0, 0 };
+                    const int dy[4] = { 0, 0, -1, 1 };
+                    for (int k = 0; k < 4; k++) {
+                        int nx = x + dx[k], ny = y + dy[k];
+                        if (nx < 0 || ny < 0 || nx >= size || ny >= size || !filled[(size_t)ny * size + nx])
+                            continue;
+                        sum += texels[(size_t)ny * size + nx];
+                        count++;
+                    }
+                    if (count > 0) {
+                        texels[i] = sum / (float)count;
+                        next[i] = 1;
+                    }
+                }
+            }
+            filled.swap(next);
+        }
+    }
+
+    bool LightmapBaker::save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+
+        uint32_t header[2] = { LIGHTMAP_MAGIC, (uint32_t)settings.atlasSize };
+        file.write((const char*)header, sizeof(header));
+        file.write((const char*)&key, sizeof(key));
+        file.write((const char*)texels.data(), texels.size() * sizeof(glm::vec4));
+        return (bool)file;
+    }
+
+    bool LightmapBaker::load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t header[2] = { 0, 0 };
+        uint64_t fileKey = 0;
+        file.read((char*)header, sizeof(header));
+        file.read((char*)&fileKey, sizeof(fileKey));
+        if (!file || header[0] != LIGHTMAP_MAGIC || (int)header[1] != settings.atlasSize || fileKey != key)
+            return false;
+
+        std::vector<glm::vec4> loaded((size_t)settings.atlasSize * settings.atlasSize);
+        file.read((char*)loaded.data(), loaded.size() * sizeof(glm::vec4));
+        if (!file)
+            return false;
+
+        texels.swap(loaded);
+        return true;
+    }
+}
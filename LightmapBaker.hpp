@@ -0,0 +1,136 @@
+#ifndef LightmapBaker_hpp
+#define LightmapBaker_hpp
+
+#include <glm/glm.hpp>
+
+#include "ThreadPool.hpp"
+#include "TriangleBVH.hpp"
+
+#include <cfloat>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //one planar face of a lightmapped mesh, in world space: the point at texture coordinates
+    //(s, t) of that face is origin + s * axisS + t * axisT, for s, t in [0, 1]
+    struct LightmapFace {
+        glm::vec3 origin;
+        glm::vec3 axisS;
+        glm::vec3 axisT;
+        glm::vec3 normal;
+    };
+
+    //a light as the baker sees it, in world space, with the falloff basic.frag uses
+    struct BakeLight {
+        enum Kind {
+            DIRECTIONAL,
+            SPOT
+        };
+
+        Kind kind = DIRECTIONAL;
+        glm::vec3 position = glm::vec3(0.0f);
+        glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);  // directional: towards the light; spot: where it points
+        glm::vec3 color = glm::vec3(1.0f);                   // already scaled by the intensity
+        float cosInner = 1.0f;
+        float cosOuter = 1.0f;
+        float constant = 1.0f;
+        float linear = 0.0f;
+        float quadratic = 0.0f;
+        float range = FLT_MAX;
+        //its direct light is baked too; otherwise only its bounces are (the shader keeps
+        //lighting it, e.g. for the shadows of moving objects)
+        bool direct = true;
+    };
+
+    struct LightmapSettings {
+        int atlasSize = 512;
+        float texelsPerMeter = 16.0f;   // lowered step by step until the charts fit
+        int padding = 2;                // texels around every cell, filled by dilation
+        int samples = 64;               // hemisphere paths per texel
+        int bounces = 2;
+        float aoDistance = 1.0f;        // hits closer than this occlude
+        glm::vec3 skyRadiance = glm::vec3(0.0f);    // paths that leave the scene
+    };
+
+    //offline lightmaps for the static part of the scene, traced on the cpu
+    //every lightmapped surface is a chart of planar faces, one cell per face side by side, and
+    //the charts are shelf packed into one atlas; every texel of a cell then gathers the direct
+    //light of the baked lights (shadow rays) plus the light bounced off the static geometry
+    //(cosine weighted paths), and the share of its hemisphere that is open as occlusion
+    //rays run against a TriangleBVH of everything added; rows of the atlas are traced in
+    //parallel on a ThreadPool with a random sequence per texel, so a bake is reproducible
+    //the result is in the units basic.frag shades with: multiplied by the albedo it is the
+    //outgoing light, like max(dot(n, l), 0) * color of a light
+    class LightmapBaker {
+
+    public:
+        //static geometry that blocks and reflects light, three world space vertices per triangle
+        void addOccluder(const std::vector<glm::vec3>& triangles, const glm::vec3& albedo);
+        //a lightmapped surface, its faces in cell order; also an occluder
+        uint32_t addChart(const std::vector<LightmapFace>& faces, const glm::vec3& albedo);
+        void addLight(const BakeLight& light);
+
+        //places the charts in the atlas and builds the BVH; false if they don't fit
+        bool pack(const LightmapSettings& settings);
+
+        //atlas uv of a chart's first cell: xy its corner, zw its size; getCellStride() on
+        //from there to each next cell
+        glm::vec4 getChartRect(uint32_t chart) const;
+        float getCellStride(uint32_t chart) const;
+        size_t getChartCount() const { return charts.size(); }
+
+        //identifies the packed layout, the geometry, the lights and the settings; a saved
+        //atlas is only valid for the same key
+        uint64_t getKey() const { return key; }
+
+        //traces every covered texel, then dilates the cells into their padding
+        void bake(ThreadPool& pool);
+
+        //atlasSize x atlasSize, row major from v = 0; rgb light to be multiplied by the
+        //albedo (linear), a the unoccluded share of the hemisphere
+        const std::vector<glm::vec4>& getTexels() const { return texels; }
+        int getAtlasSize() const { return settings.atlasSize; }
+        float getTexelsPerMeter() const { return texelsPerMeter; }
+
+        //the texels with the key; load() fails on a missing file or another key
+        bool save(const std::string& path) const;
+        bool load(const std::string& path);
+
+    private:
+        struct Chart {
+            uint32_t firstFace;
+            uint32_t faceCount;
+            uint32_t surface;
+            int cellWidth = 0;          // texels, without padding
+            int cellHeight = 0;
+            int x = 0;                  // atlas texel of the first cell, padding included
+            int y = 0;
+        };
+
+        std::vector<LightmapFace> faces;
+        std::vector<uint32_t> faceChart;
+        std::vector<Chart> charts;
+        std::vector<BakeLight> lights;
+
+        std::vector<glm::vec3> vertices;            // three per triangle
+        std::vector<uint32_t> triangleSurface;
+        std::vector<glm::vec3> surfaceAlbedo;
+
+        LightmapSettings settings;
+        float texelsPerMeter = 0.0f;
+        uint64_t key = 0;
+        TriangleBVH bvh;
+
+        std::vector<glm::vec4> texels;
+        std::vector<int32_t> texelFace;             // face covering each texel, -1 for none
+
+        bool place(float density);
+        glm::vec3 directLight(const glm::vec3& p, const glm::vec3& n, bool bakedOnly) const;
+        glm::vec4 traceTexel(const glm::vec3& p, const glm::vec3& n, uint32_t seed) const;
+        void dilate();
+    };
+}
+
+#endif /* LightmapBaker_hpp */
@@ -0,0 +1,190 @@
+#include "Material.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gps {
+
+    void MaterialLibrary::init() {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+        uboAlignment = std::max<GLint>(uboAlignment, 16);
+        uboStride = ((GLsizeiptr)sizeof(MaterialParams) + uboAlignment - 1) / uboAlignment * uboAlignment;
+
+        if (GLEW_EXT_texture_filter_anisotropic)
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+
+        //1x1 white texel for slots a material leaves empty
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glGenTextures(1, &whiteTexture);
+        glBindTexture(GL_TEXTURE_2D, whiteTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenBuffers(1, &ubo);
+    }
+
+    uint32_t MaterialLibrary::create(const Material& material) {
+        Material m = material;
+
+        if (m.textures[SLOT_SPECULAR] == 0)
+            m.textures[SLOT_SPECULAR] = m.textures[SLOT_DIFFUSE];
+        if (m.textures[SLOT_ROUGHNESS] == 0)
+            m.textures[SLOT_ROUGHNESS] = whiteTexture;
+
+        m.params.useNormalMap = m.textures[SLOT_NORMAL] != 0 ? 1 : 0;
+        //the opacity map is only read for glass
+        m.params.useOpacityMap = (m.params.isGlass == 1 && m.textures[SLOT_OPACITY] != 0) ? 1 : 0;
+
+        uint32_t id = (uint32_t)materials.size();
+        materials.push_back(m);
+
+        for (int s = 0; s < MATERIAL_SLOT_COUNT; s++)
+            materialSamplers.push_back(getSampler(m.samplers[s]));
+
+        uint32_t group = bindGroupCount;
+        for (uint32_t other = 0; other < id; other++) {
+            if (sameBindState(id, other)) {
+                group = bindGroups[other];
+                break;
+            }
+        }
+        if (group == bindGroupCount)
+            bindGroupCount++;
+        bindGroups.push_back(group);
+
+        uboDirty = true;
+        return id;
+    }
+
+    GLuint MaterialLibrary::getSampler(const SamplerDesc& desc) {
+        for (const SamplerEntry& e : samplerCache) {
+            if (e.desc == desc)
+                return e.sampler;
+        }
+
+        GLuint sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, desc.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, desc.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+        if (desc.anisotropic && maxAnisotropy > 1.0f)
+            glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy);
+
+        samplerCache.push_back({ desc, sampler });
+        return sampler;
+    }
+
+    bool MaterialLibrary::sameBindState(uint32_t a, uint32_t b) const {
+        const Material& ma = materials[a];
+        const Material& mb = materials[b];
+        for (int s = 0; s < MATERIAL_SLOT_COUNT; s++) {
+            if (ma.textures[s] != mb.textures[s])
+                return false;
+            if (materialSamplers[a * MATERIAL_SLOT_COUNT + s] != materialSamplers[b * MATERIAL_SLOT_COUNT + s])
+                return false;
+        }
+        return ma.params.useNormalMap == mb.params.useNormalMap &&
+            ma.params.useOpacityMap == mb.params.useOpacityMap &&
+            ma.params.isGlass == mb.params.isGlass &&
+            ma.params.isOutside == mb.params.isOutside &&
+            ma.params.glassFactor == mb.params.glassFactor &&
+            ma.alphaTested == mb.alphaTested;
+    }
+
+    void MaterialLibrary::upload() {
+        std::vector<unsigned char> data(uboStride * std::max<size_t>(materials.size(), 1), 0);
+        for (size_t i = 0; i < materials.size(); i++)
+            std::memcpy(&data[i * uboStride], &materials[i].params, sizeof(MaterialParams));
+
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)data.size(), data.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        if (GLEW_ARB_shader_storage_buffer_object) {
+            std::vector<MaterialParams> table(materials.size());
+            for (size_t i = 0; i < materials.size(); i++)
+                table[i] = materials[i].params;
+
+            if (tableBuffer == 0)
+                glGenBuffers(1, &tableBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, tableBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(table.size() * sizeof(MaterialParams)), table.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        uboDirty = false;
+        boundMaterial = UINT32_MAX;
+    }
+
+    void MaterialLibrary::bind(uint32_t id) {
+        if (uboDirty)
+            upload();
+
+        if (id == boundMaterial) {
+            skipCount++;
+            return;
+        }
+
+        const GLuint* textures = materials[id].textures;
+        const GLuint* samplers = &materialSamplers[id * MATERIAL_SLOT_COUNT];
+
+        if (GLEW_ARB_multi_bind) {
+            glBindTextures(0, MATERIAL_SLOT_COUNT, textures);
+            glBindSamplers(0, MATERIAL_SLOT_COUNT, samplers);
+            std::memcpy(boundTextures, textures, sizeof(boundTextures));
+            std::memcpy(boundSamplers, samplers, sizeof(boundSamplers));
+        }
+        else {
+            for (int s = 0; s < MATERIAL_SLOT_COUNT; s++) {
+                if (boundTextures[s] != textures[s]) {
+                    glActiveTexture(GL_TEXTURE0 + s);
+                    glBindTexture(GL_TEXTURE_2D, textures[s]);
+                    boundTextures[s] = textures[s];
+                }
+                if (boundSamplers[s] != samplers[s]) {
+                    glBindSampler(s, samplers[s]);
+                    boundSamplers[s] = samplers[s];
+                }
+            }
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UBO_BINDING, ubo,
+            (GLintptr)(id * uboStride), (GLsizeiptr)sizeof(MaterialParams));
+
+        boundMaterial = id;
+        bindCount++;
+    }
+
+    void MaterialLibrary::bindTable(GLuint binding) {
+        if (uboDirty)
+            upload();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, tableBuffer);
+    }
+
+    void MaterialLibrary::invalidate() {
+        boundMaterial = UINT32_MAX;
+        //0xFFFFFFFF is never a texture/sampler name, so every slot gets re-sent
+        std::fill(boundTextures, boundTextures + MATERIAL_SLOT_COUNT, 0xFFFFFFFFu);
+        std::fill(boundSamplers, boundSamplers + MATERIAL_SLOT_COUNT, 0xFFFFFFFFu);
+    }
+
+    void MaterialLibrary::setupProgram(GLuint program) {
+        static const char* names[MATERIAL_SLOT_COUNT] = {
+            "diffuseTexture", "specularTexture", "roughnessTexture", "normalTexture", "opacityTexture"
+        };
+
+        glUseProgram(program);
+        for (int s = 0; s < MATERIAL_SLOT_COUNT; s++) {
+            GLint loc = glGetUniformLocation(program, names[s]);
+            if (loc >= 0)
+                glUniform1i(loc, s);
+        }
+
+        GLuint block = glGetUniformBlockIndex(program, "MaterialBlock");
+        if (block != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, block, MATERIAL_UBO_BINDING);
+    }
+}
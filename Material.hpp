@@ -0,0 +1,149 @@
+#ifndef Material_hpp
+#define Material_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //fixed texture unit of every material texture (the sampler uniforms are set once per program)
+    enum MaterialSlot {
+        SLOT_DIFFUSE,
+        SLOT_SPECULAR,
+        SLOT_ROUGHNESS,
+        SLOT_NORMAL,
+        SLOT_OPACITY,
+        MATERIAL_SLOT_COUNT
+    };
+
+    //uniform block binding point of MaterialBlock
+    const GLuint MATERIAL_UBO_BINDING = 0;
+    //storage buffer binding point of the packed MaterialParams table (GL 4.3 path)
+    const GLuint MATERIAL_TABLE_BINDING = 1;
+
+    //std140 image of the MaterialBlock uniform block in basic.vert/basic.frag
+    struct MaterialParams {
+        glm::vec2 uvTiling = glm::vec2(1.0f);
+        glm::vec2 uvOffset = glm::vec2(0.0f);
+        glm::vec2 uvMin = glm::vec2(0.0f);
+        glm::vec2 uvMax = glm::vec2(1.0f);
+        GLint useNormalMap = 0;
+        GLint useOpacityMap = 0;
+        GLint isGlass = 0;
+        GLint isOutside = 0;
+        GLfloat glassFactor = 1.0f;
+        GLfloat pad[3] = { 0.0f, 0.0f, 0.0f };
+    };
+
+    //sampler object state for one texture slot
+    struct SamplerDesc {
+        GLenum wrap = GL_REPEAT;
+        GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+        GLenum magFilter = GL_LINEAR;
+        bool anisotropic = false;
+
+        bool operator==(const SamplerDesc& o) const {
+            return wrap == o.wrap && minFilter == o.minFilter && magFilter == o.magFilter && anisotropic == o.anisotropic;
+        }
+    };
+
+    struct Material {
+        //colour factors read from the .mtl file
+        glm::vec3 ambient = glm::vec3(1.0f);
+        glm::vec3 diffuse = glm::vec3(1.0f);
+        glm::vec3 specular = glm::vec3(1.0f);
+
+        GLuint textures[MATERIAL_SLOT_COUNT] = { 0, 0, 0, 0, 0 };
+        SamplerDesc samplers[MATERIAL_SLOT_COUNT];
+        MaterialParams params;
+        //cut out by the diffuse alpha (discard below 0.1); everything else is drawn without a
+        //discard so it keeps early depth testing
+        bool alphaTested = false;
+    };
+
+    //owns every material of the scene: the GL sampler objects and one uniform buffer holding
+    //each material's parameters in its own aligned slice
+    class MaterialLibrary {
+
+    public:
+        //needs a current GL context
+        void init();
+
+        //registers a material built at load time and returns its id
+        //missing specular/roughness maps fall back to the diffuse map / a white texel
+        uint32_t create(const Material& material);
+
+        //binds textures, samplers and the parameter slice of a material in one call;
+        //does nothing if it is already the bound material
+        void bind(uint32_t id);
+
+        //forget the cached bindings (someone else touched texture units 0-4)
+        void invalidate();
+
+        //points the sampler uniforms of a program at the material slots and hooks up MaterialBlock
+        static void setupProgram(GLuint program);
+
+        const Material& get(uint32_t id) const { return materials[id]; }
+
+        //materials that differ only in their uv parameters share a bind group: same textures,
+        //samplers and fragment flags, so one bind of any member serves all of them as long as
+        //the uv parameters come from the material table
+        uint32_t getBindGroup(uint32_t id) const { return bindGroups[id]; }
+        uint32_t getBindGroupCount() const { return bindGroupCount; }
+
+        //binds the MaterialParams of every material, tightly packed (std430), as a storage buffer
+        //needs GL 4.3 / ARB_shader_storage_buffer_object
+        void bindTable(GLuint binding = MATERIAL_TABLE_BINDING);
+        size_t size() const { return materials.size(); }
+        GLuint getWhiteTexture() const { return whiteTexture; }
+
+        //binds done / skipped since the last resetStats()
+        unsigned getBindCount() const { return bindCount; }
+        unsigned getSkipCount() const { return skipCount; }
+        void resetStats() { bindCount = 0; skipCount = 0; }
+
+    private:
+        struct SamplerEntry {
+            SamplerDesc desc;
+            GLuint sampler;
+        };
+
+        std::vector<Material> materials;
+        std::vector<GLuint> materialSamplers;   // MATERIAL_SLOT_COUNT per material
+        std::vector<SamplerEntry> samplerCache;
+        std::vector<uint32_t> bindGroups;
+        uint32_t bindGroupCount = 0;
+
+        GLuint ubo = 0;
+        GLuint tableBuffer = 0;
+        GLint uboAlignment = 256;
+        GLsizeiptr uboStride = 0;
+        bool uboDirty = true;
+
+        GLuint whiteTexture = 0;
+        float maxAnisotropy = 1.0f;
+
+        uint32_t boundMaterial = UINT32_MAX;
+        GLuint boundTextures[MATERIAL_SLOT_COUNT] = { 0, 0, 0, 0, 0 };
+        GLuint boundSamplers[MATERIAL_SLOT_COUNT] = { 0, 0, 0, 0, 0 };
+
+        unsigned bindCount = 0;
+        unsigned skipCount = 0;
+
+        GLuint getSampler(const SamplerDesc& desc);
+        bool sameBindState(uint32_t a, uint32_t b) const;
+        void upload();
+    };
+}
+
+#endif /* Material_hpp */
@@ -38,6 +38,13 @@ namespace gps {
 
     }
 
+	void Mesh::DrawGeometry() {
+
+		glBindVertexArray(this->buffers.VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+	}
+
 	void Mesh::setupMesh() {
 
 		glGenVertexArrays(1, &this->buffers.VAO);
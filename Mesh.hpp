@@ -12,6 +12,7 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "Material.hpp"
 
 #include <string>
 #include <vector>
@@ -34,13 +35,6 @@ namespace gps {
         std::string path;
     };
 
-    struct Material {
-
-        glm::vec3 ambient;
-        glm::vec3 diffuse;
-        glm::vec3 specular;
-    };
-
     struct Buffers {
         GLuint VAO;
         GLuint VBO;
@@ -53,6 +47,9 @@ namespace gps {
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // Material built from the .mtl entry and its id once registered in a MaterialLibrary
+        Material material;
+        uint32_t materialId = 0;
 
 	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
@@ -60,6 +57,9 @@ namespace gps {
 
 	    void Draw(gps::Shader shader);
 
+	    // Draws the triangles only; textures/material must already be bound
+	    void DrawGeometry();
+
     private:
         /*  Render data  */
         Buffers buffers;
@@ -19,6 +19,16 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
+	std::vector<glm::vec3> Model3D::getTriangles(const glm::mat4& transform) const {
+
+		std::vector<glm::vec3> triangles;
+		for (const gps::Mesh& mesh : meshes) {
+			for (GLuint index : mesh.indices)
+				triangles.push_back(glm::vec3(transform * glm::vec4(mesh.vertices[index].Position, 1.0f)));
+		}
+		return triangles;
+	}
+
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
 
         std::cout << "Loading : " << fileName << std::endl;
@@ -84,6 +94,7 @@ namespace gps {
 					currentVertex.TexCoords = glm::vec2(tx, ty);
 
 					vertices.push_back(currentVertex);
+					bounds.expand(currentVertex.Position);
 
 					indices.push_back((GLuint)vertices.size() - 1);
 
@@ -93,13 +104,13 @@ namespace gps {
 			}
 
 			size_t a = shapes[s].mesh.material_ids.size();
+			gps::Material currentMaterial;
 
 			if (a > 0 && materials.size()>0) {
 
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
 
-					gps::Material currentMaterial;
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
@@ -111,6 +122,7 @@ namespace gps {
 						gps::Texture currentTexture;
 						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
 						textures.push_back(currentTexture);
+						currentMaterial.textures[gps::SLOT_DIFFUSE] = currentTexture.id;
 					}
 
 					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
@@ -120,6 +132,7 @@ namespace gps {
 						gps::Texture currentTexture;
 						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
 						textures.push_back(currentTexture);
+						currentMaterial.textures[gps::SLOT_DIFFUSE] = currentTexture.id;
 					}
 
 					std::string specularTexturePath = materials[materialId].specular_texname;
@@ -129,11 +142,13 @@ namespace gps {
 						gps::Texture currentTexture;
 						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
 						textures.push_back(currentTexture);
+						currentMaterial.textures[gps::SLOT_SPECULAR] = currentTexture.id;
 					}
 				}
 			}
 
 			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			meshes.back().material = currentMaterial;
 		}
 	}
 
@@ -2,6 +2,7 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "Bounds.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
@@ -23,6 +24,15 @@ namespace gps {
 
 		void Draw(gps::Shader shaderProgram);
 
+		// Component meshes, e.g. to register their materials or draw them one by one
+		std::vector<gps::Mesh>& getMeshes() { return meshes; }
+
+		// Object space box around every vertex of every mesh
+		const gps::AABB& getBounds() const { return bounds; }
+
+		// Positions of every triangle of every mesh, three per triangle, through the transform
+		// (e.g. to build a TriangleBVH)
+		std::vector<glm::vec3> getTriangles(const glm::mat4& transform = glm::mat4(1.0f)) const;
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
@@ -35,6 +45,8 @@ namespace gps {
         std::vector<gps::Mesh> meshes;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Bounds of all loaded vertices
+		gps::AABB bounds;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
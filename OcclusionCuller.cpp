@@ -0,0 +1,348 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    //unit shapes of MESH_QUAD / MESH_CUBE (see Scene::meshBounds)
+    static const glm::vec3 QUAD_CORNERS[4] = {
+        glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 0.0f, -0.5f),
+        glm::vec3(0.5f, 0.0f, 0.5f), glm::vec3(-0.5f, 0.0f, 0.5f)
+    };
+
+    //boxes that reach this close to the camera plane are always visible
+    static const float NEAR_W = 1e-4f;
+
+    static void addBoxTriangles(std::vector<glm::vec3>& out) {
+        //corner i has x from bit 0, y from bit 1, z from bit 2
+        static const int faces[6][4] = {
+            { 0, 2, 6, 4 }, { 1, 5, 7, 3 },     // -x, +x
+            { 0, 4, 5, 1 }, { 2, 3, 7, 6 },     // -y, +y
+            { 0, 1, 3, 2 }, { 4, 6, 7, 5 }      // -z, +z
+        };
+
+        glm::vec3 c[8];
+        for (int i = 0; i < 8; i++)
+            c[i] = glm::vec3((i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f);
+
+        for (const int* f : faces) {
+            out.push_back(c[f[0]]); out.push_back(c[f[1]]); out.push_back(c[f[2]]);
+            out.push_back(c[f[0]]); out.push_back(c[f[2]]); out.push_back(c[f[3]]);
+        }
+    }
+
+    void OcclusionCuller::build(const Scene& scene, size_t maxModelTriangles) {
+        occluders.clear();
+        localVertices.clear();
+        depth.assign(WIDTH * HEIGHT, 1.0f);
+
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            if (!scene.hasFlags(id, ENTITY_OCCLUDER))
+                continue;
+
+            Occluder o;
+            o.entity = id;
+            o.firstVertex = (uint32_t)localVertices.size();
+
+            const MeshRef& mesh = scene.meshes[id];
+            switch (mesh.kind) {
+            case MESH_QUAD:
+                localVertices.push_back(QUAD_CORNERS[0]);
+                localVertices.push_back(QUAD_CORNERS[1]);
+                localVertices.push_back(QUAD_CORNERS[2]);
+                localVertices.push_back(QUAD_CORNERS[0]);
+                localVertices.push_back(QUAD_CORNERS[2]);
+                localVertices.push_back(QUAD_CORNERS[3]);
+                break;
+            case MESH_CUBE:
+                addBoxTriangles(localVertices);
+                break;
+            case MESH_MODEL: {
+                size_t triangleCount = 0;
+                for (const Mesh& m : mesh.model->getMeshes())
+                    triangleCount += m.indices.size() / 3;
+                if (triangleCount > maxModelTriangles)
+                    break;
+
+                for (const Mesh& m : mesh.model->getMeshes()) {
+                    for (GLuint index : m.indices)
+                        localVertices.push_back(m.vertices[index].Position);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+
+            o.vertexCount = (uint32_t)localVertices.size() - o.firstVertex;
+            if (o.vertexCount > 0)
+                occluders.push_back(o);
+        }
+    }
+
+    void OcclusionCuller::setupTriangle(const glm::vec3 s[3]) {
+        ScreenTriangle t;
+
+        float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[2].x - s[0].x) * (s[1].y - s[0].y);
+        if (std::fabs(area) < 1e-8f)
+            return;
+
+        //counter clockwise, so the inside is where all edge functions are >= 0
+        int order[3] = { 0, 1, 2 };
+        if (area < 0.0f) {
+            order[1] = 2;
+            order[2] = 1;
+            area = -area;
+        }
+        for (int i = 0; i < 3; i++) {
+            t.x[i] = s[order[i]].x;
+            t.y[i] = s[order[i]].y;
+        }
+        float z[3] = { s[order[0]].z, s[order[1]].z, s[order[2]].z };
+
+        float minX = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+        float maxX = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+        float minY = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+        float maxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+
+        t.minX = std::max(0, (int)std::floor(minX));
+        t.maxX = std::min(WIDTH - 1, (int)std::ceil(maxX));
+        t.minY = std::max(0, (int)std::floor(minY));
+        t.maxY = std::min(HEIGHT - 1, (int)std::ceil(maxY));
+        if (t.minX > t.maxX || t.minY > t.maxY)
+            return;
+
+        t.dzdx = ((z[1] - z[0]) * (t.y[2] - t.y[0]) - (z[2] - z[0]) * (t.y[1] - t.y[0])) / area;
+        t.dzdy = ((z[2] - z[0]) * (t.x[1] - t.x[0]) - (z[1] - z[0]) * (t.x[2] - t.x[0])) / area;
+
+        //depth is sampled at pixel centers; pushing it back by the largest change across half
+        //a pixel keeps the occluder from ever looking nearer than it is
+        t.z0 = z[0] + 0.5f * (std::fabs(t.dzdx) + std::fabs(t.dzdy));
+
+        triangles.push_back(t);
+    }
+
+    void OcclusionCuller::addTriangle(const glm::vec4 clip[3]) {
+        //clip against the near plane (z >= -w), at most one extra vertex
+        glm::vec4 poly[4];
+        int n = 0;
+        for (int i = 0; i < 3; i++) {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 3];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+
+            if (da >= 0.0f)
+                poly[n++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                poly[n++] = a + (b - a) * (da / (da - db));
+        }
+        if (n < 3)
+            return;
+
+        glm::vec3 screen[4];
+        for (int i = 0; i < n; i++) {
+            float invW = 1.0f / std::max(poly[i].w, NEAR_W);
+            screen[i].x = (poly[i].x * invW * 0.5f + 0.5f) * WIDTH;
+            screen[i].y = (poly[i].y * invW * 0.5f + 0.5f) * HEIGHT;
+            screen[i].z = std::min(poly[i].z * invW * 0.5f + 0.5f, 1.0f);
+        }
+
+        glm::vec3 first[3] = { screen[0], screen[1], screen[2] };
+        setupTriangle(first);
+        if (n == 4) {
+            glm::vec3 second[3] = { screen[0], screen[2], screen[3] };
+            setupTriangle(second);
+        }
+    }
+
+    void OcclusionCuller::render(const Scene& scene, const glm::mat4& viewProjection, ThreadPool* pool) {
+        this->viewProjection = viewProjection;
+        triangles.clear();
+
+        for (const Occluder& o : occluders) {
+            glm::mat4 M = viewProjection * scene.worldTransforms[o.entity];
+            const glm::vec3* v = &localVertices[o.firstVertex];
+
+            for (uint32_t i = 0; i + 3 <= o.vertexCount; i += 3) {
+                glm::vec4 clip[3] = {
+                    M * glm::vec4(v[i], 1.0f),
+                    M * glm::vec4(v[i + 1], 1.0f),
+                    M * glm::vec4(v[i + 2], 1.0f)
+                };
+                addTriangle(clip);
+            }
+        }
+
+        //bands own disjoint rows, so the workers never touch the same pixels
+        const size_t bandCount = HEIGHT / BAND_HEIGHT;
+        auto job = [this](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++)
+                rasterizeBand((int)b * BAND_HEIGHT, (int)(b + 1) * BAND_HEIGHT);
+        };
+
+        if (pool)
+            pool->parallelFor(bandCount, 1, job);
+        else
+            job(0, bandCount);
+    }
+
+    void OcclusionCuller::rasterizeBand(int y0, int y1) {
+        std::fill(depth.begin() + (size_t)y0 * WIDTH, depth.begin() + (size_t)y1 * WIDTH, 1.0f);
+
+        for (const ScreenTriangle& t : triangles) {
+            int rowBegin = std::max(t.minY, y0);
+            int rowEnd = std::min(t.maxY + 1, y1);
+            if (rowBegin >= rowEnd)
+                continue;
+
+#if defined(GPS_SIMD_X86)
+            rasterizeRowsSSE(t, rowBegin, rowEnd);
+#else
+            rasterizeRowsScalar(t, rowBegin, rowEnd);
+#endif
+        }
+    }
+
+    void OcclusionCuller::rasterizeRowsScalar(const ScreenTriangle& t, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            float py = y + 0.5f;
+            float* row = &depth[(size_t)y * WIDTH];
+
+            for (int x = t.minX; x <= t.maxX; x++) {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3 && inside; e++) {
+                    int n = (e + 1) % 3;
+                    float edge = (py - t.y[e]) * (t.x[n] - t.x[e]) - (px - t.x[e]) * (t.y[n] - t.y[e]);
+                    inside = edge >= 0.0f;
+                }
+                if (!inside)
+                    continue;
+
+                float z = t.z0 + t.dzdx * (px - t.x[0]) + t.dzdy * (py - t.y[0]);
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+
+#if defined(GPS_SIMD_X86)
+
+    void OcclusionCuller::rasterizeRowsSSE(const ScreenTriangle& t, int y0, int y1) {
+        const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+
+        //edge e: (py - y[e]) * dx[e] - (px - x[e]) * dy[e]
+        __m128 ex[3], ey[3], edx[3], edy[3];
+        for (int e = 0; e < 3; e++) {
+            int n = (e + 1) % 3;
+            ex[e] = _mm_set1_ps(t.x[e]);
+            ey[e] = _mm_set1_ps(t.y[e]);
+            edx[e] = _mm_set1_ps(t.x[n] - t.x[e]);
+            edy[e] = _mm_set1_ps(t.y[n] - t.y[e]);
+        }
+        const __m128 x0 = _mm_set1_ps(t.x[0]);
+        const __m128 z0 = _mm_set1_ps(t.z0);
+        const __m128 dzdx = _mm_set1_ps(t.dzdx);
+
+        int xBegin = t.minX & ~3;   // WIDTH is a multiple of 4, so the last group stays in the row
+
+        for (int y = y0; y < y1; y++) {
+            __m128 py = _mm_set1_ps(y + 0.5f);
+            __m128 rowZ = _mm_add_ps(z0, _mm_set1_ps(t.dzdy * (y + 0.5f - t.y[0])));
+            float* row = &depth[(size_t)y * WIDTH];
+
+            __m128 rowEdge[3];
+            for (int e = 0; e < 3; e++)
+                rowEdge[e] = _mm_mul_ps(_mm_sub_ps(py, ey[e]), edx[e]);
+
+            for (int x = xBegin; x <= t.maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffset);
+
+                __m128 inside = _mm_cmpge_ps(_mm_sub_ps(rowEdge[0], _mm_mul_ps(_mm_sub_ps(px, ex[0]), edy[0])), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_sub_ps(rowEdge[1], _mm_mul_ps(_mm_sub_ps(px, ex[1]), edy[1])), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_sub_ps(rowEdge[2], _mm_mul_ps(_mm_sub_ps(px, ex[2]), edy[2])), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 z = _mm_add_ps(rowZ, _mm_mul_ps(dzdx, _mm_sub_ps(px, x0)));
+                __m128 d = _mm_load_ps(row + x);
+                __m128 nearer = _mm_min_ps(d, z);
+                _mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, d)));
+            }
+        }
+    }
+
+#endif
+
+    bool OcclusionCuller::isVisible(const AABB& box) const {
+        if (!box.isValid())
+            return true;
+
+        float minX = 1e30f, maxX = -1e30f;
+        float minY = 1e30f, maxY = -1e30f;
+        float minZ = 1.0f;
+
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner((i & 1) ? box.maxCorner.x : box.minCorner.x,
+                (i & 2) ? box.maxCorner.y : box.minCorner.y,
+                (i & 4) ? box.maxCorner.z : box.minCorner.z);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+
+            //straddles the camera plane: projected bounds are meaningless
+            if (clip.w <= NEAR_W || clip.z < -clip.w)
+                return true;
+
+            float invW = 1.0f / clip.w;
+            float sx = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+            float sy = (clip.y * invW * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, sx); maxX = std::max(maxX, sx);
+            minY = std::min(minY, sy); maxY = std::max(maxY, sy);
+            minZ = std::min(minZ, clip.z * invW * 0.5f + 0.5f);
+        }
+
+        //every pixel the box touches
+        int x0 = std::max(0, (int)std::floor(minX));
+        int x1 = std::min(WIDTH - 1, (int)std::floor(maxX));
+        int y0 = std::max(0, (int)std::floor(minY));
+        int y1 = std::min(HEIGHT - 1, (int)std::floor(maxY));
+        if (x0 > x1 || y0 > y1)
+            return true;
+
+        for (int y = y0; y <= y1; y++) {
+            const float* row = &depth[(size_t)y * WIDTH];
+#if defined(GPS_SIMD_X86)
+            const __m128 vz = _mm_set1_ps(minZ);
+            const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+            for (int x = x0 & ~3; x <= x1; x += 4) {
+                //lanes left of x0 / right of x1 belong to other objects' pixels
+                __m128i px = _mm_add_epi32(_mm_set1_epi32(x), lane);
+                __m128i inRange = _mm_and_si128(
+                    _mm_cmpgt_epi32(px, _mm_set1_epi32(x0 - 1)),
+                    _mm_cmplt_epi32(px, _mm_set1_epi32(x1 + 1)));
+                __m128 farther = _mm_cmpge_ps(_mm_load_ps(row + x), vz);
+                if (_mm_movemask_ps(_mm_and_ps(farther, _mm_castsi128_ps(inRange))))
+                    return true;
+            }
+#else
+            for (int x = x0; x <= x1; x++) {
+                if (row[x] >= minZ)
+                    return true;
+            }
+#endif
+        }
+        return false;
+    }
+
+    void OcclusionCuller::filter(const Scene& scene, std::vector<EntityId>& entities, CullStats& stats) const {
+        size_t kept = 0;
+        for (EntityId id : entities) {
+            if (isVisible(scene.worldBounds[id]))
+                entities[kept++] = id;
+            else
+                stats.occluded++;
+        }
+        entities.resize(kept);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "Culling.hpp"
+#include "Scene.hpp"
+#include "SimdUtils.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //cpu occlusion culling: the ENTITY_OCCLUDER entities are rasterized into a small depth
+    //buffer and the bounding boxes of the other entities are tested against it, all without
+    //touching the gpu
+    //the rasterizer walks 4 pixels per SSE2 step; the screen is split into horizontal bands
+    //that are filled in parallel on the worker threads
+    class OcclusionCuller {
+
+    public:
+        static const int WIDTH = 256;
+        static const int HEIGHT = 128;
+        static const int BAND_HEIGHT = 16;
+
+        //collects the occluder triangles in entity local space
+        //quads and cubes use their exact shape; models with more than maxModelTriangles
+        //triangles are skipped (too expensive to rasterize every frame)
+        void build(const Scene& scene, size_t maxModelTriangles = 20000);
+
+        //clears the depth buffer and rasterizes the occluders seen through viewProjection
+        void render(const Scene& scene, const glm::mat4& viewProjection, ThreadPool* pool);
+
+        //false only if every pixel the box covers already holds a nearer occluder
+        bool isVisible(const AABB& box) const;
+
+        //drops the entities hidden behind the occluders, counting them into stats.occluded
+        void filter(const Scene& scene, std::vector<EntityId>& entities, CullStats& stats) const;
+
+        //depth (0 near .. 1 far) of the last render(), WIDTH * HEIGHT, bottom row first
+        const float* getDepth() const { return depth.data(); }
+        size_t getOccluderTriangleCount() const { return localVertices.size() / 3; }
+        size_t getRasterizedTriangleCount() const { return triangles.size(); }
+
+    private:
+        struct Occluder {
+            EntityId entity;
+            uint32_t firstVertex;
+            uint32_t vertexCount;
+        };
+
+        //a triangle in screen space with its setup for the edge walk
+        struct ScreenTriangle {
+            float x[3];
+            float y[3];
+            float z0;           // depth at (x[0], y[0])
+            float dzdx;
+            float dzdy;
+            int minX, maxX;
+            int minY, maxY;
+        };
+
+        std::vector<Occluder> occluders;
+        std::vector<glm::vec3> localVertices;   // triangle list, 3 per triangle
+        std::vector<ScreenTriangle> triangles;
+        simd::FloatArray depth;
+
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+
+        void addTriangle(const glm::vec4 clip[3]);
+        void setupTriangle(const glm::vec3 screen[3]);
+        void rasterizeBand(int y0, int y1);
+        void rasterizeRowsScalar(const ScreenTriangle& t, int y0, int y1);
+#if defined(GPS_SIMD_X86)
+        void rasterizeRowsSSE(const ScreenTriangle& t, int y0, int y1);
+#endif
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
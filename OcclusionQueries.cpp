@@ -0,0 +1,124 @@
+#include "OcclusionQueries.hpp"
+
+namespace gps {
+
+    void OcclusionQueries::init(const Scene& scene, bool conservative) {
+        destroy();
+
+        target = conservative ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+        slotOf.assign(scene.size(), -1);
+
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            if (!scene.hasFlags(id, ENTITY_QUERIED))
+                continue;
+
+            slotOf[id] = (int)slots.size();
+            entities.push_back(id);
+            slots.push_back(Slot());
+            glGenQueries(RING_SIZE, slots.back().queries);
+        }
+    }
+
+    void OcclusionQueries::destroy() {
+        for (Slot& slot : slots)
+            glDeleteQueries(RING_SIZE, slot.queries);
+
+        slots.clear();
+        entities.clear();
+        slotOf.clear();
+        frame = 0;
+    }
+
+    void OcclusionQueries::beginFrame() {
+        frame++;
+        for (Slot& slot : slots)
+            resolve(slot);
+    }
+
+    void OcclusionQueries::resolve(Slot& slot) {
+        unsigned current = frame % RING_SIZE;
+
+        //oldest first; the first entry is the one this frame reuses
+        for (int k = 0; k < RING_SIZE; k++) {
+            Sample& s = slot.samples[(current + k) % RING_SIZE];
+            if (!s.pending)
+                continue;
+
+            if (s.kind == SAMPLE_QUERY) {
+                GLuint query = slot.queries[(current + k) % RING_SIZE];
+                GLuint available = 0;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+                //a newer result can't be used before an older one, so stop at the first
+                //unfinished query; only the entry being reused is worth a wait
+                if (!available) {
+                    if (k > 0)
+                        break;
+                    stallCount++;
+                }
+
+                GLuint passed = 0;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+                push(slot, passed != 0);
+            }
+            else {
+                push(slot, s.kind == SAMPLE_VISIBLE);
+            }
+            s.pending = false;
+        }
+
+        slot.samples[current] = Sample();
+    }
+
+    void OcclusionQueries::push(Slot& slot, bool visible) {
+        slot.history = (slot.history << 1) | (visible ? 1u : 0u);
+        slot.hiddenFrames = visible ? 0 : slot.hiddenFrames + 1;
+    }
+
+    void OcclusionQueries::beginDraw(EntityId id) {
+        const Slot& slot = slots[slotOf[id]];
+        unsigned previous = (frame + RING_SIZE - 1) % RING_SIZE;
+
+        conditionalActive = slot.samples[previous].kind == SAMPLE_QUERY;
+        if (conditionalActive) {
+            glBeginConditionalRender(slot.queries[previous], GL_QUERY_NO_WAIT);
+            conditionalCount++;
+        }
+    }
+
+    void OcclusionQueries::endDraw() {
+        if (conditionalActive)
+            glEndConditionalRender();
+        conditionalActive = false;
+    }
+
+    void OcclusionQueries::beginQuery(EntityId id) {
+        Slot& slot = slots[slotOf[id]];
+        unsigned current = frame % RING_SIZE;
+
+        slot.samples[current].kind = SAMPLE_QUERY;
+        slot.samples[current].pending = true;
+        glBeginQuery(target, slot.queries[current]);
+        queryCount++;
+    }
+
+    void OcclusionQueries::endQuery() {
+        glEndQuery(target);
+    }
+
+    void OcclusionQueries::record(EntityId id, bool visible) {
+        Slot& slot = slots[slotOf[id]];
+        unsigned current = frame % RING_SIZE;
+
+        slot.samples[current].kind = visible ? SAMPLE_VISIBLE : SAMPLE_HIDDEN;
+        slot.samples[current].pending = true;
+    }
+
+    uint32_t OcclusionQueries::getHistory(EntityId id) const {
+        return isTracked(id) ? slots[slotOf[id]].history : 0xFFFFFFFFu;
+    }
+
+    unsigned OcclusionQueries::getHiddenFrames(EntityId id) const {
+        return isTracked(id) ? slots[slotOf[id]].hiddenFrames : 0;
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //hardware occlusion queries for the expensive models (ENTITY_QUERIED)
+    //every frame the bounding box of such an entity is drawn inside an any-samples query, and
+    //the next frame draws the real model under glBeginConditionalRender on that query with
+    //GL_QUERY_NO_WAIT: the gpu skips it if the box was hidden, and draws it anyway if the
+    //result isn't in yet, so the cpu never waits for a query
+    //finished queries are also read back (only once available) into a per-entity visibility
+    //history that LOD / texture streaming can look at
+    class OcclusionQueries {
+
+    public:
+        //queries kept per entity; matches the frames StreamBuffer lets the cpu run ahead
+        static const int RING_SIZE = 3;
+
+        //one query ring per ENTITY_QUERIED entity; needs a current GL context
+        //conservative: GL_ANY_SAMPLES_PASSED_CONSERVATIVE (GL 4.3 / ARB_ES3_compatibility),
+        //otherwise GL_ANY_SAMPLES_PASSED
+        void init(const Scene& scene, bool conservative);
+        void destroy();
+
+        //folds the finished queries into the histories, oldest first, without waiting (unless
+        //a query is still unfinished when its ring entry comes around again)
+        //once per frame, before any of the calls below
+        void beginFrame();
+
+        //brackets the draw of the real model: conditional on last frame's box query when
+        //there is one, unconditional otherwise
+        void beginDraw(EntityId id);
+        void endDraw();
+
+        //brackets the draw of the bounding box; its result gates next frame's beginDraw()
+        void beginQuery(EntityId id);
+        void endQuery();
+
+        //this frame's sample for an entity that got no query: culled on the cpu (false),
+        //or too close for its box to be drawn (true)
+        //every tracked entity needs beginQuery() or record() once per frame
+        void record(EntityId id, bool visible);
+
+        //bit i set: visible i + 1 resolved frames ago (bit 0 is the newest result)
+        //untracked entities always read as visible
+        uint32_t getHistory(EntityId id) const;
+        bool wasVisible(EntityId id) const { return (getHistory(id) & 1u) != 0; }
+        //resolved frames since the entity was last seen; 0 if it was seen in the newest one
+        unsigned getHiddenFrames(EntityId id) const;
+
+        bool isTracked(EntityId id) const { return id < slotOf.size() && slotOf[id] >= 0; }
+        const std::vector<EntityId>& getEntities() const { return entities; }
+
+        //since the last resetStats(): queries issued, model draws made conditional, and
+        //ring reuses that had to block on an unfinished query
+        unsigned getQueryCount() const { return queryCount; }
+        unsigned getConditionalCount() const { return conditionalCount; }
+        unsigned getStallCount() const { return stallCount; }
+        void resetStats() { queryCount = 0; conditionalCount = 0; stallCount = 0; }
+
+    private:
+        enum SampleKind : uint8_t {
+            SAMPLE_NONE,
+            SAMPLE_QUERY,
+            SAMPLE_HIDDEN,
+            SAMPLE_VISIBLE
+        };
+
+        struct Sample {
+            SampleKind kind = SAMPLE_NONE;
+            bool pending = false;       // not folded into the history yet
+        };
+
+        struct Slot {
+            GLuint queries[RING_SIZE] = { 0, 0, 0 };
+            Sample samples[RING_SIZE];
+            uint32_t history = 0xFFFFFFFFu;
+            unsigned hiddenFrames = 0;
+        };
+
+        std::vector<EntityId> entities;
+        std::vector<int> slotOf;        // per entity, -1 if untracked
+        std::vector<Slot> slots;
+
+        GLenum target = GL_ANY_SAMPLES_PASSED;
+        unsigned frame = 0;
+        bool conditionalActive = false;
+
+        unsigned queryCount = 0;
+        unsigned conditionalCount = 0;
+        unsigned stallCount = 0;
+
+        void resolve(Slot& slot);
+        void push(Slot& slot, bool visible);
+    };
+}
+
+#endif /* OcclusionQueries_hpp */
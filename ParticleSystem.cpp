@@ -0,0 +1,253 @@
+#include "ParticleSystem.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+namespace gps {
+
+    //particles handed to one worker at a time; a multiple of the widest SIMD lane count
+    static const size_t PARTICLE_CHUNK = 16384;
+
+    static const float INV_TWO_PI = 0.15915494f;
+    static const float TWO_PI = 6.28318531f;
+    static const float SIN_B = 1.27323954f;
+    static const float SIN_C = -0.40528473f;
+    static const float SIN_P = 0.225f;
+
+    void ParticleSystem::init(size_t capacity, const ParticleEmitter& emitter, uint32_t seed) {
+        this->emitter = emitter;
+        this->count = capacity;
+        this->seed = seed;
+        this->spawnGeneration = 0;
+
+        posX.assign(capacity, 0.0f);
+        posY.assign(capacity, 0.0f);
+        posZ.assign(capacity, 0.0f);
+        velX.assign(capacity, 0.0f);
+        velY.assign(capacity, 0.0f);
+        velZ.assign(capacity, 0.0f);
+        phase.assign(capacity, 0.0f);
+        age.assign(capacity, 0.0f);
+        life.assign(capacity, 0.0f);
+
+        for (size_t i = 0; i < capacity; i++)
+            spawn(i, true);
+    }
+
+    void ParticleSystem::spawn(size_t i, bool initial) {
+        uint32_t h = simd::hash32((uint32_t)i * 0x9E3779B9u ^ simd::hash32(seed + spawnGeneration));
+        auto next = [&h]() {
+            h = simd::hash32(h);
+            return simd::unitFloat(h);
+        };
+
+        const glm::vec3& lo = emitter.boxMin;
+        const glm::vec3& hi = emitter.boxMax;
+
+        posX[i] = lo.x + (hi.x - lo.x) * next();
+        posY[i] = (initial || !emitter.respawnOnTop) ? lo.y + (hi.y - lo.y) * next() : hi.y;
+        posZ[i] = lo.z + (hi.z - lo.z) * next();
+
+        velX[i] = emitter.velocityMin.x + (emitter.velocityMax.x - emitter.velocityMin.x) * next();
+        velY[i] = emitter.velocityMin.y + (emitter.velocityMax.y - emitter.velocityMin.y) * next();
+        velZ[i] = emitter.velocityMin.z + (emitter.velocityMax.z - emitter.velocityMin.z) * next();
+
+        phase[i] = TWO_PI * next();
+        life[i] = emitter.lifeMin + (emitter.lifeMax - emitter.lifeMin) * next();
+        //spread the first generation over its lifetime so they don't all expire together
+        age[i] = initial ? life[i] * next() : 0.0f;
+    }
+
+    void ParticleSystem::update(float dt, float time, ThreadPool* pool) {
+        if (count == 0)
+            return;
+
+        spawnGeneration++;
+
+        if (!pool) {
+            updateRange(0, count, dt, time);
+            return;
+        }
+
+        pool->parallelFor(count, PARTICLE_CHUNK, [&](size_t begin, size_t end) {
+            updateRange(begin, end, dt, time);
+        });
+    }
+
+    void ParticleSystem::updateRange(size_t begin, size_t end, float dt, float time) {
+#if defined(GPS_SIMD_X86)
+        if (simd::hasAVX2())
+            updateRangeAVX2(begin, end, dt, time);
+        else
+            updateRangeSSE(begin, end, dt, time);
+#else
+        updateRangeScalar(begin, end, dt, time);
+#endif
+    }
+
+    void ParticleSystem::updateRangeScalar(size_t begin, size_t end, float dt, float time) {
+        float swayPhase = emitter.swayFrequency * time;
+        float swayStep = emitter.swayAmplitude * dt;
+
+        for (size_t i = begin; i < end; i++) {
+            posX[i] += velX[i] * dt + simd::fastSin(phase[i] + swayPhase) * swayStep;
+            posY[i] += velY[i] * dt;
+            posZ[i] += velZ[i] * dt;
+            age[i] += dt;
+
+            if (age[i] >= life[i] || posY[i] < emitter.floorY)
+                spawn(i, false);
+        }
+    }
+
+#if defined(GPS_SIMD_X86)
+
+    static inline __m128 fastSin4(__m128 x) {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+
+        //wrap to [-pi, pi]; cvtps rounds to nearest under the default MXCSR
+        __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(INV_TWO_PI))));
+        x = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(TWO_PI)));
+
+        __m128 ax = _mm_andnot_ps(signMask, x);
+        __m128 y = _mm_mul_ps(x, _mm_add_ps(_mm_set1_ps(SIN_B), _mm_mul_ps(_mm_set1_ps(SIN_C), ax)));
+
+        __m128 ay = _mm_andnot_ps(signMask, y);
+        return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_P), _mm_sub_ps(_mm_mul_ps(y, ay), y)), y);
+    }
+
+    void ParticleSystem::updateRangeSSE(size_t begin, size_t end, float dt, float time) {
+        const __m128 vdt = _mm_set1_ps(dt);
+        const __m128 vswayPhase = _mm_set1_ps(emitter.swayFrequency * time);
+        const __m128 vswayStep = _mm_set1_ps(emitter.swayAmplitude * dt);
+        const __m128 vfloor = _mm_set1_ps(emitter.floorY);
+
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(&posX[i]);
+            __m128 y = _mm_loadu_ps(&posY[i]);
+            __m128 z = _mm_loadu_ps(&posZ[i]);
+            __m128 s = fastSin4(_mm_add_ps(_mm_loadu_ps(&phase[i]), vswayPhase));
+
+            x = _mm_add_ps(x, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&velX[i]), vdt), _mm_mul_ps(s, vswayStep)));
+            y = _mm_add_ps(y, _mm_mul_ps(_mm_loadu_ps(&velY[i]), vdt));
+            z = _mm_add_ps(z, _mm_mul_ps(_mm_loadu_ps(&velZ[i]), vdt));
+            __m128 a = _mm_add_ps(_mm_loadu_ps(&age[i]), vdt);
+
+            _mm_storeu_ps(&posX[i], x);
+            _mm_storeu_ps(&posY[i], y);
+            _mm_storeu_ps(&posZ[i], z);
+            _mm_storeu_ps(&age[i], a);
+
+            __m128 dead = _mm_or_ps(_mm_cmpge_ps(a, _mm_loadu_ps(&life[i])), _mm_cmplt_ps(y, vfloor));
+            int mask = _mm_movemask_ps(dead);
+            while (mask) {
+                int lane = 0;
+                while (!(mask & (1 << lane)))
+                    lane++;
+                spawn(i + lane, false);
+                mask &= ~(1 << lane);
+            }
+        }
+
+        updateRangeScalar(i, end, dt, time);
+    }
+
+    GPS_TARGET_AVX2 static inline __m256 fastSin8(__m256 x) {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(INV_TWO_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        x = _mm256_fnmadd_ps(k, _mm256_set1_ps(TWO_PI), x);
+
+        __m256 ax = _mm256_andnot_ps(signMask, x);
+        __m256 y = _mm256_mul_ps(x, _mm256_fmadd_ps(_mm256_set1_ps(SIN_C), ax, _mm256_set1_ps(SIN_B)));
+
+        __m256 ay = _mm256_andnot_ps(signMask, y);
+        return _mm256_fmadd_ps(_mm256_set1_ps(SIN_P), _mm256_fmsub_ps(y, ay, y), y);
+    }
+
+    GPS_TARGET_AVX2 void ParticleSystem::updateRangeAVX2(size_t begin, size_t end, float dt, float time) {
+        const __m256 vdt = _mm256_set1_ps(dt);
+        const __m256 vswayPhase = _mm256_set1_ps(emitter.swayFrequency * time);
+        const __m256 vswayStep = _mm256_set1_ps(emitter.swayAmplitude * dt);
+        const __m256 vfloor = _mm256_set1_ps(emitter.floorY);
+
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 x = _mm256_loadu_ps(&posX[i]);
+            __m256 y = _mm256_loadu_ps(&posY[i]);
+            __m256 z = _mm256_loadu_ps(&posZ[i]);
+            __m256 s = fastSin8(_mm256_add_ps(_mm256_loadu_ps(&phase[i]), vswayPhase));
+
+            x = _mm256_fmadd_ps(_mm256_loadu_ps(&velX[i]), vdt, _mm256_fmadd_ps(s, vswayStep, x));
+            y = _mm256_fmadd_ps(_mm256_loadu_ps(&velY[i]), vdt, y);
+            z = _mm256_fmadd_ps(_mm256_loadu_ps(&velZ[i]), vdt, z);
+            __m256 a = _mm256_add_ps(_mm256_loadu_ps(&age[i]), vdt);
+
+            _mm256_storeu_ps(&posX[i], x);
+            _mm256_storeu_ps(&posY[i], y);
+            _mm256_storeu_ps(&posZ[i], z);
+            _mm256_storeu_ps(&age[i], a);
+
+            __m256 dead = _mm256_or_ps(
+                _mm256_cmp_ps(a, _mm256_loadu_ps(&life[i]), _CMP_GE_OQ),
+                _mm256_cmp_ps(y, vfloor, _CMP_LT_OQ));
+            int mask = _mm256_movemask_ps(dead);
+            while (mask) {
+                int lane = 0;
+                while (!(mask & (1 << lane)))
+                    lane++;
+                spawn(i + lane, false);
+                mask &= ~(1 << lane);
+            }
+        }
+
+        updateRangeScalar(i, end, dt, time);
+    }
+
+#endif
+
+    void ParticleSystem::runBenchmark(size_t particleCount, ThreadPool& pool) {
+        ParticleEmitter e;
+        e.boxMin = glm::vec3(-5.0f, 0.0f, -8.0f);
+        e.boxMax = glm::vec3(5.0f, 4.0f, 2.0f);
+        e.velocityMin = glm::vec3(0.0f, -3.3f, 0.0f);
+        e.velocityMax = glm::vec3(0.0f, -0.3f, 0.0f);
+        e.lifeMin = 2.0f;
+        e.lifeMax = 20.0f;
+        e.swayAmplitude = 0.06f;
+        e.swayFrequency = 1.0f;
+
+        ParticleSystem ps;
+        ps.init(particleCount, e);
+
+        const float dt = 1.0f / 60.0f;
+        const int warmup = 5;
+        const int frames = 100;
+
+        std::cout << "Particle benchmark: " << particleCount << " particles, "
+            << simd::bestKernelName() << " kernel" << std::endl;
+
+        auto measure = [&](ThreadPool* p, const char* label) {
+            float t = 0.0f;
+            for (int f = 0; f < warmup; f++, t += dt)
+                ps.update(dt, t, p);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int f = 0; f < frames; f++, t += dt)
+                ps.update(dt, t, p);
+            auto stop = std::chrono::high_resolution_clock::now();
+
+            double ms = std::chrono::duration<double, std::milli>(stop - start).count() / frames;
+            double perMs = particleCount / ms / 1.0e6;
+            std::cout << "  " << label << ": " << ms << " ms/update, "
+                << perMs << " M particles/ms" << std::endl;
+        };
+
+        measure(nullptr, "1 thread");
+        std::string pooled = "thread pool (" + std::to_string(pool.getConcurrency()) + " threads)";
+        measure(&pool, pooled.c_str());
+    }
+}
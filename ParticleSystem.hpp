@@ -0,0 +1,81 @@
+#ifndef ParticleSystem_hpp
+#define ParticleSystem_hpp
+
+#include <glm/glm.hpp>
+
+#include "SimdUtils.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gps {
+
+    //describes where particles are born and how they move; all rates are per second
+    struct ParticleEmitter {
+        //spawn volume (world space)
+        glm::vec3 boxMin = glm::vec3(-1.0f);
+        glm::vec3 boxMax = glm::vec3(1.0f);
+        //recycled particles start on the top face of the box instead of anywhere inside it
+        bool respawnOnTop = true;
+
+        //initial velocity range (m/s)
+        glm::vec3 velocityMin = glm::vec3(0.0f, -1.0f, 0.0f);
+        glm::vec3 velocityMax = glm::vec3(0.0f, -0.1f, 0.0f);
+
+        //lifetime range (s)
+        float lifeMin = 5.0f;
+        float lifeMax = 10.0f;
+
+        //sideways drift along x: swayAmplitude * sin(swayFrequency * time + phase) (m/s)
+        float swayAmplitude = 0.0f;
+        float swayFrequency = 1.0f;
+
+        //particles falling below this height are recycled
+        float floorY = 0.0f;
+    };
+
+    class ParticleSystem {
+
+    public:
+        //allocates the SoA streams and fills them from the emitter
+        void init(size_t capacity, const ParticleEmitter& emitter, uint32_t seed = 1);
+
+        //advances every particle by dt seconds; time drives the sway phase
+        //when a pool is given the particles are processed in chunks on its workers
+        void update(float dt, float time, ThreadPool* pool = nullptr);
+
+        size_t size() const { return count; }
+        const float* getPositionsX() const { return posX.data(); }
+        const float* getPositionsY() const { return posY.data(); }
+        const float* getPositionsZ() const { return posZ.data(); }
+        glm::vec3 getPosition(size_t i) const { return glm::vec3(posX[i], posY[i], posZ[i]); }
+
+        ParticleEmitter& getEmitter() { return emitter; }
+
+        //updates particleCount particles for a while and prints millions of particles per millisecond
+        static void runBenchmark(size_t particleCount, ThreadPool& pool);
+
+    private:
+        ParticleEmitter emitter;
+        size_t count = 0;
+        uint32_t seed = 1;
+        uint32_t spawnGeneration = 0;
+
+        //struct-of-arrays particle state
+        simd::FloatArray posX, posY, posZ;
+        simd::FloatArray velX, velY, velZ;
+        simd::FloatArray phase;
+        simd::FloatArray age, life;
+
+        void spawn(size_t i, bool initial);
+        void updateRange(size_t begin, size_t end, float dt, float time);
+        void updateRangeScalar(size_t begin, size_t end, float dt, float time);
+#if defined(GPS_SIMD_X86)
+        void updateRangeSSE(size_t begin, size_t end, float dt, float time);
+        GPS_TARGET_AVX2 void updateRangeAVX2(size_t begin, size_t end, float dt, float time);
+#endif
+    };
+}
+
+#endif /* ParticleSystem_hpp */
@@ -0,0 +1,109 @@
+#include "ProgramCache.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace gps {
+
+    void ProgramCache::init(const std::string& directory) {
+        this->directory = directory;
+        hitCount = missCount = rejectCount = 0;
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        enabled = formats > 0 && !error;
+
+        //a driver update changes at least one of these, and its binaries with them
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+        driver = hash("");
+        for (GLenum name : strings) {
+            const GLubyte* value = glGetString(name);
+            driver = hash(value ? (const char*)value : "", driver);
+        }
+    }
+
+    std::string ProgramCache::pathFor(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    bool ProgramCache::load(uint64_t key, GLuint program) {
+        if (!enabled)
+            return false;
+
+        std::ifstream file(pathFor(key), std::ios::binary);
+        if (!file) {
+            missCount++;
+            return false;
+        }
+
+        BinaryHeader header = {};
+        std::vector<char> binary;
+        if (file.read((char*)&header, sizeof(header)) && header.magic == MAGIC
+            && header.driver == driver && header.key == key && header.length > 0) {
+            binary.resize(header.length);
+            file.read(binary.data(), header.length);
+        }
+        if (binary.empty() || !file) {
+            rejectCount++;
+            return false;
+        }
+
+        //the driver may still refuse a binary of its own (e.g. changed state it depends on)
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            rejectCount++;
+            return false;
+        }
+
+        hitCount++;
+        return true;
+    }
+
+    void ProgramCache::store(uint64_t key, GLuint program) {
+        if (!enabled)
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        BinaryHeader header = { MAGIC, format, driver, key, (uint32_t)length, 0 };
+
+        //written aside and renamed, so an interrupted run never leaves a torn file behind
+        std::string path = pathFor(key);
+        {
+            std::ofstream file(path + ".tmp", std::ios::binary | std::ios::trunc);
+            if (!file)
+                return;
+            file.write((const char*)&header, sizeof(header));
+            file.write(binary.data(), length);
+            if (!file)
+                return;
+        }
+        std::error_code error;
+        std::filesystem::rename(path + ".tmp", path, error);
+    }
+
+    uint64_t ProgramCache::hash(const std::string& data, uint64_t seed) {
+        uint64_t h = seed;
+        for (unsigned char c : data) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+}
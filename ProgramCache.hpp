@@ -0,0 +1,71 @@
+#ifndef ProgramCache_hpp
+#define ProgramCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    //linked program binaries kept on disk between runs (GL 4.1 / ARB_get_program_binary), so a
+    //warm start skips compiling and linking
+    //a binary is stored under a hash of everything that went into the program (expanded
+    //sources, defines, captured varyings) and is only handed back to the driver that wrote it
+    //(vendor, renderer and version strings); a missing file, another driver or a binary the
+    //driver refuses all read as a miss, and the caller compiles from source
+    class ProgramCache {
+
+    public:
+        //directory is created if needed; needs a current GL context
+        //stays disabled when the driver offers no binary format
+        void init(const std::string& directory);
+        bool isEnabled() const { return enabled; }
+
+        //loads the binary stored for key into program; true if the program is now linked
+        //on false the program is left unlinked and can still be built from source
+        bool load(uint64_t key, GLuint program);
+
+        //writes a linked program under key; link it with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+        void store(uint64_t key, GLuint program);
+
+        //FNV-1a, chained through seed to key several strings
+        static uint64_t hash(const std::string& data, uint64_t seed = 14695981039346656037ull);
+
+        //since init(): programs loaded, keys without a file, and files found stale or refused
+        unsigned getHitCount() const { return hitCount; }
+        unsigned getMissCount() const { return missCount; }
+        unsigned getRejectCount() const { return rejectCount; }
+
+    private:
+        //file header, followed by length bytes of the binary
+        struct BinaryHeader {
+            uint32_t magic;
+            uint32_t format;
+            uint64_t driver;
+            uint64_t key;
+            uint32_t length;
+            uint32_t reserved;
+        };
+
+        static const uint32_t MAGIC = 0x31424750u;  // "PGB1"
+
+        std::string directory;
+        uint64_t driver = 0;
+        bool enabled = false;
+
+        unsigned hitCount = 0;
+        unsigned missCount = 0;
+        unsigned rejectCount = 0;
+
+        std::string pathFor(uint64_t key) const;
+    };
+}
+
+#endif /* ProgramCache_hpp */
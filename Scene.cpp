@@ -0,0 +1,75 @@
+#include "Scene.hpp"
+
+#include <cassert>
+
+namespace gps {
+
+    EntityId Scene::addEntity(const std::string& name, MeshRef mesh, uint32_t material,
+        const glm::mat4& localTransform, uint32_t flags, EntityId parent) {
+
+        EntityId id = (EntityId)names.size();
+        assert(parent == NO_ENTITY || parent < id);
+
+        names.push_back(name);
+        parents.push_back(parent);
+        localTransforms.push_back(localTransform);
+        worldTransforms.push_back(glm::mat4(1.0f));
+        meshes.push_back(mesh);
+        materials.push_back(material);
+        localBounds.push_back(meshBounds(mesh));
+        worldBounds.push_back(AABB());
+        this->flags.push_back(flags);
+        dirty.push_back(1);
+
+        return id;
+    }
+
+    void Scene::setLocalTransform(EntityId id, const glm::mat4& localTransform) {
+        localTransforms[id] = localTransform;
+        dirty[id] = 1;
+    }
+
+    void Scene::updateTransforms() {
+        lastUpdated.clear();
+
+        for (EntityId i = 0; i < (EntityId)names.size(); i++) {
+            EntityId p = parents[i];
+
+            //a parent that moved this sweep drags its children along
+            if (p != NO_ENTITY && dirty[p])
+                dirty[i] = 1;
+
+            if (!dirty[i])
+                continue;
+
+            worldTransforms[i] = (p == NO_ENTITY) ? localTransforms[i] : worldTransforms[p] * localTransforms[i];
+            worldBounds[i] = transformAABB(localBounds[i], worldTransforms[i]);
+            lastUpdated.push_back(i);
+        }
+
+        //clear after the sweep so the propagation above still sees this frame's flags
+        for (EntityId i : lastUpdated)
+            dirty[i] = 0;
+    }
+
+    EntityId Scene::find(const std::string& name) const {
+        for (EntityId i = 0; i < (EntityId)names.size(); i++) {
+            if (names[i] == name)
+                return i;
+        }
+        return NO_ENTITY;
+    }
+
+    AABB Scene::meshBounds(const MeshRef& mesh) {
+        switch (mesh.kind) {
+        case MESH_QUAD:
+            return AABB(glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 0.0f, 0.5f));
+        case MESH_CUBE:
+            return AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+        case MESH_MODEL:
+            return mesh.model ? mesh.model->getBounds() : AABB();
+        default:
+            return AABB();
+        }
+    }
+}
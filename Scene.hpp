@@ -0,0 +1,82 @@
+#ifndef Scene_hpp
+#define Scene_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "Model3D.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    typedef uint32_t EntityId;
+    const EntityId NO_ENTITY = 0xFFFFFFFFu;
+
+    //what gets drawn for an entity
+    enum MeshKind : uint8_t {
+        MESH_NONE,      // pure transform node (groups children)
+        MESH_QUAD,      // unit quad in the xz plane
+        MESH_CUBE,      // unit cube
+        MESH_MODEL      // every mesh of a Model3D
+    };
+
+    enum EntityFlags : uint32_t {
+        ENTITY_VISIBLE     = 1u << 0,
+        ENTITY_CAST_SHADOW = 1u << 1,
+        ENTITY_TRANSPARENT = 1u << 2,   // drawn after the opaque entities, blended, no depth writes
+        ENTITY_DYNAMIC     = 1u << 3,   // transform is expected to change every frame
+        ENTITY_OCCLUDER    = 1u << 4,   // rasterized into the cpu occlusion buffer
+        ENTITY_QUERIED     = 1u << 5    // expensive model, drawn behind a hardware occlusion query
+    };
+
+    struct MeshRef {
+        MeshKind kind;
+        gps::Model3D* model;
+    };
+
+    //flat, contiguous entity storage shared by every render pass
+    //entities are stored parents-first, so one forward sweep resolves the hierarchy
+    class Scene {
+
+    public:
+        //adds an entity; parent must already exist (or be NO_ENTITY for a root)
+        EntityId addEntity(const std::string& name, MeshRef mesh, uint32_t material,
+            const glm::mat4& localTransform, uint32_t flags, EntityId parent = NO_ENTITY);
+
+        //replaces the local transform and marks the entity (and its subtree) for update
+        void setLocalTransform(EntityId id, const glm::mat4& localTransform);
+
+        //recomputes world matrices and world bounds of dirty entities only
+        void updateTransforms();
+
+        //entities whose world transform changed during the last updateTransforms()
+        const std::vector<EntityId>& getLastUpdated() const { return lastUpdated; }
+
+        size_t size() const { return names.size(); }
+        EntityId find(const std::string& name) const;
+
+        bool hasFlags(EntityId id, uint32_t mask) const { return (flags[id] & mask) == mask; }
+
+        //per-entity streams, indexed by EntityId
+        std::vector<std::string> names;
+        std::vector<EntityId> parents;
+        std::vector<glm::mat4> localTransforms;
+        std::vector<glm::mat4> worldTransforms;
+        std::vector<MeshRef> meshes;
+        std::vector<uint32_t> materials;
+        std::vector<AABB> localBounds;
+        std::vector<AABB> worldBounds;
+        std::vector<uint32_t> flags;
+
+    private:
+        std::vector<uint8_t> dirty;
+        std::vector<EntityId> lastUpdated;
+
+        static AABB meshBounds(const MeshRef& mesh);
+    };
+}
+
+#endif /* Scene_hpp */
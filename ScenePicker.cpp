@@ -0,0 +1,231 @@
+#include "ScenePicker.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <map>
+
+namespace gps {
+
+    //entities per top level leaf; there are few of them, each far more costly than a box test
+    static const uint32_t TOP_LEAF_SIZE = 2;
+
+    void ScenePicker::build(const Scene& scene, const std::vector<glm::vec3>& quad, const std::vector<glm::vec3>& cube,
+        ThreadPool* pool) {
+
+        shapes.clear();
+        instances.assign(scene.size(), Instance());
+        entityBounds.assign(scene.size(), AABB());
+        entities.clear();
+
+        //the primitives first, then every model once however many entities show it
+        shapes.resize(2);
+        shapes[0].bvh.build(quad, pool, 8);
+        shapes[0].meshFirst = { 0 };
+        shapes[1].bvh.build(cube, pool, 8);
+        shapes[1].meshFirst = { 0 };
+
+        std::map<const Model3D*, uint32_t> modelShapes;
+        for (EntityId id = 0; id < (EntityId)scene.size(); id++) {
+            const MeshRef& mesh = scene.meshes[id];
+            if (mesh.kind == MESH_QUAD)
+                instances[id].shape = 0;
+            else if (mesh.kind == MESH_CUBE)
+                instances[id].shape = 1;
+            else if (mesh.kind == MESH_MODEL && mesh.model) {
+                auto found = modelShapes.find(mesh.model);
+                if (found == modelShapes.end()) {
+                    Shape shape;
+                    uint32_t first = 0;
+                    for (const Mesh& m : mesh.model->getMeshes()) {
+                        shape.meshFirst.push_back(first);
+                        first += (uint32_t)(m.indices.size() / 3);
+                    }
+                    shape.bvh.build(mesh.model->getTriangles(), pool, 8);
+                    found = modelShapes.emplace(mesh.model, (uint32_t)shapes.size()).first;
+                    shapes.push_back(std::move(shape));
+                }
+                instances[id].shape = found->second;
+            }
+            else {
+                continue;
+            }
+
+            setInstance(scene, id);
+            if (entityBounds[id].isValid())
+                entities.push_back(id);
+        }
+
+        nodes.clear();
+        if (entities.empty())
+            return;
+        nodes.push_back(Node());
+        split(0, 0, (uint32_t)entities.size());
+    }
+
+    void ScenePicker::setInstance(const Scene& scene, EntityId id) {
+        Instance& instance = instances[id];
+        instance.flags = scene.flags[id];
+        instance.worldToObject = glm::inverse(scene.worldTransforms[id]);
+        instance.normalMatrix = glm::inverseTranspose(glm::mat3(scene.worldTransforms[id]));
+        entityBounds[id] = scene.worldBounds[id];
+    }
+
+    //median split on the longest axis of the box centers, leaves of TOP_LEAF_SIZE entities
+    void ScenePicker::split(uint32_t node, uint32_t begin, uint32_t end) {
+        AABB bounds, centers;
+        for (uint32_t i = begin; i < end; i++) {
+            bounds.expand(entityBounds[entities[i]]);
+            centers.expand(entityBounds[entities[i]].center());
+        }
+        nodes[node].minCorner = bounds.minCorner;
+        nodes[node].maxCorner = bounds.maxCorner;
+        nodes[node].first = begin;
+        nodes[node].count = end - begin;
+        if (end - begin <= TOP_LEAF_SIZE)
+            return;
+
+        glm::vec3 size = centers.maxCorner - centers.minCorner;
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(entities.begin() + begin, entities.begin() + mid, entities.begin() + end,
+            [this, axis](EntityId a, EntityId b) { return entityBounds[a].center()[axis] < entityBounds[b].center()[axis]; });
+
+        uint32_t left = (uint32_t)nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[node].first = left;
+        nodes[node].count = 0;
+        split(left, begin, mid);
+        split(left + 1, mid, end);
+    }
+
+    void ScenePicker::update(const Scene& scene) {
+        const std::vector<EntityId>& moved = scene.getLastUpdated();
+        bool changed = false;
+        for (EntityId id : moved) {
+            if (id < instances.size() && instances[id].shape != NO_SHAPE) {
+                setInstance(scene, id);
+                changed = true;
+            }
+        }
+        if (changed)
+            refit();
+    }
+
+    //the tree keeps its shape, only the boxes follow the entities (children come after parents)
+    void ScenePicker::refit() {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& n = nodes[i];
+            AABB b;
+            if (n.count > 0) {
+                for (uint32_t e = n.first; e < n.first + n.count; e++)
+                    b.expand(entityBounds[entities[e]]);
+            }
+            else {
+                b.expand(AABB(nodes[n.first].minCorner, nodes[n.first].maxCorner));
+                b.expand(AABB(nodes[n.first + 1].minCorner, nodes[n.first + 1].maxCorner));
+            }
+            n.minCorner = b.minCorner;
+            n.maxCorner = b.maxCorner;
+        }
+    }
+
+    size_t ScenePicker::getTriangleCount() const {
+        size_t count = 0;
+        for (const Shape& shape : shapes)
+            count += shape.bvh.getTriangleCount();
+        return count;
+    }
+
+    static bool intersectBox(const glm::vec3& minCorner, const glm::vec3& maxCorner, const Ray& ray,
+        const glm::vec3& invDir, float tMax, float& tNear) {
+        glm::vec3 t0 = (minCorner - ray.origin) * invDir;
+        glm::vec3 t1 = (maxCorner - ray.origin) * invDir;
+        glm::vec3 lo = glm::min(t0, t1);
+        glm::vec3 hi = glm::max(t0, t1);
+        tNear = std::max(std::max(lo.x, lo.y), std::max(lo.z, 0.0f));
+        float tFar = std::min(std::min(hi.x, hi.y), std::min(hi.z, tMax));
+        return tNear <= tFar;
+    }
+
+    bool ScenePicker::pick(const Ray& ray, PickHit& hit, uint32_t required, uint32_t excluded) const {
+        if (nodes.empty())
+            return false;
+
+        glm::vec3 invDir = 1.0f / ray.direction;
+        float tMax = ray.tMax;
+        EntityId bestEntity = NO_ENTITY;
+        RayHit best;
+
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            float tNear;
+            if (!intersectBox(node.minCorner, node.maxCorner, ray, invDir, tMax, tNear))
+                continue;
+
+            if (node.count == 0) {
+                //nearer child on top; its hit may cull the other one
+                const Node& l = nodes[node.first];
+                const Node& r = nodes[node.first + 1];
+                float tLeft, tRight;
+                bool left = intersectBox(l.minCorner, l.maxCorner, ray, invDir, tMax, tLeft);
+                bool right = intersectBox(r.minCorner, r.maxCorner, ray, invDir, tMax, tRight);
+                if (left && right) {
+                    bool leftFirst = tLeft <= tRight;
+                    stack[top++] = leftFirst ? node.first + 1 : node.first;
+                    stack[top++] = leftFirst ? node.first : node.first + 1;
+                }
+                else if (left) {
+                    stack[top++] = node.first;
+                }
+                else if (right) {
+                    stack[top++] = node.first + 1;
+                }
+                continue;
+            }
+
+            for (uint32_t e = node.first; e < node.first + node.count; e++) {
+                EntityId id = entities[e];
+                const Instance& instance = instances[id];
+                if ((instance.flags & required) != required || (instance.flags & excluded) != 0)
+                    continue;
+
+                //the direction is transformed, not normalized, so t means the same in both spaces
+                Ray local;
+                local.origin = glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f));
+                local.direction = glm::mat3(instance.worldToObject) * ray.direction;
+                local.tMax = tMax;
+
+                RayHit h;
+                if (shapes[instance.shape].bvh.intersect(local, h)) {
+                    tMax = h.t;
+                    best = h;
+                    bestEntity = id;
+                }
+            }
+        }
+
+        if (bestEntity == NO_ENTITY)
+            return false;
+
+        const Instance& instance = instances[bestEntity];
+        const Shape& shape = shapes[instance.shape];
+        uint32_t mesh = (uint32_t)(std::upper_bound(shape.meshFirst.begin(), shape.meshFirst.end(), best.triangle)
+            - shape.meshFirst.begin()) - 1;
+
+        hit.entity = bestEntity;
+        hit.mesh = mesh;
+        hit.triangle = best.triangle - shape.meshFirst[mesh];
+        hit.distance = best.t;
+        hit.position = ray.origin + ray.direction * best.t;
+        hit.normal = glm::normalize(instance.normalMatrix * shape.bvh.getNormal(best.triangle));
+        if (glm::dot(hit.normal, ray.direction) > 0.0f)
+            hit.normal = -hit.normal;
+        return true;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef ScenePicker_hpp
+#define ScenePicker_hpp
+
+#include <glm/glm.hpp>
+
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleBVH.hpp"
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    struct PickHit {
+        EntityId entity = NO_ENTITY;
+        uint32_t mesh = 0;          // index into the model's getMeshes(); 0 for quads and cubes
+        uint32_t triangle = 0;      // within that mesh, in index buffer order
+        float distance = FLT_MAX;   // along the ray, in units of its direction
+        glm::vec3 position = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f);     // world space, geometric, facing the ray
+    };
+
+    //ray queries against the triangles of the scene's entities, in two levels: a small BVH over
+    //the entities' world boxes, whose leaves lead into object space triangle BVHs, one per
+    //Model3D (shared by all of its entities) plus one each for the quad and the cube
+    //a ray enters a triangle BVH through its entity's inverse world transform, so a moving
+    //entity only refits the top level and the scan triangles are never touched again
+    class ScenePicker {
+
+    public:
+        //quad, cube: object space triangles of the two primitives, three vertices each
+        void build(const Scene& scene, const std::vector<glm::vec3>& quad, const std::vector<glm::vec3>& cube,
+            ThreadPool* pool = nullptr);
+
+        //follows the entities that moved in the last Scene::updateTransforms()
+        void update(const Scene& scene);
+
+        //closest hit on an entity with all of the required flags and none of the excluded ones
+        bool pick(const Ray& ray, PickHit& hit, uint32_t required = ENTITY_VISIBLE,
+            uint32_t excluded = ENTITY_TRANSPARENT) const;
+
+        size_t getShapeCount() const { return shapes.size(); }
+        size_t getTriangleCount() const;
+
+    private:
+        static const uint32_t NO_SHAPE = 0xFFFFFFFFu;
+
+        //a triangle BVH and where each mesh's triangles start in it
+        struct Shape {
+            TriangleBVH bvh;
+            std::vector<uint32_t> meshFirst;
+        };
+
+        struct Instance {
+            uint32_t shape = NO_SHAPE;
+            uint32_t flags = 0;
+            glm::mat4 worldToObject = glm::mat4(1.0f);
+            glm::mat3 normalMatrix = glm::mat3(1.0f);
+        };
+
+        //same layout as the triangle BVH's nodes; leaves hold entities[first, first + count)
+        struct Node {
+            glm::vec3 minCorner;
+            uint32_t first;
+            glm::vec3 maxCorner;
+            uint32_t count;
+        };
+
+        std::vector<Shape> shapes;
+        std::vector<Instance> instances;            // per entity
+        std::vector<EntityId> entities;             // the pickable ones, in top level leaf order
+        std::vector<AABB> entityBounds;             // world boxes, per entity
+        std::vector<Node> nodes;
+
+        void setInstance(const Scene& scene, EntityId id);
+        void split(uint32_t node, uint32_t begin, uint32_t end);
+        void refit();
+    };
+}
+
+#endif /* ScenePicker_hpp */
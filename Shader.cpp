@@ -27,9 +27,49 @@ namespace gps {
         
         //convert stream into GLchar array
         shaderString = shaderStringStream.str();
-        return shaderString;
+        return expandIncludes(shaderString, fileName);
+    }
+
+    std::string Shader::expandIncludes(const std::string& source, const std::string& fileName) {
+
+        //#include "name" lines are replaced by the file, relative to the including one, so
+        //shaders can share their lighting code
+        std::string directory;
+        size_t slash = fileName.find_last_of("/\\");
+        if (slash != std::string::npos)
+            directory = fileName.substr(0, slash + 1);
+
+        std::istringstream lines(source);
+        std::ostringstream expanded;
+        std::string line;
+        while (std::getline(lines, line)) {
+            size_t start = line.find_first_not_of(" \t");
+            if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+                size_t open = line.find('"', start);
+                size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+                if (close != std::string::npos) {
+                    expanded << readShaderFile(directory + line.substr(open + 1, close - open - 1)) << "\n";
+                    continue;
+                }
+            }
+            expanded << line << "\n";
+        }
+        return expanded.str();
     }
     
+    std::string Shader::insertDefines(const std::string& source) {
+
+        if (defines.empty())
+            return source;
+
+        //#version has to stay the first statement
+        size_t version = source.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return defines + source;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
     void Shader::shaderCompileLog(GLuint shaderId) {
 
         GLint success;
@@ -53,46 +93,124 @@ namespace gps {
         //check linking info
         glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+            glGetProgramInfoLog(shaderProgramId, 512, NULL, infoLog);
             std::cout << "Shader linking error\n" << infoLog << std::endl;
         }
     }
     
+    ProgramCache* Shader::programCache = nullptr;
+    bool Shader::parallelCompile = false;
+    std::unordered_map<GLuint, Shader::PendingProgram> Shader::pendingPrograms;
+
+    bool Shader::enableParallelCompile() {
+
+#if defined (GL_KHR_parallel_shader_compile) && !defined (__APPLE__)
+        if (GLEW_KHR_parallel_shader_compile) {
+            //as many threads as the driver wants
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+            parallelCompile = true;
+        }
+#endif
+        return parallelCompile;
+    }
+
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
 
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-        
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
-        
-        //attach and link the shader programs
+        loadShader(vertexShaderFileName, "", fragmentShaderFileName, {});
+    }
+    
+    GLuint Shader::compileShader(GLenum type, const std::string& source) {
+
+        const GLchar* sourceString = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &sourceString, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName,
+        std::string fragmentShaderFileName, const std::vector<std::string>& feedbackVaryings) {
+
+        //read every stage with its includes and defines
+        std::vector<std::pair<GLenum, std::string>> stages;
+        stages.push_back({ GL_VERTEX_SHADER, insertDefines(readShaderFile(vertexShaderFileName)) });
+        if (!geometryShaderFileName.empty())
+            stages.push_back({ GL_GEOMETRY_SHADER, insertDefines(readShaderFile(geometryShaderFileName)) });
+        if (!fragmentShaderFileName.empty())
+            stages.push_back({ GL_FRAGMENT_SHADER, insertDefines(readShaderFile(fragmentShaderFileName)) });
+
+        //the cache key covers everything the binary depends on besides the driver
+        PendingProgram pending;
+        pending.cacheKey = ProgramCache::hash("");
+        for (const auto& stage : stages)
+            pending.cacheKey = ProgramCache::hash(std::to_string(stage.first) + "\n" + stage.second + "\n", pending.cacheKey);
+        for (const std::string& name : feedbackVaryings)
+            pending.cacheKey = ProgramCache::hash("varying " + name + "\n", pending.cacheKey);
+
         this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
+        if (programCache && programCache->load(pending.cacheKey, this->shaderProgram))
+            return;
+
+        for (const auto& stage : stages)
+            pending.shaders.push_back(compileShader(stage.first, stage.second));
+        for (GLuint shader : pending.shaders)
+            glAttachShader(this->shaderProgram, shader);
+
+        //the captured outputs have to be named before linking
+        if (!feedbackVaryings.empty()) {
+            std::vector<const GLchar*> names;
+            for (const std::string& name : feedbackVaryings)
+                names.push_back(name.c_str());
+            glTransformFeedbackVaryings(this->shaderProgram, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+        }
+
+        if (programCache && programCache->isEnabled())
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+        //no status queries here, they would wait for the driver; the shaders are only flagged
+        //for deletion and live on while attached, so finish() can still read their logs
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
+        for (GLuint shader : pending.shaders)
+            glDeleteShader(shader);
+        pendingPrograms[this->shaderProgram] = pending;
+    }
+
+    bool Shader::isReady() const {
+
+        if (!parallelCompile || pendingPrograms.count(this->shaderProgram) == 0)
+            return true;
+
+#if defined (GL_KHR_parallel_shader_compile)
+        GLint completed = GL_FALSE;
+        glGetProgramiv(this->shaderProgram, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed == GL_TRUE;
+#else
+        return true;
+#endif
+    }
+
+    void Shader::finish() {
+
+        auto found = pendingPrograms.find(this->shaderProgram);
+        if (found == pendingPrograms.end())
+            return;
+        PendingProgram pending = found->second;
+        pendingPrograms.erase(found);
+
+        //check compilation and linking info
+        for (GLuint shader : pending.shaders)
+            shaderCompileLog(shader);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &linked);
         shaderLinkLog(this->shaderProgram);
+
+        if (linked && programCache)
+            programCache->store(pending.cacheKey, this->shaderProgram);
     }
     
     void Shader::useShaderProgram() {
 
+        finish();
         glUseProgram(this->shaderProgram);
     }
 
@@ -17,9 +17,15 @@
     #include <GL/glew.h>
 #endif
 
+#include "ProgramCache.hpp"
+
+#include <cstdint>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
@@ -28,11 +34,46 @@ namespace gps {
 
     public:
         GLuint shaderProgram;
+        //both overloads only issue the compile and link (or load the binary from the program
+        //cache) and return; the program is waited for on first use, see finish()
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+        //optional geometry stage, no fragment stage if its file name is empty (transform feedback
+        //only programs), and the outputs captured by transform feedback, interleaved
+        void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName,
+            std::string fragmentShaderFileName, const std::vector<std::string>& feedbackVaryings);
+        //finishes the program the first time
         void useShaderProgram();
+        //false while the driver is still compiling or linking on its own threads; never blocks
+        bool isReady() const;
+        //waits for the program, reports compile and link errors and writes it to the program
+        //cache; nothing to do after the first call
+        void finish();
+        //#define lines put right after the #version line of every stage loaded from now on
+        void setDefines(const std::string& defines) { this->defines = defines; }
     
+        //programs are looked up in and written to cache from now on (nullptr: always compile)
+        static void setProgramCache(ProgramCache* cache) { programCache = cache; }
+        //lets the driver compile and link in the background (KHR_parallel_shader_compile);
+        //needs a current GL context, false if the extension is missing
+        static bool enableParallelCompile();
+
     private:
+        //a program issued by loadShader() and not finished yet; kept by program name, so
+        //copies of a Shader (Model3D::Draw takes one by value) finish it only once
+        struct PendingProgram {
+            std::vector<GLuint> shaders;
+            uint64_t cacheKey = 0;
+        };
+
+        static ProgramCache* programCache;
+        static bool parallelCompile;
+        static std::unordered_map<GLuint, PendingProgram> pendingPrograms;
+
+        std::string defines;
+        std::string insertDefines(const std::string& source);
         std::string readShaderFile(std::string fileName);
+        std::string expandIncludes(const std::string& source, const std::string& fileName);
+        GLuint compileShader(GLenum type, const std::string& source);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
     };
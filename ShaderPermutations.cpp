@@ -0,0 +1,91 @@
+#include "ShaderPermutations.hpp"
+
+namespace gps {
+
+    void ShaderPermutations::init(const std::string& vertexFileName, const std::string& fragmentFileName,
+        const std::vector<std::string>& features, const ProgramFn& setup) {
+        destroy();
+        this->vertexFileName = vertexFileName;
+        this->fragmentFileName = fragmentFileName;
+        this->features = features;
+        this->setup = setup;
+    }
+
+    void ShaderPermutations::destroy() {
+        for (auto& variant : variants)
+            glDeleteProgram(variant.second.shader.shaderProgram);
+        variants.clear();
+    }
+
+    void ShaderPermutations::prepare(uint32_t key) {
+        if (variants.count(key) != 0)
+            return;
+
+        std::string defines;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (key & (1u << i))
+                defines += "#define " + features[i] + "\n";
+        }
+
+        Shader& shader = variants[key].shader;
+        shader.setDefines(defines);
+        shader.loadShader(vertexFileName, fragmentFileName);
+    }
+
+    Shader& ShaderPermutations::get(uint32_t key) {
+        auto found = variants.find(key);
+        if (found != variants.end() && found->second.setUp)
+            return found->second.shader;
+
+        prepare(key);
+        Variant& variant = variants[key];
+        if (!variant.shader.isReady()) {
+            Variant* standIn = findStandIn(key);
+            if (standIn) {
+                if (!standIn->setUp) {
+                    standIn->shader.finish();
+                    if (setup)
+                        setup(standIn->shader);
+                    standIn->setUp = true;
+                }
+                return standIn->shader;
+            }
+        }
+
+        variant.shader.finish();
+        if (setup)
+            setup(variant.shader);
+        variant.setUp = true;
+        return variant.shader;
+    }
+
+    //the ready variant that drops the fewest optional features of key, nullptr if there is none
+    ShaderPermutations::Variant* ShaderPermutations::findStandIn(uint32_t key) {
+        uint32_t optional = key & optionalFeatures;
+        Variant* best = nullptr;
+        int bestDropped = 33;
+
+        //every non-empty subset of the optional bits
+        for (uint32_t dropped = optional; dropped != 0; dropped = (dropped - 1) & optional) {
+            int count = 0;
+            for (uint32_t bits = dropped; bits != 0; bits &= bits - 1)
+                count++;
+            if (count >= bestDropped)
+                continue;
+
+            auto found = variants.find(key & ~dropped);
+            if (found != variants.end() && (found->second.setUp || found->second.shader.isReady())) {
+                best = &found->second;
+                bestDropped = count;
+            }
+        }
+        return best;
+    }
+
+    void ShaderPermutations::forEach(const ProgramFn& fn) {
+        for (auto& variant : variants) {
+            if (variant.second.setUp)
+                fn(variant.second.shader);
+        }
+    }
+}
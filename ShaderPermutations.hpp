@@ -0,0 +1,68 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    //one shader source specialized into a program per combination of feature bits
+    //bit i of a key puts "#define features[i]" in front of both stages, so the shader resolves
+    //its feature branches at compile time; a variant is compiled the first time its key is
+    //asked for and kept, so only the combinations the scene draws get built
+    //prepare() issues a variant early without waiting for it, so the driver can build the
+    //known ones side by side (see Shader::enableParallelCompile) before the first frame
+    //while a variant is still building on the driver's threads, get() can hand out a ready one
+    //that lacks some of its optional features instead of waiting for it
+    class ShaderPermutations {
+
+    public:
+        typedef std::function<void(Shader&)> ProgramFn;
+
+        //setup runs once on every new variant, right after it is linked (sampler units, block
+        //bindings, uniforms that are already known)
+        void init(const std::string& vertexFileName, const std::string& fragmentFileName,
+            const std::vector<std::string>& features, const ProgramFn& setup);
+        void destroy();
+
+        //starts compiling the variant for key unless it exists already; returns at once
+        void prepare(uint32_t key);
+
+        //features that only change the look (not the inputs or what gets discarded), which get()
+        //may leave out while the full variant is compiling; none by default
+        void setOptionalFeatures(uint32_t mask) { optionalFeatures = mask; }
+
+        //the variant for key, compiled now if it's the first request; the first get() of a
+        //variant waits for it and runs setup, unless a variant without some of the optional
+        //features is ready to stand in for it
+        Shader& get(uint32_t key);
+
+        //every variant that went through get() so far, e.g. for per-frame uniforms
+        void forEach(const ProgramFn& fn);
+
+        size_t getVariantCount() const { return variants.size(); }
+
+    private:
+        std::string vertexFileName;
+        std::string fragmentFileName;
+        std::vector<std::string> features;
+        ProgramFn setup;
+        uint32_t optionalFeatures = 0;
+
+        struct Variant {
+            Shader shader;
+            bool setUp = false;     // finished and through setup
+        };
+
+        std::unordered_map<uint32_t, Variant> variants;  // references stay valid on insert
+
+        Variant* findStandIn(uint32_t key);
+    };
+}
+
+#endif /* ShaderPermutations_hpp */
@@ -0,0 +1,188 @@
+#include "ShadowAtlas.hpp"
+
+#include "Culling.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        //the even bits of v packed together (x of a Morton code)
+        GLint compactBits(uint32_t v) {
+            v &= 0x55555555u;
+            v = (v | (v >> 1)) & 0x33333333u;
+            v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+            v = (v | (v >> 4)) & 0x00FF00FFu;
+            v = (v | (v >> 8)) & 0x0000FFFFu;
+            return (GLint)v;
+        }
+
+        bool boxInFrustum(const Frustum& f, const AABB& box) {
+            glm::vec3 c = box.center(), e = box.extents();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& pl = f.planes[p];
+                float d = glm::dot(glm::vec3(pl), c) + pl.w + glm::dot(glm::abs(glm::vec3(pl)), e);
+                if (d < 0.0f)
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    void ShadowAtlas::init(GLsizei size, GLsizei minTile, GLsizei maxTile, int lightCount) {
+        this->size = size;
+        this->minTile = minTile;
+        this->maxTile = std::min(maxTile, size);
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        tiles.assign(lightCount, Tile());
+        updates.clear();
+    }
+
+    void ShadowAtlas::destroy() {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &depthTexture);
+        framebuffer = depthTexture = 0;
+        tiles.clear();
+    }
+
+    GLsizei ShadowAtlas::tileSize(float importance) const {
+        GLsizei s = minTile;
+        while (s < maxTile && (float)(s * 2) <= importance * (float)size)
+            s *= 2;
+        return s;
+    }
+
+    void ShadowAtlas::allocate(const float* importance) {
+        std::vector<GLsizei> sizes(tiles.size());
+        bool changed = false;
+        for (size_t i = 0; i < tiles.size(); i++) {
+            tiles[i].importance = importance[i];
+            sizes[i] = tileSize(importance[i]);
+            changed = changed || sizes[i] != tiles[i].size;
+        }
+        if (!changed)
+            return;
+
+        //everything must fit: halve the largest tiles until it does
+        for (;;) {
+            size_t area = 0;
+            for (GLsizei s : sizes)
+                area += (size_t)s * (size_t)s;
+            if (area <= (size_t)size * (size_t)size)
+                break;
+            GLsizei* largest = &*std::max_element(sizes.begin(), sizes.end());
+            if (*largest <= minTile)
+                break;
+            *largest /= 2;
+        }
+
+        //largest first along a Morton curve of minTile cells: every power of two tile then
+        //starts aligned to its own size, so the packing has no holes
+        std::vector<int> order(tiles.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+        uint32_t cell = 0;
+        for (int i : order) {
+            Tile& t = tiles[i];
+            GLsizei cells = sizes[i] / minTile;
+            GLint x = compactBits(cell) * minTile;
+            GLint y = compactBits(cell >> 1) * minTile;
+            cell += (uint32_t)(cells * cells);
+
+            //no room left: the light goes without a shadow
+            GLsizei s = (x + sizes[i] <= size && y + sizes[i] <= size) ? sizes[i] : 0;
+            if (x != t.x || y != t.y || s != t.size || s == 0)
+                t.valid = false;
+            t.x = x;
+            t.y = y;
+            t.size = s;
+        }
+    }
+
+    void ShadowAtlas::invalidateMoved(const Scene& scene) {
+        for (Tile& t : tiles) {
+            if (!t.valid || t.dirty)
+                continue;
+            Frustum f = Frustum::fromMatrix(t.lightSpace);
+            for (EntityId id : scene.getLastUpdated()) {
+                if (scene.hasFlags(id, ENTITY_CAST_SHADOW) && scene.worldBounds[id].isValid()
+                    && boxInFrustum(f, scene.worldBounds[id])) {
+                    t.dirty = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    const std::vector<int>& ShadowAtlas::selectUpdates(const glm::mat4* lightSpaces, int budget) {
+        updates.clear();
+        for (int i = 0; i < (int)tiles.size(); i++) {
+            const Tile& t = tiles[i];
+            if (t.size > 0 && (!t.valid || t.dirty || t.lightSpace != lightSpaces[i]))
+                updates.push_back(i);
+        }
+
+        //frames spent waiting raise the priority, so a busy important tile can't starve the rest
+        auto priority = [&](int i) { return tiles[i].importance * (float)(1 + tiles[i].waited); };
+        std::stable_sort(updates.begin(), updates.end(), [&](int a, int b) {
+            if (tiles[a].valid != tiles[b].valid)
+                return !tiles[a].valid;
+            return priority(a) > priority(b);
+        });
+
+        if ((int)updates.size() > budget) {
+            deferredCount += (unsigned)updates.size() - (unsigned)budget;
+            for (size_t k = (size_t)budget; k < updates.size(); k++)
+                tiles[updates[k]].waited++;
+            updates.resize(budget);
+        }
+        return updates;
+    }
+
+    void ShadowAtlas::beginTile(int light, const glm::mat4& lightSpace) {
+        Tile& t = tiles[light];
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(t.x, t.y, t.size, t.size);
+        glScissor(t.x, t.y, t.size, t.size);
+        glEnable(GL_SCISSOR_TEST);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        t.lightSpace = lightSpace;
+        t.valid = true;
+        t.dirty = false;
+        t.waited = 0;
+        updateCount++;
+    }
+
+    void ShadowAtlas::endUpdates() {
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    glm::vec3 ShadowAtlas::getRect(int light) const {
+        const Tile& t = tiles[light];
+        return glm::vec3((float)t.x, (float)t.y, (float)t.size) / (float)size;
+    }
+}
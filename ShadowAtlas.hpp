@@ -0,0 +1,93 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Scene.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //shadow maps of many local lights as square tiles of one depth texture
+    //a tile's size follows its light's screen importance (powers of two between the min and max
+    //tile), and its depth is kept until the light matrix changes, a shadow caster inside the
+    //light's volume moves, or the packing moves the tile
+    //at most a budget of tiles is redrawn per frame, most important and longest waiting first;
+    //a tile that waits keeps the matrix it was drawn with, so its shadow lags instead of being
+    //wrong
+    class ShadowAtlas {
+
+    public:
+        //size x size GL_DEPTH_COMPONENT24 texture, linear filtered with hardware compare
+        //tile sizes are powers of two in [minTile, maxTile], maxTile <= size
+        //needs a current GL context
+        void init(GLsizei size, GLsizei minTile, GLsizei maxTile, int lightCount);
+        void destroy();
+
+        //importance in [0, 1] per light (roughly the share of the screen its volume covers);
+        //repacks the tiles when a size changes, and tiles that moved lose their contents
+        void allocate(const float* importance);
+
+        //marks the tiles whose light volume holds a shadow caster moved by the last
+        //Scene::updateTransforms()
+        void invalidateMoved(const Scene& scene);
+
+        //the lights whose tiles are out of date for lightSpaces (one matrix per light), at most
+        //budget of them: tiles without any contents first, then by importance times frames waited
+        const std::vector<int>& selectUpdates(const glm::mat4* lightSpaces, int budget);
+
+        //binds the atlas framebuffer, restricted to the light's tile, and clears the tile; draw
+        //the casters with lightSpace, then endUpdates() once all selected tiles are done
+        void beginTile(int light, const glm::mat4& lightSpace);
+        void endUpdates();
+
+        //whether the light has a shadow this frame, and the matrix / atlas rectangle
+        //(offset xy, scale z in texture coordinates) to sample it with
+        bool hasShadow(int light) const { return tiles[light].valid; }
+        const glm::mat4& getLightSpace(int light) const { return tiles[light].lightSpace; }
+        glm::vec3 getRect(int light) const;
+
+        GLuint getTexture() const { return depthTexture; }
+
+        //since the last resetStats(): tiles redrawn, and stale tiles left for a later frame
+        unsigned getUpdateCount() const { return updateCount; }
+        unsigned getDeferredCount() const { return deferredCount; }
+        void resetStats() { updateCount = 0; deferredCount = 0; }
+
+    private:
+        struct Tile {
+            GLint x = 0, y = 0;
+            GLsizei size = 0;
+            float importance = 0.0f;
+            glm::mat4 lightSpace = glm::mat4(1.0f);     // the one the contents were drawn with
+            bool valid = false;         // has contents at its current place
+            bool dirty = false;         // a caster in its volume moved
+            unsigned waited = 0;        // frames it was stale but over the budget
+        };
+
+        GLsizei size = 0;
+        GLsizei minTile = 0;
+        GLsizei maxTile = 0;
+        GLuint depthTexture = 0;
+        GLuint framebuffer = 0;
+
+        std::vector<Tile> tiles;
+        std::vector<int> updates;
+
+        unsigned updateCount = 0;
+        unsigned deferredCount = 0;
+
+        GLsizei tileSize(float importance) const;
+    };
+}
+
+#endif /* ShadowAtlas_hpp */
@@ -0,0 +1,96 @@
+#include "ShadowCache.hpp"
+
+namespace gps {
+
+    void ShadowCache::init(GLsizei size, GLsizei layers) {
+        this->size = size;
+        this->layers = layers;
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, layers, 0,
+            GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenFramebuffers(1, &readFramebuffer);
+        glGenFramebuffers(1, &drawFramebuffer);
+        for (GLuint fbo : { readFramebuffer, drawFramebuffer }) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        cachedLightSpaces.assign(layers, glm::mat4(1.0f));
+        valid = false;
+    }
+
+    void ShadowCache::destroy() {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteFramebuffers(1, &readFramebuffer);
+        glDeleteFramebuffers(1, &drawFramebuffer);
+        glDeleteTextures(1, &depthTexture);
+        framebuffer = readFramebuffer = drawFramebuffer = 0;
+        depthTexture = 0;
+        valid = false;
+    }
+
+    unsigned ShadowCache::staleLayers(const glm::mat4* lightSpaces) const {
+        unsigned mask = 0;
+        for (GLsizei l = 0; l < layers; l++) {
+            if (!valid || lightSpaces[l] != cachedLightSpaces[l])
+                mask |= 1u << l;
+        }
+        return mask;
+    }
+
+    void ShadowCache::beginRebuild(const glm::mat4* lightSpaces, unsigned layerMask) {
+        //a clear of the layered attachment would wipe every layer, so one layer at a time
+        glBindFramebuffer(GL_FRAMEBUFFER, drawFramebuffer);
+        for (GLsizei l = 0; l < layers; l++) {
+            if ((layerMask & (1u << l)) == 0)
+                continue;
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, l);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            cachedLightSpaces[l] = lightSpaces[l];
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        rebuildCount++;
+    }
+
+    void ShadowCache::endRebuild() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        valid = true;
+    }
+
+    void ShadowCache::restore(GLuint targetTexture, unsigned layerMask) const {
+        for (GLsizei l = 0; l < layers; l++) {
+            if ((layerMask & (1u << l)) == 0)
+                continue;
+
+            if (GLEW_ARB_copy_image) {
+                glCopyImageSubData(depthTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, l,
+                    targetTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, size, size, 1);
+                continue;
+            }
+
+            //a depth blit between identical formats is a straight copy, one layer at a time
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, l);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targetTexture, 0, l);
+            glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+}
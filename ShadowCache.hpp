@@ -0,0 +1,62 @@
+#ifndef ShadowCache_hpp
+#define ShadowCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    //depth of the static casters of a layered shadow map (one layer per light), kept in its
+    //own texture array
+    //a frame copies it into the live map and draws only the moving casters on top; a static
+    //layer is redrawn when its light matrix changes (cascades following the camera), and all of
+    //them when invalidate() is called (a static caster moved)
+    class ShadowCache {
+
+    public:
+        //size x size x layers depth array in GL_DEPTH_COMPONENT24, the format of the live map;
+        //needs a current GL context
+        void init(GLsizei size, GLsizei layers);
+        void destroy();
+
+        void invalidate() { valid = false; }
+        //mask of the layers whose static depth is out of date; lightSpaces: one matrix per layer
+        unsigned staleLayers(const glm::mat4* lightSpaces) const;
+
+        //clears the layers in layerMask and binds the layered framebuffer of the cache; draw the
+        //static casters into those layers, then endRebuild()
+        void beginRebuild(const glm::mat4* lightSpaces, unsigned layerMask);
+        void endRebuild();
+
+        //copies the layers set in layerMask into the same layers of targetTexture
+        void restore(GLuint targetTexture, unsigned layerMask) const;
+
+        //static layer redraws since the last resetStats()
+        unsigned getRebuildCount() const { return rebuildCount; }
+        void resetStats() { rebuildCount = 0; }
+
+    private:
+        GLsizei size = 0;
+        GLsizei layers = 0;
+        GLuint depthTexture = 0;
+        GLuint framebuffer = 0;
+        //single layer attachments for per-layer clears and the blit fallback (no ARB_copy_image)
+        GLuint readFramebuffer = 0;
+        GLuint drawFramebuffer = 0;
+
+        std::vector<glm::mat4> cachedLightSpaces;
+        bool valid = false;
+        unsigned rebuildCount = 0;
+    };
+}
+
+#endif /* ShadowCache_hpp */
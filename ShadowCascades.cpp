@@ -0,0 +1,103 @@
+#include "ShadowCascades.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        glm::mat4 lightView(const glm::vec3& direction) {
+            glm::vec3 d = glm::normalize(direction);
+            glm::vec3 up = std::abs(d.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+            return glm::lookAt(-d, glm::vec3(0.0f), up);
+        }
+
+        //box of the 8 corners of b in the space of M
+        AABB boundsIn(const glm::mat4& M, const AABB& b) {
+            AABB r;
+            for (int i = 0; i < 8; i++) {
+                glm::vec3 p((i & 1) ? b.maxCorner.x : b.minCorner.x,
+                    (i & 2) ? b.maxCorner.y : b.minCorner.y,
+                    (i & 4) ? b.maxCorner.z : b.minCorner.z);
+                r.expand(glm::vec3(M * glm::vec4(p, 1.0f)));
+            }
+            return r;
+        }
+
+        //looking down -z: the ortho near/far planes are the negated z range
+        glm::mat4 orthoFor(const AABB& box) {
+            return glm::ortho(box.minCorner.x, box.maxCorner.x, box.minCorner.y, box.maxCorner.y,
+                -box.maxCorner.z, -box.minCorner.z);
+        }
+    }
+
+    void practicalSplits(float nearPlane, float farPlane, int count, float lambda, float* splitFar) {
+        for (int i = 1; i <= count; i++) {
+            float t = (float)i / (float)count;
+            float logSplit = nearPlane * std::pow(farPlane / nearPlane, t);
+            float uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+            splitFar[i - 1] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+        }
+        splitFar[count - 1] = farPlane;
+    }
+
+    glm::mat4 fitCascade(const glm::vec3& direction, const glm::mat4& invViewProjection,
+        float cameraNear, float cameraFar, float sliceNear, float sliceFar,
+        const AABB& sceneBounds, int mapSize) {
+
+        //frustum edges from the near to the far corners; view depth is linear along each edge
+        glm::vec3 nearCorners[4], farCorners[4];
+        for (int i = 0; i < 4; i++) {
+            glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+            glm::vec4 n = invViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+            glm::vec4 f = invViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+            nearCorners[i] = glm::vec3(n) / n.w;
+            farCorners[i] = glm::vec3(f) / f.w;
+        }
+
+        float t0 = (sliceNear - cameraNear) / (cameraFar - cameraNear);
+        float t1 = (sliceFar - cameraNear) / (cameraFar - cameraNear);
+
+        glm::vec3 slice[8];
+        for (int i = 0; i < 4; i++) {
+            glm::vec3 edge = farCorners[i] - nearCorners[i];
+            slice[i] = nearCorners[i] + edge * t0;
+            slice[i + 4] = nearCorners[i] + edge * t1;
+        }
+
+        glm::mat4 V = lightView(direction);
+        AABB box;
+        for (int i = 0; i < 8; i++)
+            box.expand(glm::vec3(V * glm::vec4(slice[i], 1.0f)));
+
+        //the longest diagonal of the slice bounds it under any rotation
+        float diagonal = std::max(glm::length(slice[0] - slice[7]), glm::length(slice[4] - slice[7]));
+        float texel = diagonal / (float)mapSize;
+
+        AABB scene = boundsIn(V, sceneBounds);
+
+        for (int axis = 0; axis < 2; axis++) {
+            if (scene.maxCorner[axis] - scene.minCorner[axis] <= diagonal) {
+                box.minCorner[axis] = scene.minCorner[axis];
+                box.maxCorner[axis] = scene.maxCorner[axis];
+                continue;
+            }
+            float center = (box.minCorner[axis] + box.maxCorner[axis]) * 0.5f;
+            float lo = std::floor((center - diagonal * 0.5f) / texel) * texel;
+            box.minCorner[axis] = lo;
+            box.maxCorner[axis] = lo + diagonal;
+        }
+
+        //z stays on the slice (all the depth precision goes to the receivers); casters nearer
+        //the light are found by extrudeTowardLight() and drawn with depth clamping
+        return orthoFor(box) * V;
+    }
+
+    glm::mat4 fitSceneBounds(const glm::vec3& direction, const AABB& sceneBounds) {
+        glm::mat4 V = lightView(direction);
+        return orthoFor(boundsIn(V, sceneBounds)) * V;
+    }
+}
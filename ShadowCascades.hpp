@@ -0,0 +1,31 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+
+namespace gps {
+
+    //light space matrices for cascaded shadow maps of a directional light
+    //the light looks along -direction (its eye sits at -direction, as in the single map setup)
+    //and keeps a fixed orientation and origin, so texel snapping happens on a fixed grid
+
+    //far distance of every cascade, practical split scheme: lambda = 1 is fully logarithmic,
+    //0 fully uniform; splitFar[count - 1] == farPlane
+    void practicalSplits(float nearPlane, float farPlane, int count, float lambda, float* splitFar);
+
+    //orthographic light matrix covering the view frustum slice [sliceNear, sliceFar] of a camera
+    //(invViewProjection, camera near/far planes) with a mapSize x mapSize map
+    //x/y: the slice, padded to its diagonal so the size doesn't change as the camera turns, and
+    //moved in whole texels; an axis where the scene is smaller than that uses the scene instead
+    //z: the slice only; casters between it and the light must be drawn with GL_DEPTH_CLAMP
+    glm::mat4 fitCascade(const glm::vec3& direction, const glm::mat4& invViewProjection,
+        float cameraNear, float cameraFar, float sliceNear, float sliceFar,
+        const AABB& sceneBounds, int mapSize);
+
+    //orthographic light matrix tightly enclosing the scene bounds
+    glm::mat4 fitSceneBounds(const glm::vec3& direction, const AABB& sceneBounds);
+}
+
+#endif /* ShadowCascades_hpp */
@@ -0,0 +1,50 @@
+#include "ShadowCasters.hpp"
+
+namespace gps {
+
+    Frustum extrudeTowardLight(const glm::mat4& lightSpace) {
+        Frustum f = Frustum::fromMatrix(lightSpace);
+        //0x + 0y + 0z + 1 >= 0 holds everywhere
+        f.planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return f;
+    }
+
+    void ShadowCasterLists::init(const std::vector<EntityId>& casters, size_t entityCount, int lightCount) {
+        this->casters = casters;
+
+        member.assign(entityCount, 0);
+        for (EntityId id : casters)
+            member[id] = 1;
+
+        lights.assign(lightCount, LightList());
+        rebuildCount = 0;
+    }
+
+    void ShadowCasterLists::invalidateMoved(const Scene& scene) {
+        for (EntityId id : scene.getLastUpdated()) {
+            if (id < member.size() && member[id]) {
+                for (LightList& l : lights)
+                    l.valid = false;
+                return;
+            }
+        }
+    }
+
+    const std::vector<EntityId>& ShadowCasterLists::update(int light, const glm::mat4& lightSpace, const CullingBounds& bounds) {
+        LightList& l = lights[light];
+        if (l.valid && l.lightSpace == lightSpace)
+            return l.casters;
+
+        bounds.testFrustum(extrudeTowardLight(lightSpace), visible);
+
+        l.casters.clear();
+        for (EntityId id : casters) {
+            if (visible[id])
+                l.casters.push_back(id);
+        }
+        l.lightSpace = lightSpace;
+        l.valid = true;
+        rebuildCount++;
+        return l.casters;
+    }
+}
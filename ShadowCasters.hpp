@@ -0,0 +1,57 @@
+#ifndef ShadowCasters_hpp
+#define ShadowCasters_hpp
+
+#include <glm/glm.hpp>
+
+#include "Culling.hpp"
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    //the volume of a light matrix with its near plane dropped, so it reaches back to the light:
+    //a caster outside the map's depth range but between it and the light still counts (drawn
+    //with depth clamping it lands on the near plane)
+    Frustum extrudeTowardLight(const glm::mat4& lightSpace);
+
+    //per-light caster lists over one set of shadow casters
+    //a light's list holds the casters whose bounds touch its extruded volume; it's kept until
+    //the light matrix changes or a caster of the set moves, so a static light over static
+    //casters is culled once
+    class ShadowCasterLists {
+
+    public:
+        //casters: the set, entity ids below entityCount; lightCount lists, all stale
+        void init(const std::vector<EntityId>& casters, size_t entityCount, int lightCount);
+
+        //drops every list if a caster of the set moved in the last Scene::updateTransforms()
+        void invalidateMoved(const Scene& scene);
+
+        //the casters of the set that light sees through lightSpace; culled again only when stale
+        const std::vector<EntityId>& update(int light, const glm::mat4& lightSpace, const CullingBounds& bounds);
+
+        const std::vector<EntityId>& getCasters() const { return casters; }
+
+        //lists culled again since the last resetStats()
+        unsigned getRebuildCount() const { return rebuildCount; }
+        void resetStats() { rebuildCount = 0; }
+
+    private:
+        struct LightList {
+            std::vector<EntityId> casters;
+            glm::mat4 lightSpace = glm::mat4(1.0f);
+            bool valid = false;
+        };
+
+        std::vector<EntityId> casters;
+        std::vector<uint8_t> member;        // per entity, 1 if in the set
+        std::vector<LightList> lights;
+        std::vector<uint8_t> visible;       // scratch for CullingBounds::testFrustum
+
+        unsigned rebuildCount = 0;
+    };
+}
+
+#endif /* ShadowCasters_hpp */
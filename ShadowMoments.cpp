@@ -0,0 +1,121 @@
+#include "ShadowMoments.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+    void ShadowMoments::init(GLsizei size, GLsizei layers) {
+        this->size = size;
+        this->layers = layers;
+
+        momentsShader.loadShader("shaders/fullscreen.vert", "shaders/evsm_moments.frag");
+        blurShader.loadShader("shaders/fullscreen.vert", "shaders/evsm_blur.frag");
+
+        //full chain allocated up front (no immutable storage on 4.1)
+        glGenTextures(1, &momentsTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, momentsTexture);
+        GLint level = 0;
+        for (GLsizei s = size; s > 0; s >>= 1, level++)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA32F, s, s, layers, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        //outside the map: the moments of depth 1, nothing in front of it
+        float pos = std::exp(POSITIVE_EXPONENT), neg = -std::exp(-NEGATIVE_EXPONENT);
+        float border[] = { pos, pos * pos, neg, neg * neg };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        if (GLEW_EXT_texture_filter_anisotropic) {
+            float maxAnisotropy = 1.0f;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+            glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenTextures(1, &blurTexture);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenSamplers(1, &depthSampler);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &framebuffer);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void ShadowMoments::destroy() {
+        if (momentsShader.shaderProgram != 0)
+            glDeleteProgram(momentsShader.shaderProgram);
+        if (blurShader.shaderProgram != 0)
+            glDeleteProgram(blurShader.shaderProgram);
+        glDeleteTextures(1, &momentsTexture);
+        glDeleteTextures(1, &blurTexture);
+        glDeleteSamplers(1, &depthSampler);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteVertexArrays(1, &emptyVAO);
+
+        momentsShader.shaderProgram = blurShader.shaderProgram = 0;
+        momentsTexture = blurTexture = depthSampler = framebuffer = emptyVAO = 0;
+    }
+
+    void ShadowMoments::update(GLuint depthArray, unsigned layerMask) {
+        if (layerMask == 0)
+            return;
+
+        glViewport(0, 0, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glBindVertexArray(emptyVAO);
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+
+        //both passes sample from unit 0
+        glActiveTexture(GL_TEXTURE0);
+
+        for (GLsizei l = 0; l < layers; l++) {
+            if ((layerMask & (1u << l)) == 0)
+                continue;
+
+            //depth -> moments, blurred along x, into the scratch texture
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, blurTexture, 0);
+            momentsShader.useShaderProgram();
+            glUniform1i(glGetUniformLocation(momentsShader.shaderProgram, "depthMaps"), 0);
+            glUniform1i(glGetUniformLocation(momentsShader.shaderProgram, "layer"), l);
+            glUniform1i(glGetUniformLocation(momentsShader.shaderProgram, "blurRadius"), blurRadius);
+            glUniform2f(glGetUniformLocation(momentsShader.shaderProgram, "exponents"),
+                POSITIVE_EXPONENT, NEGATIVE_EXPONENT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+            glBindSampler(0, depthSampler);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindSampler(0, 0);
+
+            //blurred along y into the layer
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsTexture, 0, l);
+            blurShader.useShaderProgram();
+            glUniform1i(glGetUniformLocation(blurShader.shaderProgram, "source"), 0);
+            glUniform1i(glGetUniformLocation(blurShader.shaderProgram, "blurRadius"), blurRadius);
+            glBindTexture(GL_TEXTURE_2D, blurTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+
+        //rebuilds every layer's chain; the blur already did the expensive part
+        glBindTexture(GL_TEXTURE_2D_ARRAY, momentsTexture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
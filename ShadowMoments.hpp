@@ -0,0 +1,57 @@
+#ifndef ShadowMoments_hpp
+#define ShadowMoments_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    //exponential variance shadow maps (EVSM) built from a layered depth map
+    //every updated layer is turned into four warped moments (exp(c+ d), its square, -exp(-c- d),
+    //its square) and blurred with a separable gaussian once per update; the result is a
+    //mipmapped RGBA32F array, so a soft shadow is one trilinear / anisotropic fetch and a
+    //Chebyshev bound in the fragment shader whatever the blur size
+    class ShadowMoments {
+
+    public:
+        //positive / negative warp exponents; 32 bit floats hold exp(40)^2
+        static constexpr float POSITIVE_EXPONENT = 40.0f;
+        static constexpr float NEGATIVE_EXPONENT = 5.0f;
+
+        //size x size x layers moments; needs a current GL context
+        void init(GLsizei size, GLsizei layers);
+        void destroy();
+
+        //converts the layers of depthArray (size x size x layers, any compare mode) set in
+        //layerMask and blurs them with 2 * radius + 1 taps per direction, then rebuilds the mips
+        //leaves the framebuffer and viewport changed
+        void update(GLuint depthArray, unsigned layerMask);
+
+        void setBlurRadius(int radius) { blurRadius = radius; }
+        GLuint getTexture() const { return momentsTexture; }
+
+    private:
+        GLsizei size = 0;
+        GLsizei layers = 0;
+        int blurRadius = 2;
+
+        Shader momentsShader;       // depth layer -> moments, horizontal blur
+        Shader blurShader;          // vertical blur
+        GLuint momentsTexture = 0;  // RGBA32F array, mipmapped
+        GLuint blurTexture = 0;     // RGBA32F, the horizontal pass of one layer
+        GLuint framebuffer = 0;
+        GLuint depthSampler = 0;    // raw depth reads, compare mode off
+        GLuint emptyVAO = 0;        // full screen triangle from gl_VertexID
+    };
+}
+
+#endif /* ShadowMoments_hpp */
@@ -0,0 +1,53 @@
+#include "SimdUtils.hpp"
+
+#if defined(GPS_SIMD_X86) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace gps {
+namespace simd {
+
+    static bool detectAVX2() {
+#if defined(GPS_SIMD_X86)
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        if (!osxsave || !fma)
+            return false;
+
+        //the OS must save the YMM registers on context switch
+        unsigned long long xcr0 = _xgetbv(0);
+        if ((xcr0 & 0x6) != 0x6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    #endif
+#else
+        return false;
+#endif
+    }
+
+    bool hasAVX2() {
+        static const bool supported = detectAVX2();
+        return supported;
+    }
+
+    const char* bestKernelName() {
+#if defined(GPS_SIMD_X86)
+        return hasAVX2() ? "AVX2" : "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+}
+}
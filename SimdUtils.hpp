@@ -0,0 +1,96 @@
+#ifndef SimdUtils_hpp
+#define SimdUtils_hpp
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define GPS_SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        //MSVC accepts AVX2 intrinsics in any function
+        #define GPS_TARGET_AVX2
+    #else
+        #define GPS_TARGET_AVX2 __attribute__((target("avx2,fma")))
+    #endif
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace gps {
+namespace simd {
+
+    //true when the CPU and the OS both support AVX2 + FMA (checked once)
+    bool hasAVX2();
+
+    //name of the widest kernel family the dispatchers will pick ("AVX2", "SSE2" or "scalar")
+    const char* bestKernelName();
+
+    //allocator keeping SoA streams 32-byte aligned for the AVX2 kernels
+    template <typename T>
+    struct AlignedAllocator {
+        typedef T value_type;
+
+        AlignedAllocator() = default;
+        template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            void* p = nullptr;
+#if defined(_MSC_VER)
+            p = _aligned_malloc(n * sizeof(T), 32);
+#else
+            if (posix_memalign(&p, 32, n * sizeof(T)) != 0)
+                p = nullptr;
+#endif
+            if (!p)
+                throw std::bad_alloc();
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, size_t) {
+#if defined(_MSC_VER)
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+
+        template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+        template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+    };
+
+    typedef std::vector<float, AlignedAllocator<float>> FloatArray;
+
+    //parabolic sine approximation (max error ~0.001), matches the SIMD kernels lane for lane
+    inline float fastSin(float x) {
+        const float INV_TWO_PI = 0.15915494f;
+        const float TWO_PI = 6.28318531f;
+        const float B = 1.27323954f;   // 4/pi
+        const float C = -0.40528473f;  // -4/pi^2
+        const float P = 0.225f;
+
+        x -= TWO_PI * std::floor(x * INV_TWO_PI + 0.5f);
+        float y = B * x + C * x * std::fabs(x);
+        return P * (y * std::fabs(y) - y) + y;
+    }
+
+    //cheap stateless integer hash, used as a per-particle random stream
+    inline uint32_t hash32(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    //uniform float in [0, 1) from a hash value
+    inline float unitFloat(uint32_t h) {
+        return (h >> 8) * (1.0f / 16777216.0f);
+    }
+}
+}
+
+#endif /* SimdUtils_hpp */
@@ -0,0 +1,115 @@
+#include "StreamBuffer.hpp"
+
+#include <chrono>
+#include <cstring>
+
+namespace gps {
+
+    void StreamBuffer::init(GLsizeiptr bytesPerFrame) {
+        frameSize = bytesPerFrame;
+        GLsizeiptr total = frameSize * FRAME_COUNT;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+        if (GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, total, nullptr, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+        }
+        else {
+            glBufferData(GL_COPY_WRITE_BUFFER, total, nullptr, GL_STREAM_DRAW);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        frame = FRAME_COUNT - 1;
+        head = 0;
+    }
+
+    void StreamBuffer::destroy() {
+        for (GLsync& f : fences) {
+            if (f)
+                glDeleteSync(f);
+            f = 0;
+        }
+
+        if (mapped) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            mapped = nullptr;
+        }
+
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    void StreamBuffer::beginFrame() {
+        frame = (frame + 1) % FRAME_COUNT;
+        head = 0;
+        lastWaitMs = 0.0;
+        frameCount++;
+
+        GLsync fence = fences[frame];
+        if (!fence)
+            return;
+
+        //cheap poll first; only a real stall gets timed
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            auto start = std::chrono::high_resolution_clock::now();
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            lastWaitMs = std::chrono::duration<double, std::milli>(end - start).count();
+            totalWaitMs += lastWaitMs;
+            waitCount++;
+        }
+
+        glDeleteSync(fence);
+        fences[frame] = 0;
+    }
+
+    void StreamBuffer::endFrame() {
+        if (fences[frame])
+            glDeleteSync(fences[frame]);
+        fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    GLintptr StreamBuffer::upload(const void* data, GLsizeiptr bytes, GLsizeiptr alignment) {
+        GLsizeiptr start = (head + alignment - 1) / alignment * alignment;
+        if (start + bytes > frameSize) {
+            overflowCount++;
+            return -1;
+        }
+
+        GLintptr offset = frame * frameSize + start;
+        head = start + bytes;
+
+        if (mapped) {
+            std::memcpy(mapped + offset, data, bytes);
+            return offset;
+        }
+
+        //this range is fenced off from the gpu, so the driver needn't synchronize
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        void* dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            std::memcpy(dst, data, bytes);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return offset;
+    }
+
+    void StreamBuffer::resetStats() {
+        totalWaitMs = 0.0;
+        waitCount = 0;
+        frameCount = 0;
+        overflowCount = 0;
+    }
+}
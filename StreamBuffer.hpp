@@ -0,0 +1,66 @@
+#ifndef StreamBuffer_hpp
+#define StreamBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    //ring of per-frame regions in one buffer object for data rewritten every frame
+    //(draw records, indirect commands, particle positions)
+    //the cpu fills region N+1 while the gpu still reads region N; a fence per region tells
+    //when a region may be reused, so uploads never hit the driver's implicit synchronization
+    //with ARB_buffer_storage the buffer is mapped once, persistently and coherently;
+    //without it every upload maps its range unsynchronized (the fences keep that safe)
+    class StreamBuffer {
+
+    public:
+        static const int FRAME_COUNT = 3;
+
+        //needs a current GL context
+        void init(GLsizeiptr bytesPerFrame);
+        void destroy();
+
+        //moves to the next region, waiting for the gpu if it is still reading it
+        void beginFrame();
+        //fences the region written since beginFrame()
+        void endFrame();
+
+        //copies data into the current region; returns its offset in the buffer,
+        //or -1 when the region is full
+        GLintptr upload(const void* data, GLsizeiptr bytes, GLsizeiptr alignment = 16);
+
+        GLuint getBuffer() const { return buffer; }
+        bool isPersistent() const { return mapped != nullptr; }
+
+        //time the cpu spent blocked in beginFrame() because it got FRAME_COUNT frames ahead
+        double getLastWaitMs() const { return lastWaitMs; }
+        double getTotalWaitMs() const { return totalWaitMs; }
+        unsigned getWaitCount() const { return waitCount; }
+        unsigned getFrameCount() const { return frameCount; }
+        unsigned getOverflowCount() const { return overflowCount; }
+        void resetStats();
+
+    private:
+        GLuint buffer = 0;
+        GLsizeiptr frameSize = 0;
+        unsigned char* mapped = nullptr;
+        GLsync fences[FRAME_COUNT] = { 0, 0, 0 };
+
+        int frame = 0;
+        GLsizeiptr head = 0;
+
+        double lastWaitMs = 0.0;
+        double totalWaitMs = 0.0;
+        unsigned waitCount = 0;
+        unsigned frameCount = 0;
+        unsigned overflowCount = 0;
+    };
+}
+
+#endif /* StreamBuffer_hpp */
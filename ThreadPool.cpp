@@ -0,0 +1,114 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    ThreadPool::ThreadPool(unsigned threadCount) {
+        if (threadCount == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            threadCount = hw > 1 ? hw - 1 : 0;
+        }
+
+        for (unsigned i = 0; i < threadCount; i++)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& t : workers)
+            t.join();
+    }
+
+    unsigned ThreadPool::getConcurrency() const {
+        return (unsigned)workers.size() + 1;
+    }
+
+    void ThreadPool::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn) {
+        if (count == 0)
+            return;
+
+        chunkSize = std::max<size_t>(chunkSize, 1);
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+        //not worth waking anybody
+        if (workers.empty() || chunkCount == 1) {
+            fn(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> submit(submitMutex);
+
+        Job current;
+        current.fn = &fn;
+        current.count = count;
+        current.chunkSize = chunkSize;
+        current.chunkCount = chunkCount;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            //a late worker may still be draining the previous job
+            done.wait(lock, [&] { return activeWorkers == 0; });
+
+            job = current;
+            nextChunk = 0;
+            doneChunks = 0;
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks(current);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return doneChunks.load() == chunkCount && activeWorkers == 0; });
+        job = Job();
+    }
+
+    void ThreadPool::workerLoop() {
+        uint64_t seen = 0;
+
+        for (;;) {
+            Job current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+
+                seen = generation;
+                current = job;
+                activeWorkers++;
+            }
+
+            runChunks(current);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                activeWorkers--;
+            }
+            done.notify_all();
+        }
+    }
+
+    void ThreadPool::runChunks(const Job& current) {
+        for (;;) {
+            size_t c = nextChunk.fetch_add(1);
+            if (c >= current.chunkCount)
+                break;
+
+            size_t begin = c * current.chunkSize;
+            size_t end = std::min(begin + current.chunkSize, current.count);
+            (*current.fn)(begin, end);
+
+            if (doneChunks.fetch_add(1) + 1 == current.chunkCount) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    class ThreadPool {
+
+    public:
+        //threadCount - number of worker threads; 0 uses one less than the hardware threads
+        //(the calling thread always takes part in parallelFor)
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        //splits [0, count) into chunks of chunkSize and runs fn(begin, end) on every chunk,
+        //returns once all chunks are done
+        void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn);
+
+        //workers plus the calling thread
+        unsigned getConcurrency() const;
+
+    private:
+        struct Job {
+            const std::function<void(size_t, size_t)>* fn = nullptr;
+            size_t count = 0;
+            size_t chunkSize = 1;
+            size_t chunkCount = 0;
+        };
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::mutex submitMutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        Job job;
+        uint64_t generation = 0;
+        unsigned activeWorkers = 0;
+        bool stopping = false;
+        std::atomic<size_t> nextChunk{ 0 };
+        std::atomic<size_t> doneChunks{ 0 };
+
+        void workerLoop();
+        void runChunks(const Job& current);
+    };
+}
+
+#endif /* ThreadPool_hpp */
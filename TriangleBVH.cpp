@@ -0,0 +1,774 @@
+#include "TriangleBVH.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+    //ranges at least this large bin and measure on the pool during the serial top of a build
+    static const uint32_t PARALLEL_RANGE_MIN = 1u << 16;
+
+    //cost of one box test relative to one triangle test in the surface area heuristic
+    static const float TRAVERSAL_COST = 1.0f;
+
+    static float surfaceArea(const AABB& b) {
+        if (!b.isValid())
+            return 0.0f;
+        glm::vec3 d = b.maxCorner - b.minCorner;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    //fn(begin, end) over about four chunks per thread of [begin, end), serially without a pool
+    template <typename Fn>
+    static void forChunks(ThreadPool* pool, uint32_t begin, uint32_t end, size_t chunks, const Fn& fn) {
+        if (!pool || chunks <= 1) {
+            fn(0, begin, end);
+            return;
+        }
+        uint32_t count = end - begin;
+        pool->parallelFor(chunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++)
+                fn(c, begin + (uint32_t)(count * c / chunks), begin + (uint32_t)(count * (c + 1) / chunks));
+        });
+    }
+
+    void TriangleBVH::build(const std::vector<glm::vec3>& vertices, ThreadPool* pool, int width) {
+        uint32_t count = (uint32_t)(vertices.size() / 3);
+        this->width = width >= 8 ? 8 : (width >= 4 ? 4 : 2);
+#if defined(GPS_SIMD_X86)
+        if (this->width == 8 && !simd::hasAVX2())
+            this->width = 4;
+#endif
+
+        nodes.clear();
+        wideNodes.clear();
+        wideSources.clear();
+        bounds = AABB();
+        order.resize(count);
+        slots.resize(count);
+        this->vertices.resize((size_t)count * 3);
+        if (count == 0)
+            return;
+
+        triangleBounds.resize(count);
+        centroids.resize(count);
+        size_t chunks = pool ? (size_t)pool->getConcurrency() * 4 : 1;
+        forChunks(pool, 0, count, count >= PARALLEL_RANGE_MIN ? chunks : 1, [&](size_t, uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; i++) {
+                AABB b;
+                for (int k = 0; k < 3; k++)
+                    b.expand(vertices[3 * i + k]);
+                triangleBounds[i] = b;
+                centroids[i] = b.center();
+                order[i] = i;
+            }
+        });
+
+        //the top of the tree is split here, binning on the pool, down to ranges small enough
+        //that there are a few per thread; those subtrees are then built independently
+        std::vector<BuildTask> deferred;
+        subtreeSize = pool ? std::max(count / (uint32_t)(pool->getConcurrency() * 8), 1024u) : 0;
+
+        nodes.reserve((size_t)count / 2 + 1);
+        nodes.push_back(Node());
+        split(nodes, 0, 0, count, 0, pool ? &deferred : nullptr, pool);
+
+        if (!deferred.empty()) {
+            std::vector<std::vector<Node>> subtrees(deferred.size());
+            pool->parallelFor(deferred.size(), 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    const BuildTask& task = deferred[i];
+                    subtrees[i].reserve((task.end - task.begin) / 2 + 1);
+                    subtrees[i].push_back(Node());
+                    split(subtrees[i], 0, task.begin, task.end, task.depth, nullptr, nullptr);
+                }
+            });
+
+            //a subtree's root replaces its placeholder, the rest is appended; child indices are
+            //local to the subtree (root 0), so inner nodes are moved by the append offset
+            for (size_t i = 0; i < deferred.size(); i++) {
+                const std::vector<Node>& sub = subtrees[i];
+                uint32_t base = (uint32_t)nodes.size();
+                auto place = [base](Node n) {
+                    if (n.count == 0)
+                        n.first = base + n.first - 1;
+                    return n;
+                };
+                nodes[deferred[i].node] = place(sub[0]);
+                for (size_t j = 1; j < sub.size(); j++)
+                    nodes.push_back(place(sub[j]));
+            }
+        }
+
+        //triangles in leaf order, so a leaf reads one contiguous run
+        for (uint32_t i = 0; i < count; i++) {
+            slots[order[i]] = i;
+            for (int k = 0; k < 3; k++)
+                this->vertices[3 * i + k] = vertices[3 * order[i] + k];
+        }
+        bounds = AABB(nodes[0].minCorner, nodes[0].maxCorner);
+
+        triangleBounds = std::vector<AABB>();
+        centroids = std::vector<glm::vec3>();
+        collapse();
+    }
+
+    void TriangleBVH::measure(uint32_t begin, uint32_t end, ThreadPool* pool, AABB& nodeBounds, AABB& centroidBounds) const {
+        size_t chunks = pool && end - begin >= PARALLEL_RANGE_MIN ? (size_t)pool->getConcurrency() * 4 : 1;
+        std::vector<AABB> partial(chunks * 2);
+        forChunks(pool, begin, end, chunks, [&](size_t c, uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; i++) {
+                partial[2 * c].expand(triangleBounds[order[i]]);
+                partial[2 * c + 1].expand(centroids[order[i]]);
+            }
+        });
+
+        nodeBounds = centroidBounds = AABB();
+        for (size_t c = 0; c < chunks; c++) {
+            nodeBounds.expand(partial[2 * c]);
+            centroidBounds.expand(partial[2 * c + 1]);
+        }
+    }
+
+    //binned SAH over the three axes: returns the cheapest split as an axis and the first bin
+    //of the right side, or false if keeping the range as one leaf is cheaper
+    bool TriangleBVH::findSplit(uint32_t begin, uint32_t end, const AABB& nodeBounds, const AABB& centroidBounds,
+        ThreadPool* pool, int& axis, int& bin) const {
+
+        struct Bin {
+            AABB bounds;
+            uint32_t count = 0;
+        };
+
+        glm::vec3 extent = centroidBounds.maxCorner - centroidBounds.minCorner;
+        glm::vec3 scale;
+        for (int a = 0; a < 3; a++)
+            scale[a] = extent[a] > 0.0f ? BIN_COUNT / extent[a] : 0.0f;
+
+        size_t chunks = pool && end - begin >= PARALLEL_RANGE_MIN ? (size_t)pool->getConcurrency() * 4 : 1;
+        std::vector<Bin> partial(chunks * 3 * BIN_COUNT);
+        forChunks(pool, begin, end, chunks, [&](size_t c, uint32_t first, uint32_t last) {
+            Bin* bins = &partial[c * 3 * BIN_COUNT];
+            for (uint32_t i = first; i < last; i++) {
+                uint32_t tri = order[i];
+                for (int a = 0; a < 3; a++) {
+                    int b = std::min((int)((centroids[tri][a] - centroidBounds.minCorner[a]) * scale[a]), BIN_COUNT - 1);
+                    bins[a * BIN_COUNT + b].bounds.expand(triangleBounds[tri]);
+                    bins[a * BIN_COUNT + b].count++;
+                }
+            }
+        });
+
+        Bin bins[3 * BIN_COUNT];
+        for (size_t c = 0; c < chunks; c++) {
+            for (int b = 0; b < 3 * BIN_COUNT; b++) {
+                bins[b].bounds.expand(partial[c * 3 * BIN_COUNT + b].bounds);
+                bins[b].count += partial[c * 3 * BIN_COUNT + b].count;
+            }
+        }
+
+        float bestCost = FLT_MAX;
+        axis = -1;
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] == 0.0f)
+                continue;
+            const Bin* axisBins = &bins[a * BIN_COUNT];
+
+            //sweep from the right for the area x count of every right side, then from the left
+            float rightCost[BIN_COUNT];
+            AABB right;
+            uint32_t rightCount = 0;
+            for (int b = BIN_COUNT - 1; b > 0; b--) {
+                right.expand(axisBins[b].bounds);
+                rightCount += axisBins[b].count;
+                rightCost[b] = surfaceArea(right) * rightCount;
+            }
+
+            AABB left;
+            uint32_t leftCount = 0;
+            for (int b = 1; b < BIN_COUNT; b++) {
+                left.expand(axisBins[b - 1].bounds);
+                leftCount += axisBins[b - 1].count;
+                float cost = surfaceArea(left) * leftCount + rightCost[b];
+                if (leftCount > 0 && leftCount < end - begin && cost < bestCost) {
+                    bestCost = cost;
+                    axis = a;
+                    bin = b;
+                }
+            }
+        }
+
+        if (axis < 0)
+            return false;
+        float area = surfaceArea(nodeBounds);
+        float splitCost = TRAVERSAL_COST * area + bestCost;
+        float leafCost = area * (end - begin);
+        return end - begin > MAX_LEAF_SIZE || splitCost < leafCost;
+    }
+
+    void TriangleBVH::split(std::vector<Node>& out, uint32_t node, uint32_t begin, uint32_t end, int depth,
+        std::vector<BuildTask>* deferred, ThreadPool* pool) {
+
+        uint32_t count = end - begin;
+        if (deferred && count <= subtreeSize) {
+            deferred->push_back({ node, begin, end, depth });
+            return;
+        }
+
+        AABB nodeBounds, centroidBounds;
+        measure(begin, end, pool, nodeBounds, centroidBounds);
+        out[node].minCorner = nodeBounds.minCorner;
+        out[node].maxCorner = nodeBounds.maxCorner;
+        out[node].first = begin;
+        out[node].count = count;
+
+        if (count <= 1 || depth >= MAX_DEPTH)
+            return;
+
+        int axis = -1, bin = 0;
+        uint32_t mid = begin;
+        if (findSplit(begin, end, nodeBounds, centroidBounds, pool, axis, bin)) {
+            float minCorner = centroidBounds.minCorner[axis];
+            float scale = BIN_COUNT / (centroidBounds.maxCorner[axis] - minCorner);
+            mid = (uint32_t)(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t tri) {
+                return std::min((int)((centroids[tri][axis] - minCorner) * scale), BIN_COUNT - 1) < bin;
+            }) - order.begin());
+        }
+        else if (axis >= 0 || count <= MAX_LEAF_SIZE) {
+            return;     // a leaf is cheaper
+        }
+
+        //no split separates the centroids (all in one bin or one point): halve the range so
+        //leaves stay small
+        if (mid == begin || mid == end) {
+            mid = begin + count / 2;
+            glm::vec3 size = centroidBounds.maxCorner - centroidBounds.minCorner;
+            int longest = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                [&](uint32_t a, uint32_t b) { return centroids[a][longest] < centroids[b][longest]; });
+        }
+
+        uint32_t left = (uint32_t)out.size();
+        out.push_back(Node());
+        out.push_back(Node());
+        out[node].first = left;
+        out[node].count = 0;
+
+        split(out, left, begin, mid, depth + 1, deferred, pool);
+        split(out, left + 1, mid, end, depth + 1, deferred, pool);
+    }
+
+    //every wide node takes the children of one binary node and keeps opening its largest inner
+    //lane into that node's two children until the lanes are full
+    void TriangleBVH::collapse() {
+        wideNodes.clear();
+        wideSources.clear();
+        if (width == 2 || nodes.empty())
+            return;
+
+        std::vector<std::pair<uint32_t, uint32_t>> pending = { { 0u, 0u } };     // wide node, binary node
+        wideNodes.push_back(WideNode());
+        wideSources.resize(8);
+
+        while (!pending.empty()) {
+            uint32_t wide = pending.back().first;
+            uint32_t binary = pending.back().second;
+            pending.pop_back();
+
+            uint32_t lanes[8];
+            int laneCount = 0;
+            if (nodes[binary].count > 0) {
+                lanes[laneCount++] = binary;
+            }
+            else {
+                lanes[laneCount++] = nodes[binary].first;
+                lanes[laneCount++] = nodes[binary].first + 1;
+                while (laneCount < width) {
+                    int open = -1;
+                    float openArea = -1.0f;
+                    for (int k = 0; k < laneCount; k++) {
+                        const Node& n = nodes[lanes[k]];
+                        float area = surfaceArea(AABB(n.minCorner, n.maxCorner));
+                        if (n.count == 0 && area > openArea) {
+                            open = k;
+                            openArea = area;
+                        }
+                    }
+                    if (open < 0)
+                        break;
+                    uint32_t first = nodes[lanes[open]].first;
+                    lanes[open] = first;
+                    lanes[laneCount++] = first + 1;
+                }
+            }
+
+            for (int k = 0; k < 8; k++) {
+                WideNode& w = wideNodes[wide];
+                if (k >= laneCount) {
+                    w.minX[k] = w.minY[k] = w.minZ[k] = FLT_MAX;
+                    w.maxX[k] = w.maxY[k] = w.maxZ[k] = -FLT_MAX;
+                    w.child[k] = 0;
+                    w.count[k] = 0;
+                    wideSources[8 * wide + k] = 0xFFFFFFFFu;
+                    continue;
+                }
+
+                const Node& n = nodes[lanes[k]];
+                w.minX[k] = n.minCorner.x; w.minY[k] = n.minCorner.y; w.minZ[k] = n.minCorner.z;
+                w.maxX[k] = n.maxCorner.x; w.maxY[k] = n.maxCorner.y; w.maxZ[k] = n.maxCorner.z;
+                w.count[k] = n.count;
+                wideSources[8 * wide + k] = lanes[k];
+                if (n.count > 0) {
+                    w.child[k] = n.first;
+                }
+                else {
+                    uint32_t child = (uint32_t)wideNodes.size();
+                    w.child[k] = child;         // before the push_back, which may move w
+                    wideNodes.push_back(WideNode());
+                    wideSources.resize(wideSources.size() + 8);
+                    pending.push_back({ child, lanes[k] });
+                }
+            }
+        }
+    }
+
+    void TriangleBVH::refit(const std::vector<glm::vec3>& vertices, const glm::mat4& transform, ThreadPool* pool) {
+        uint32_t count = (uint32_t)order.size();
+        if (vertices.size() != (size_t)count * 3 || count == 0)
+            return;
+
+        size_t chunks = pool && count >= PARALLEL_RANGE_MIN ? (size_t)pool->getConcurrency() * 4 : 1;
+        forChunks(pool, 0, count, chunks, [&](size_t, uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; i++) {
+                for (int k = 0; k < 3; k++)
+                    this->vertices[3 * i + k] = glm::vec3(transform * glm::vec4(vertices[3 * order[i] + k], 1.0f));
+            }
+        });
+
+        //children always come after their parent, so one backwards sweep sees them first
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& n = nodes[i];
+            AABB b;
+            if (n.count > 0) {
+                for (uint32_t v = 3 * n.first; v < 3 * (n.first + n.count); v++)
+                    b.expand(this->vertices[v]);
+            }
+            else {
+                b.expand(AABB(nodes[n.first].minCorner, nodes[n.first].maxCorner));
+                b.expand(AABB(nodes[n.first + 1].minCorner, nodes[n.first + 1].maxCorner));
+            }
+            n.minCorner = b.minCorner;
+            n.maxCorner = b.maxCorner;
+        }
+        bounds = AABB(nodes[0].minCorner, nodes[0].maxCorner);
+        refitWide();
+    }
+
+    //the lanes copy the boxes of the binary nodes they were collapsed from
+    void TriangleBVH::refitWide() {
+        for (size_t w = 0; w < wideNodes.size(); w++) {
+            for (int k = 0; k < 8; k++) {
+                uint32_t source = wideSources[8 * w + k];
+                if (source == 0xFFFFFFFFu)
+                    continue;
+                const Node& n = nodes[source];
+                WideNode& wn = wideNodes[w];
+                wn.minX[k] = n.minCorner.x; wn.minY[k] = n.minCorner.y; wn.minZ[k] = n.minCorner.z;
+                wn.maxX[k] = n.maxCorner.x; wn.maxY[k] = n.maxCorner.y; wn.maxZ[k] = n.maxCorner.z;
+            }
+        }
+    }
+
+    glm::vec3 TriangleBVH::getNormal(uint32_t triangle) const {
+        const glm::vec3* v = &vertices[3 * slots[triangle]];
+        return glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+    }
+
+    //Moller-Trumbore, both faces
+    bool TriangleBVH::intersectTriangle(uint32_t slot, const Ray& ray, float tMax, RayHit& hit) const {
+        const glm::vec3* v = &vertices[3 * slot];
+        glm::vec3 e1 = v[1] - v[0];
+        glm::vec3 e2 = v[2] - v[0];
+        glm::vec3 p = glm::cross(ray.direction, e2);
+        float det = glm::dot(e1, p);
+        if (std::abs(det) < 1e-12f)
+            return false;
+
+        float inv = 1.0f / det;
+        glm::vec3 s = ray.origin - v[0];
+        float u = glm::dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        glm::vec3 q = glm::cross(s, e1);
+        float w = glm::dot(ray.direction, q) * inv;
+        if (w < 0.0f || u + w > 1.0f)
+            return false;
+
+        float t = glm::dot(e2, q) * inv;
+        if (t <= 0.0f || t >= tMax)
+            return false;
+
+        hit.t = t;
+        hit.triangle = order[slot];
+        hit.u = u;
+        hit.v = w;
+        return true;
+    }
+
+    //slab test with the near and far planes picked by the direction's signs, so an inverted
+    //(empty) box is never entered; entry distance in tNear
+    static bool intersectBox(const glm::vec3& minCorner, const glm::vec3& maxCorner, const glm::vec3& origin,
+        const glm::vec3& invDir, const int* negative, float tMax, float& tNear) {
+        float tFar = tMax;
+        tNear = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            float nearPlane = negative[a] ? maxCorner[a] : minCorner[a];
+            float farPlane = negative[a] ? minCorner[a] : maxCorner[a];
+            tNear = std::max(tNear, (nearPlane - origin[a]) * invDir[a]);
+            tFar = std::min(tFar, (farPlane - origin[a]) * invDir[a]);
+        }
+        return tNear <= tFar;
+    }
+
+    template <bool ANY>
+    bool TriangleBVH::traverseBinary(const Ray& ray, RayHit& hit) const {
+        glm::vec3 invDir = 1.0f / ray.direction;
+        int negative[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
+        float tMax = ray.tMax;
+        bool found = false;
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            float tNear;
+            if (!intersectBox(node.minCorner, node.maxCorner, ray.origin, invDir, negative, tMax, tNear))
+                continue;
+
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    if (intersectTriangle(i, ray, tMax, hit)) {
+                        if (ANY)
+                            return true;
+                        tMax = hit.t;
+                        found = true;
+                    }
+                }
+                continue;
+            }
+
+            //nearer child on top, so it shortens tMax before the other one is tested
+            const Node& l = nodes[node.first];
+            const Node& r = nodes[node.first + 1];
+            float tLeft, tRight;
+            bool left = intersectBox(l.minCorner, l.maxCorner, ray.origin, invDir, negative, tMax, tLeft);
+            bool right = intersectBox(r.minCorner, r.maxCorner, ray.origin, invDir, negative, tMax, tRight);
+            if (left && right) {
+                bool leftFirst = tLeft <= tRight;
+                stack[top++] = leftFirst ? node.first + 1 : node.first;
+                stack[top++] = leftFirst ? node.first : node.first + 1;
+            }
+            else if (left) {
+                stack[top++] = node.first;
+            }
+            else if (right) {
+                stack[top++] = node.first + 1;
+            }
+        }
+        return found;
+    }
+
+    int TriangleBVH::hitLanesScalar(const WideNode& node, int lanes, const RaySetup& ray, float tMax, float* tNear) {
+        const float* nearPlanes[3] = { ray.negative[0] ? node.maxX : node.minX,
+            ray.negative[1] ? node.maxY : node.minY, ray.negative[2] ? node.maxZ : node.minZ };
+        const float* farPlanes[3] = { ray.negative[0] ? node.minX : node.maxX,
+            ray.negative[1] ? node.minY : node.maxY, ray.negative[2] ? node.minZ : node.maxZ };
+
+        int mask = 0;
+        for (int k = 0; k < lanes; k++) {
+            float t0 = 0.0f, t1 = tMax;
+            for (int a = 0; a < 3; a++) {
+                t0 = std::max(t0, (nearPlanes[a][k] - ray.origin[a]) * ray.invDir[a]);
+                t1 = std::min(t1, (farPlanes[a][k] - ray.origin[a]) * ray.invDir[a]);
+            }
+            tNear[k] = t0;
+            if (t0 <= t1)
+                mask |= 1 << k;
+        }
+        return mask;
+    }
+
+#if defined(GPS_SIMD_X86)
+
+    int TriangleBVH::hitLanesSSE(const WideNode& node, const RaySetup& ray, float tMax, float* tNear) {
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(tMax);
+        const float* mins[3] = { node.minX, node.minY, node.minZ };
+        const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+        for (int a = 0; a < 3; a++) {
+            __m128 o = _mm_set1_ps(ray.origin[a]);
+            __m128 inv = _mm_set1_ps(ray.invDir[a]);
+            __m128 nearPlane = _mm_load_ps(ray.negative[a] ? maxs[a] : mins[a]);
+            __m128 farPlane = _mm_load_ps(ray.negative[a] ? mins[a] : maxs[a]);
+            t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(nearPlane, o), inv));
+            t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(farPlane, o), inv));
+        }
+        _mm_storeu_ps(tNear, t0);
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+
+    GPS_TARGET_AVX2 int TriangleBVH::hitLanesAVX2(const WideNode& node, const RaySetup& ray, float tMax, float* tNear) {
+        __m256 t0 = _mm256_setzero_ps();
+        __m256 t1 = _mm256_set1_ps(tMax);
+        const float* mins[3] = { node.minX, node.minY, node.minZ };
+        const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+        for (int a = 0; a < 3; a++) {
+            //not plane * inv - origin * inv: on an axis parallel ray inv is infinite and that is NaN
+            __m256 o = _mm256_set1_ps(ray.origin[a]);
+            __m256 inv = _mm256_set1_ps(ray.invDir[a]);
+            __m256 nearPlane = _mm256_load_ps(ray.negative[a] ? maxs[a] : mins[a]);
+            __m256 farPlane = _mm256_load_ps(ray.negative[a] ? mins[a] : maxs[a]);
+            t0 = _mm256_max_ps(t0, _mm256_mul_ps(_mm256_sub_ps(nearPlane, o), inv));
+            t1 = _mm256_min_ps(t1, _mm256_mul_ps(_mm256_sub_ps(farPlane, o), inv));
+        }
+        _mm256_storeu_ps(tNear, t0);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+
+#endif
+
+    template <bool ANY, int W>
+    bool TriangleBVH::traverseWide(const Ray& ray, RayHit& hit) const {
+        RaySetup setup;
+        setup.origin = ray.origin;
+        setup.invDir = 1.0f / ray.direction;
+        for (int a = 0; a < 3; a++)
+            setup.negative[a] = setup.invDir[a] < 0.0f;
+
+        float tMax = ray.tMax;
+        bool found = false;
+
+        struct Entry {
+            uint32_t node;
+            float tNear;
+        };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0u, 0.0f };
+
+        while (top > 0) {
+            Entry entry = stack[--top];
+            if (entry.tNear > tMax)
+                continue;       // a hit found since it was pushed is closer than its box
+            const WideNode& node = wideNodes[entry.node];
+
+            float tNear[8];
+            int mask;
+#if defined(GPS_SIMD_X86)
+            mask = W == 8 ? hitLanesAVX2(node, setup, tMax, tNear) : hitLanesSSE(node, setup, tMax, tNear);
+#else
+            mask = hitLanesScalar(node, W, setup, tMax, tNear);
+#endif
+            if (!mask)
+                continue;
+
+            //the entered lanes by distance; leaves are tested right away, nearest first, and
+            //the inner ones pushed farthest first so the nearest is popped next
+            int lanes[8];
+            int laneCount = 0;
+            for (int k = 0; k < W; k++) {
+                if (!(mask & (1 << k)))
+                    continue;
+                int j = laneCount++;
+                for (; j > 0 && tNear[lanes[j - 1]] > tNear[k]; j--)
+                    lanes[j] = lanes[j - 1];
+                lanes[j] = k;
+            }
+
+            for (int j = 0; j < laneCount; j++) {
+                int k = lanes[j];
+                if (node.count[k] == 0 || tNear[k] > tMax)
+                    continue;
+                for (uint32_t i = node.child[k]; i < node.child[k] + node.count[k]; i++) {
+                    if (intersectTriangle(i, ray, tMax, hit)) {
+                        if (ANY)
+                            return true;
+                        tMax = hit.t;
+                        found = true;
+                    }
+                }
+            }
+
+            for (int j = laneCount; j-- > 0;) {
+                int k = lanes[j];
+                if (node.count[k] == 0 && tNear[k] <= tMax)
+                    stack[top++] = { node.child[k], tNear[k] };
+            }
+        }
+        return found;
+    }
+
+    template <bool ANY>
+    bool TriangleBVH::traverse(const Ray& ray, RayHit& hit) const {
+        if (order.empty())
+            return false;
+        if (width == 8)
+            return traverseWide<ANY, 8>(ray, hit);
+        if (width == 4)
+            return traverseWide<ANY, 4>(ray, hit);
+        return traverseBinary<ANY>(ray, hit);
+    }
+
+    bool TriangleBVH::intersect(const Ray& ray, RayHit& hit) const {
+        return traverse<false>(ray, hit);
+    }
+
+    bool TriangleBVH::occluded(const Ray& ray) const {
+        RayHit hit;
+        return traverse<true>(ray, hit);
+    }
+
+    bool TriangleBVH::intersectSegment(const glm::vec3& a, const glm::vec3& b, RayHit& hit) const {
+        return traverse<false>({ a, b - a, 1.0f }, hit);
+    }
+
+    bool TriangleBVH::segmentBlocked(const glm::vec3& a, const glm::vec3& b) const {
+        RayHit hit;
+        return traverse<true>({ a, b - a, 1.0f }, hit);
+    }
+
+    void TriangleBVH::runBenchmark(const std::vector<std::vector<glm::vec3>>& meshes,
+        const std::vector<std::string>& names, ThreadPool& pool) {
+
+        typedef std::chrono::high_resolution_clock Clock;
+        auto millisSince = [](Clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+
+        const size_t RAY_COUNT = 1u << 20;
+        std::cout << "BVH benchmark: " << RAY_COUNT << " rays per test, " << simd::bestKernelName()
+            << " kernel, " << pool.getConcurrency() << " threads" << std::endl;
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const std::vector<glm::vec3>& vertices = meshes[m];
+            TriangleBVH bvh;
+
+            Clock::time_point start = Clock::now();
+            bvh.build(vertices, nullptr);
+            double serialMs = millisSince(start);
+            start = Clock::now();
+            bvh.build(vertices, &pool);
+            double pooledMs = millisSince(start);
+
+            std::cout << "  " << names[m] << ": " << bvh.getTriangleCount() << " triangles, "
+                << bvh.getNodeCount() << " nodes, build " << serialMs << " ms (1 thread), "
+                << pooledMs << " ms (pool)" << std::endl;
+
+            //rays from a sphere around the mesh towards points inside its box: a mix of hits,
+            //grazing rays and misses like picking and line of sight produce
+            AABB box = bvh.getBounds();
+            glm::vec3 center = box.center();
+            float radius = glm::length(box.extents()) * 1.5f;
+            std::vector<Ray> rays(RAY_COUNT);
+            for (size_t i = 0; i < RAY_COUNT; i++) {
+                uint32_t h = simd::hash32((uint32_t)i * 0x9E3779B9u);
+                float r[5];
+                for (int k = 0; k < 5; k++) {
+                    h = simd::hash32(h);
+                    r[k] = simd::unitFloat(h);
+                }
+                float z = 1.0f - 2.0f * r[0];
+                float phi = 6.2831853f * r[1];
+                float s = std::sqrt(std::max(0.0f, 1.0f - z * z));
+                glm::vec3 origin = center + radius * glm::vec3(s * std::cos(phi), z, s * std::sin(phi));
+                glm::vec3 target = box.minCorner + (box.maxCorner - box.minCorner) * glm::vec3(r[2], r[3], r[4]);
+                rays[i] = { origin, glm::normalize(target - origin), FLT_MAX };
+            }
+
+            //axis parallel rays (a level camera, a plumb line): a grid over each face of the box
+            //straight through it, where the slab tests divide by zero; the random ones never are
+            const int GRID = 32;
+            std::vector<Ray> axisRays;
+            for (int axis = 0; axis < 3; axis++) {
+                for (float sign : { -1.0f, 1.0f }) {
+                    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                    for (int i = 0; i < GRID; i++) {
+                        for (int j = 0; j < GRID; j++) {
+                            Ray ray;
+                            ray.origin = center;
+                            ray.origin[axis] -= sign * radius;
+                            ray.origin[u] = box.minCorner[u] + (box.maxCorner[u] - box.minCorner[u]) * (i + 0.5f) / GRID;
+                            ray.origin[v] = box.minCorner[v] + (box.maxCorner[v] - box.minCorner[v]) * (j + 0.5f) / GRID;
+                            ray.direction = glm::vec3(0.0f);
+                            ray.direction[axis] = sign;
+                            axisRays.push_back(ray);
+                        }
+                    }
+                }
+            }
+            std::vector<float> axisReference;
+
+            for (int width : { 2, 4, 8 }) {
+                bvh.build(vertices, &pool, width);
+                if (bvh.getWidth() != width)
+                    continue;
+
+                //the binary tree is the reference, every width must find the same closest hits
+                size_t axisHits = 0, axisMismatches = 0;
+                for (size_t i = 0; i < axisRays.size(); i++) {
+                    RayHit hit;
+                    float t = bvh.intersect(axisRays[i], hit) ? hit.t : FLT_MAX;
+                    axisHits += t < FLT_MAX;
+                    if (width == 2)
+                        axisReference.push_back(t);
+                    else if (t != axisReference[i] && std::abs(t - axisReference[i]) > 1e-4f * radius)
+                        axisMismatches++;
+                }
+                std::cout << "    " << width << " wide, axis parallel: " << axisHits << " of " << axisRays.size()
+                    << " hit" << (axisMismatches ? ", " + std::to_string(axisMismatches) + " differ from 2 wide (BUG)" : "")
+                    << std::endl;
+
+                for (int any = 0; any < 2; any++) {
+                    std::vector<uint8_t> hits(RAY_COUNT);
+                    auto trace = [&](size_t first, size_t last) {
+                        for (size_t i = first; i < last; i++) {
+                            RayHit hit;
+                            hits[i] = any ? bvh.occluded(rays[i]) : bvh.intersect(rays[i], hit);
+                        }
+                    };
+
+                    start = Clock::now();
+                    trace(0, RAY_COUNT);
+                    double serial = millisSince(start);
+                    start = Clock::now();
+                    pool.parallelFor(RAY_COUNT, 4096, trace);
+                    double pooled = millisSince(start);
+
+                    size_t hitCount = 0;
+                    for (uint8_t h : hits)
+                        hitCount += h;
+                    std::cout << "    " << width << " wide, " << (any ? "any hit:    " : "closest hit:") << " "
+                        << RAY_COUNT / serial / 1000.0 << " Mrays/s (1 thread), "
+                        << RAY_COUNT / pooled / 1000.0 << " Mrays/s (pool), "
+                        << 100.0 * hitCount / RAY_COUNT << "% hit" << std::endl;
+                }
+            }
+
+            //a statue's turn as the scene animates it: new vertices every frame, same tree
+            const int REFITS = 20;
+            start = Clock::now();
+            for (int i = 0; i < REFITS; i++) {
+                glm::mat4 spin = glm::rotate(glm::mat4(1.0f), 0.05f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+                bvh.refit(vertices, spin, &pool);
+            }
+            std::cout << "    refit: " << millisSince(start) / REFITS << " ms" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef TriangleBVH_hpp
+#define TriangleBVH_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "SimdUtils.hpp"
+#include "ThreadPool.hpp"
+
+#include <cfloat>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;        // needn't be normalized, t is in its units
+        float tMax = FLT_MAX;
+    };
+
+    struct RayHit {
+        float t = FLT_MAX;
+        uint32_t triangle = 0xFFFFFFFFu;
+        float u = 0.0f;             // barycentrics of vertices 1 and 2
+        float v = 0.0f;
+    };
+
+    //bounding volume hierarchy over a triangle soup, for ray queries on the cpu
+    //built top down with a binned surface area heuristic: each node is split where the
+    //expected cost of tracing its two halves is lowest; the upper levels bin in parallel and
+    //the subtrees below them are built side by side on a ThreadPool
+    //the binary tree can be collapsed into 4 or 8 wide nodes whose child boxes are tested
+    //in one SSE / AVX2 step; queries only read the tree, so any number of threads can trace
+    //refit() moves the triangles (e.g. a statue under a new transform) and only recomputes
+    //the boxes, which is much cheaper than a build but loosens the tree as the shape changes
+    class TriangleBVH {
+
+    public:
+        //vertices: three per triangle; triangle i keeps index i in the hits
+        //pool: builds in parallel, nullptr on the calling thread alone
+        //width: 2 traces the binary tree, 4 and 8 the collapsed one (8 needs AVX2, else 4)
+        void build(const std::vector<glm::vec3>& vertices, ThreadPool* pool = nullptr, int width = 2);
+
+        //the same triangles at new positions, transform applied to vertices on the way in
+        void refit(const std::vector<glm::vec3>& vertices, const glm::mat4& transform = glm::mat4(1.0f),
+            ThreadPool* pool = nullptr);
+
+        //closest hit along the ray before ray.tMax
+        bool intersect(const Ray& ray, RayHit& hit) const;
+        //any hit before ray.tMax (shadow rays)
+        bool occluded(const Ray& ray) const;
+
+        //segment from a to b: hit.t is the fraction of the way, in [0, 1]
+        bool intersectSegment(const glm::vec3& a, const glm::vec3& b, RayHit& hit) const;
+        //whether anything lies between a and b (line of sight)
+        bool segmentBlocked(const glm::vec3& a, const glm::vec3& b) const;
+
+        size_t getTriangleCount() const { return order.size(); }
+        size_t getNodeCount() const { return nodes.size(); }
+        int getWidth() const { return width; }
+        const AABB& getBounds() const { return bounds; }
+        //geometric normal, counter-clockwise front face
+        glm::vec3 getNormal(uint32_t triangle) const;
+
+        //builds the tree of each mesh (three vertices per triangle) with and without the pool
+        //and prints build and refit times and millions of rays per second for every width
+        static void runBenchmark(const std::vector<std::vector<glm::vec3>>& meshes,
+            const std::vector<std::string>& names, ThreadPool& pool);
+
+    private:
+        static const uint32_t MAX_LEAF_SIZE = 8;
+        static const int BIN_COUNT = 16;
+        static const int MAX_DEPTH = 60;            // a leaf whatever its size; keeps the stacks bounded
+        static const int STACK_SIZE = 64 * 8;
+
+        //32 bytes, two per cache line
+        //leaf if count > 0: triangles [first, first + count) in tree order
+        //inner otherwise: children at first and first + 1, always after their parent
+        struct Node {
+            glm::vec3 minCorner;
+            uint32_t first;
+            glm::vec3 maxCorner;
+            uint32_t count;
+        };
+
+        //up to 8 child boxes side by side, one lane each; unused lanes hold an inverted box
+        //lane k: inner if count[k] == 0 (child[k] is a wide node), leaf otherwise (child[k] is its first triangle)
+        struct alignas(32) WideNode {
+            float minX[8], minY[8], minZ[8];
+            float maxX[8], maxY[8], maxZ[8];
+            uint32_t child[8];
+            uint32_t count[8];
+        };
+
+        //a range of triangles still to be split, with the node that will hold it
+        struct BuildTask {
+            uint32_t node;
+            uint32_t begin;
+            uint32_t end;
+            int depth;
+        };
+
+        //per ray constants of the slab tests; negative[a]: the far plane on axis a is the min one
+        struct RaySetup {
+            glm::vec3 origin;
+            glm::vec3 invDir;
+            int negative[3];
+        };
+
+        std::vector<glm::vec3> vertices;            // three per triangle, in tree order
+        std::vector<uint32_t> order;                // tree order -> caller's triangle index
+        std::vector<uint32_t> slots;                // caller's triangle index -> tree order
+        std::vector<Node> nodes;
+        std::vector<WideNode> wideNodes;
+        std::vector<uint32_t> wideSources;          // per wide node, the binary node of each lane
+        AABB bounds;
+        int width = 2;
+
+        //build scratch, per caller triangle
+        std::vector<AABB> triangleBounds;
+        std::vector<glm::vec3> centroids;
+        uint32_t subtreeSize = 0;                   // ranges up to this size become parallel tasks
+
+        void split(std::vector<Node>& out, uint32_t node, uint32_t begin, uint32_t end, int depth,
+            std::vector<BuildTask>* deferred, ThreadPool* pool);
+        void measure(uint32_t begin, uint32_t end, ThreadPool* pool, AABB& nodeBounds, AABB& centroidBounds) const;
+        bool findSplit(uint32_t begin, uint32_t end, const AABB& nodeBounds, const AABB& centroidBounds,
+            ThreadPool* pool, int& axis, int& bin) const;
+        void collapse();
+        void refitWide();
+
+        bool intersectTriangle(uint32_t slot, const Ray& ray, float tMax, RayHit& hit) const;
+        template <bool ANY> bool traverseBinary(const Ray& ray, RayHit& hit) const;
+        template <bool ANY, int W> bool traverseWide(const Ray& ray, RayHit& hit) const;
+        template <bool ANY> bool traverse(const Ray& ray, RayHit& hit) const;
+
+        //lanes of a wide node the ray enters before tMax, as a bit mask, with their entry distances
+        static int hitLanesScalar(const WideNode& node, int lanes, const RaySetup& ray, float tMax, float* tNear);
+#if defined(GPS_SIMD_X86)
+        static int hitLanesSSE(const WideNode& node, const RaySetup& ray, float tMax, float* tNear);
+        static int hitLanesAVX2(const WideNode& node, const RaySetup& ray, float tMax, float* tNear);
+#endif
+    };
+}
+
+#endif /* TriangleBVH_hpp */
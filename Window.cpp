@@ -8,8 +8,6 @@ namespace gps {
         }
 
         //window hints
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -22,7 +20,14 @@ namespace gps {
         //for antialising
         glfwWindowHint(GLFW_SAMPLES, 4);
 
-        this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        //ask for 4.3 first (indirect draws, storage buffers), settle for 4.1 (macOS, older drivers)
+        const int versions[2][2] = { { 4, 3 }, { 4, 1 } };
+        this->window = NULL;
+        for (int i = 0; i < 2 && !this->window; i++) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, versions[i][0]);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, versions[i][1]);
+            this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        }
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
         }
@@ -43,6 +48,10 @@ namespace gps {
         std::cout << "Renderer: " << renderer << std::endl;
         std::cout << "OpenGL version: " << version << std::endl;
 
+        //the driver may hand out a newer context than requested
+        glGetIntegerv(GL_MAJOR_VERSION, &this->glMajor);
+        glGetIntegerv(GL_MINOR_VERSION, &this->glMinor);
+
         //for RETINA display
         glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
     }
@@ -62,6 +71,10 @@ namespace gps {
         return this->dimensions;
     }
 
+    bool Window::hasGLVersion(int major, int minor) {
+        return this->glMajor > major || (this->glMajor == major && this->glMinor >= minor);
+    }
+
     void Window::setWindowDimensions(WindowDimensions dimensions) {
         this->dimensions = dimensions;
     }
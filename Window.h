@@ -31,9 +31,14 @@ namespace gps {
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
 
+        //version of the context that was actually created
+        bool hasGLVersion(int major, int minor);
+
     private:
         WindowDimensions dimensions;
         GLFWwindow *window;
+        int glMajor = 0;
+        int glMinor = 0;
     };
 }
 
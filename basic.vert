@@ -3,26 +3,55 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-out vec3 fPosition;
-out vec3 fNormal;
+// eye and world space position and eye space normal, once per vertex instead of per fragment
+out vec3 fPosEye;
+out vec3 fWorldPos;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
 
+#ifdef LIGHTMAP
+#include "lightmap.glsl"
+
+// this entity's chart in the lightmap atlas
+uniform vec4  lightmapRect;
+uniform float lightmapCellStride;
+out vec2 fLightmapUV;
+#endif
+
+// bit-identical to depth_prepass.vert, the color pass may test with GL_EQUAL
+invariant gl_Position;
+
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat3 normalMatrix;
 
-uniform vec2 uvTiling;
-uniform vec2 uvMin;
-uniform vec2 uvMax;
-uniform vec2 uvOffset;   // ADD THIS
+// per-material parameters (one slice of the material UBO, see gps::MaterialParams)
+layout(std140) uniform MaterialBlock {
+    vec2  uvTiling;
+    vec2  uvOffset;
+    vec2  uvMin;
+    vec2  uvMax;
+    int   useNormalMap;
+    int   useOpacityMap;
+    int   isGlass;
+    int   isOutside;
+    float glassFactor;
+};
 
 void main()
 {
-    fPosition = vPosition;
-    fNormal   = vNormal;
+    vec4 worldPos = model * vec4(vPosition, 1.0);
+    fWorldPos  = worldPos.xyz;
+    fPosEye    = (view * worldPos).xyz;
+    fNormalEye = normalMatrix * vNormal;
 
     vec2 cropped = mix(uvMin, uvMax, vTexCoords);
     fTexCoords = cropped * uvTiling + uvOffset;  // ADD OFFSET
 
+#ifdef LIGHTMAP
+    fLightmapUV = lightmapUV(lightmapRect, lightmapCellStride, vNormal, vTexCoords);
+#endif
+
     gl_Position = projection * view * model * vec4(vPosition, 1.0);
 }
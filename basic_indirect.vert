@@ -0,0 +1,76 @@
+#version 430 core
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+layout(location=3) in uint drawId;      // per-instance attribute, equals the command's baseInstance
+
+// eye and world space position and eye space normal, once per vertex instead of per fragment
+out vec3 fPosEye;
+out vec3 fWorldPos;
+out vec3 fNormalEye;
+out vec2 fTexCoords;
+
+#ifdef LIGHTMAP
+#include "lightmap.glsl"
+out vec2 fLightmapUV;
+#endif
+
+// bit-identical to depth_prepass_indirect.vert, the color pass may test with GL_EQUAL
+invariant gl_Position;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// per-draw record (see gps::DrawRecord)
+struct DrawRecord {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 lightmapRect;
+    uint material;
+    float lightmapCellStride;
+};
+
+layout(std430, binding = 0) readonly buffer DrawRecords {
+    DrawRecord draws[];
+};
+
+// packed material parameters (see gps::MaterialParams)
+struct MaterialParams {
+    vec2  uvTiling;
+    vec2  uvOffset;
+    vec2  uvMin;
+    vec2  uvMax;
+    int   useNormalMap;
+    int   useOpacityMap;
+    int   isGlass;
+    int   isOutside;
+    float glassFactor;
+    float pad0;
+    float pad1;
+    float pad2;
+};
+
+layout(std430, binding = 1) readonly buffer MaterialTable {
+    MaterialParams materials[];
+};
+
+void main()
+{
+    DrawRecord d = draws[drawId];
+    MaterialParams m = materials[d.material];
+
+    // the record's normal matrix is the world space one
+    vec4 worldPos = d.model * vec4(vPosition, 1.0);
+    fWorldPos  = worldPos.xyz;
+    fPosEye    = (view * worldPos).xyz;
+    fNormalEye = mat3(view) * (mat3(d.normalMatrix) * vNormal);
+
+    vec2 cropped = mix(m.uvMin, m.uvMax, vTexCoords);
+    fTexCoords = cropped * m.uvTiling + m.uvOffset;
+
+#ifdef LIGHTMAP
+    fLightmapUV = lightmapUV(d.lightmapRect, d.lightmapCellStride, vNormal, vTexCoords);
+#endif
+
+    gl_Position = projection * view * worldPos;
+}
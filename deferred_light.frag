@@ -0,0 +1,49 @@
+#version 410 core
+
+// deferred resolve: one full screen pass lights every G-buffer pixel with the same code as
+// the forward pass (sun and window shadows, the clustered spots, fog)
+out vec4 fColor;
+
+#include "lighting.glsl"
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+
+    // nothing drawn here, the clear color stays
+    if (depth == 1.0) discard;
+
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    if (albedo.a == 0.0) {
+        fColor = vec4(albedo.rgb, 1.0);
+        return;
+    }
+
+    // view space position back from the depth
+    vec4 ndc = vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 eye = inverseProjection * ndc;
+    vec3 posEye = eye.xyz / eye.w;
+    vec4 worldPos = inverseView * vec4(posEye, 1.0);
+
+    vec3 normalEye = octDecode(texelFetch(gNormal, pixel, 0).xy);
+    vec4 material = texelFetch(gMaterial, pixel, 0);
+
+    // the G-buffer keeps no lightmap, every light is evaluated here
+    vec3 color = shadeSurface(posEye, worldPos, normalEye, albedo.rgb, material.rgb, material.a, vec4(0.0, 0.0, 0.0, 1.0));
+    fColor = applyFog(vec4(color, 1.0), posEye);
+}
@@ -0,0 +1,13 @@
+#version 410 core
+// depth pre-pass: the exact position math of basic.vert, so GL_EQUAL matches in the color pass
+layout(location=0) in vec3 vPosition;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = projection * view * model * vec4(vPosition, 1.0);
+}
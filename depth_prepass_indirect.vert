@@ -0,0 +1,26 @@
+#version 430 core
+// depth pre-pass on the indirect path: the exact position math of basic_indirect.vert
+layout(location=0) in vec3 vPosition;
+layout(location=3) in uint drawId;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+struct DrawRecord {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 lightmapRect;
+    uint material;
+    float lightmapCellStride;
+};
+
+layout(std430, binding = 0) readonly buffer DrawRecords {
+    DrawRecord draws[];
+};
+
+invariant gl_Position;
+
+void main() {
+    vec4 worldPos = draws[drawId].model * vec4(vPosition, 1.0);
+    gl_Position = projection * view * worldPos;
+}
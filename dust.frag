@@ -0,0 +1,8 @@
+#version 410 core
+out vec4 fColor;
+
+void main()
+{
+    // unlit like the sky: motes show as plain white specks
+    fColor = vec4(1.0);
+}
@@ -0,0 +1,17 @@
+#version 410 core
+layout(location=0) in vec3 vPosition;
+
+// per-mote position, one instanced attribute per SoA stream of gps::ParticleSystem
+layout(location=1) in float moteX;
+layout(location=2) in float moteY;
+layout(location=3) in float moteZ;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float moteSize;
+
+void main()
+{
+    vec3 p = vec3(moteX, moteY, moteZ) + vPosition * moteSize;
+    gl_Position = projection * view * vec4(p, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 410 core
+// mote centers captured by the transform feedback cull, one point each
+layout(location=1) in vec4 moteCenter;
+
+out vec3 vCenter;
+
+void main()
+{
+    vCenter = moteCenter.xyz;
+}
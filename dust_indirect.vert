@@ -0,0 +1,17 @@
+#version 430 core
+layout(location=0) in vec3 vPosition;
+
+// mote centers appended by instance_cull_atomic.vert, one per instance
+layout(std430, binding = 2) readonly buffer CulledInstances {
+    vec4 culled[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float moteSize;
+
+void main()
+{
+    vec3 p = culled[gl_InstanceID].xyz + vPosition * moteSize;
+    gl_Position = projection * view * vec4(p, 1.0);
+}
@@ -0,0 +1,23 @@
+#version 410 core
+// vertical half of the separable gaussian over the moments
+in vec2 fTexCoords;
+out vec4 fMoments;
+
+uniform sampler2D source;
+uniform int blurRadius;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int height = textureSize(source, 0).y;
+    float sigma = max(float(blurRadius) * 0.5, 0.5);
+
+    vec4 sum = vec4(0.0);
+    float weights = 0.0;
+    for (int i = -blurRadius; i <= blurRadius; i++) {
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        int y = clamp(texel.y + i, 0, height - 1);
+        sum += w * texelFetch(source, ivec2(texel.x, y), 0);
+        weights += w;
+    }
+    fMoments = sum / weights;
+}
@@ -0,0 +1,32 @@
+#version 410 core
+// one depth layer -> EVSM moments, blurred along x
+in vec2 fTexCoords;
+out vec4 fMoments;
+
+uniform sampler2DArray depthMaps;   // compare mode off
+uniform int layer;
+uniform int blurRadius;
+uniform vec2 exponents;             // positive, negative warp
+
+vec4 warp(float depth) {
+    float d = depth * 2.0 - 1.0;
+    float pos = exp(exponents.x * d);
+    float neg = -exp(-exponents.y * d);
+    return vec4(pos, pos * pos, neg, neg * neg);
+}
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int width = textureSize(depthMaps, 0).x;
+    float sigma = max(float(blurRadius) * 0.5, 0.5);
+
+    vec4 sum = vec4(0.0);
+    float weights = 0.0;
+    for (int i = -blurRadius; i <= blurRadius; i++) {
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        int x = clamp(texel.x + i, 0, width - 1);
+        sum += w * warp(texelFetch(depthMaps, ivec3(x, texel.y, layer), 0).r);
+        weights += w;
+    }
+    fMoments = sum / weights;
+}
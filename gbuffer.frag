@@ -0,0 +1,38 @@
+#version 410 core
+
+in vec3 fPosEye;
+in vec3 fWorldPos;
+in vec3 fNormalEye;
+in vec2 fTexCoords;
+
+// the surface, nothing lit yet (see gps::GBuffer)
+layout(location = 0) out vec4 gAlbedo;     // albedo; a: 1 lit, 0 drawn as is (the sky)
+layout(location = 1) out vec2 gNormal;     // view space normal, octahedral
+layout(location = 2) out vec4 gMaterial;   // specular map, roughness
+
+#include "surface.glsl"
+
+// the unit octahedron unfolded onto [-1, 1]^2
+vec2 octEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z >= 0.0)
+        return n.xy;
+    return (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+}
+
+void main() {
+    vec4 albedo4 = texture(diffuseTexture, fTexCoords);
+#ifdef ALPHA_TEST
+    if (albedo4.a < 0.1) discard;
+#endif
+
+#ifdef SKY
+    gAlbedo = vec4(albedo4.rgb, 0.0);
+    gNormal = vec2(0.0);
+    gMaterial = vec4(0.0);
+#else
+    gAlbedo = vec4(albedo4.rgb, 1.0);
+    gNormal = octEncode(getSurfaceNormal());
+    gMaterial = vec4(texture(specularTexture, fTexCoords).rgb, texture(roughnessTexture, fTexCoords).r);
+#endif
+}
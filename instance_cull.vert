@@ -0,0 +1,23 @@
+#version 410 core
+// one point per instance: the sphere test runs here, instance_cull.geom drops the failures
+layout(location=0) in float instanceX;
+layout(location=1) in float instanceY;
+layout(location=2) in float instanceZ;
+
+uniform vec4 frustumPlanes[6];  // normalized, inside where dot(xyz, p) + w >= 0
+uniform float instanceRadius;
+
+out vec4 vInstance;             // xyz: center, w: 1 if inside the frustum
+
+void main()
+{
+    vec3 c = vec3(instanceX, instanceY, instanceZ);
+
+    float inside = 1.0;
+    for (int i = 0; i < 6; i++) {
+        if (dot(frustumPlanes[i].xyz, c) + frustumPlanes[i].w < -instanceRadius)
+            inside = 0.0;
+    }
+
+    vInstance = vec4(c, inside);
+}
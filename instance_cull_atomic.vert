@@ -0,0 +1,31 @@
+#version 430 core
+// one point per instance; the survivors are appended to CulledInstances and counted straight
+// into the instanceCount of the indirect command (offset 4) drawing them
+layout(location=0) in float instanceX;
+layout(location=1) in float instanceY;
+layout(location=2) in float instanceZ;
+
+uniform vec4 frustumPlanes[6];  // normalized, inside where dot(xyz, p) + w >= 0
+uniform float instanceRadius;
+
+layout(binding = 0, offset = 4) uniform atomic_uint visibleCount;
+
+layout(std430, binding = 2) writeonly buffer CulledInstances {
+    vec4 culled[];
+};
+
+void main()
+{
+    vec3 c = vec3(instanceX, instanceY, instanceZ);
+
+    bool inside = true;
+    for (int i = 0; i < 6; i++) {
+        if (dot(frustumPlanes[i].xyz, c) + frustumPlanes[i].w < -instanceRadius)
+            inside = false;
+    }
+
+    if (inside)
+        culled[atomicCounterIncrement(visibleCount)] = vec4(c, 1.0);
+
+    gl_Position = vec4(0.0);
+}
@@ -0,0 +1,288 @@
+// everything that lights a surface, shared by the forward pass and the deferred resolve
+
+uniform mat4 view;
+
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+
+// one depth array compared in hardware: the sun cascades first, then the window light
+#define CASCADE_COUNT       3
+#define SHADOW_LAYER_WINDOW 3
+uniform mat4  cascadeMatrices[CASCADE_COUNT];
+uniform float cascadeSplits[CASCADE_COUNT];    // far view depth of each cascade
+uniform sampler2DArrayShadow shadowMaps;     // linear filtered: one fetch is a bilinear 2x2 PCF
+
+// shadow filter, chosen per deployment (--shadow-kernel)
+#define SHADOW_KERNEL_1TAP    0   // one bilinear compare
+#define SHADOW_KERNEL_GATHER  1   // four gathers, a 4x4 texel tent
+#define SHADOW_KERNEL_POISSON 2   // 12 bilinear compares on a disk rotated per pixel
+uniform int shadowKernel;
+
+// prefiltered EVSM moments of the same layers (--evsm): one mipmapped, anisotropic fetch
+uniform int useMomentShadows;
+uniform sampler2DArray shadowMoments;
+uniform vec2 evsmExponents;                  // positive, negative warp
+uniform float fogDensity;
+uniform vec3  fogColor;
+
+uniform vec3 windowLightDir;
+uniform vec3 windowLightColor;
+
+uniform mat4 windowLightSpaceMatrix;
+
+// SPOTLIGHTS (clustered)
+// the view frustum is cut into CLUSTER_GRID froxels, screen tiles times slices spaced
+// logarithmically in view depth; a fragment only loops over the spots of its own froxel
+#define CLUSTER_GRID ivec3(16, 9, 24)
+uniform vec2 viewportSize;
+uniform vec2 clusterDepthRange;             // near plane, log(far / near)
+
+// 4 texels per spot, all in view space: position / range, direction / cos outer,
+// color * intensity / cos inner, attenuation constant linear quadratic / shadow slot (-1 none)
+uniform samplerBuffer  clusterLights;
+uniform usamplerBuffer clusterGrid;         // per froxel: first index, count
+uniform usamplerBuffer clusterIndices;
+
+// spot shadows: tiles of one atlas, compared in hardware
+#define MAX_SHADOWED_SPOTS 3
+uniform sampler2DShadow spotShadowAtlas;
+uniform mat4 spotShadowMatrices[MAX_SHADOWED_SPOTS];
+uniform vec4 spotShadowRects[MAX_SHADOWED_SPOTS];  // tile offset xy and size z in atlas uv; w 0: no shadow
+
+#ifdef LIGHTMAP
+// baked for the static surfaces by gps::LightmapBaker: rgb the light of the first
+// bakedSpotCount spots and the bounces of every light, to be multiplied by the albedo;
+// a the ambient occlusion; the including shader samples it and hands it to shadeSurface()
+uniform sampler2D lightmap;
+uniform int bakedSpotCount;
+#endif
+
+const vec2 poissonDisk[12] = vec2[](
+    vec2(-0.326, -0.406), vec2(-0.840, -0.074), vec2(-0.696,  0.457), vec2(-0.203,  0.621),
+    vec2( 0.962, -0.195), vec2( 0.473, -0.480), vec2( 0.519,  0.767), vec2( 0.185, -0.893),
+    vec2( 0.507,  0.064), vec2( 0.896,  0.412), vec2(-0.322, -0.933), vec2(-0.792, -0.598)
+);
+
+// gather results (x: 0,1  y: 1,1  z: 1,0  w: 0,0 of the 2x2 footprint) weighted per column and row
+float gatherWeighted(vec4 g, vec2 wx, vec2 wy) {
+    return g.w * wx.x * wy.x + g.z * wx.y * wy.x + g.x * wx.x * wy.y + g.y * wx.y * wy.y;
+}
+
+// fraction of a shadow map texel footprint that sees the light, at uv of a layer
+float filterShadow(vec2 uv, float layer, float ref) {
+    if (shadowKernel == SHADOW_KERNEL_GATHER) {
+        // 4x4 texels around uv, tent weights that fade the outer rows/columns with the
+        // sub-texel position, like 3x3 bilinear taps but in 4 fetches
+        vec2 size = vec2(textureSize(shadowMaps, 0).xy);
+        vec2 st = uv * size - 0.5;
+        vec2 base = floor(st);
+        vec2 f = st - base;
+
+        vec4 g00 = textureGather(shadowMaps, vec3(base / size, layer), ref);
+        vec4 g10 = textureGather(shadowMaps, vec3((base + vec2(2.0, 0.0)) / size, layer), ref);
+        vec4 g01 = textureGather(shadowMaps, vec3((base + vec2(0.0, 2.0)) / size, layer), ref);
+        vec4 g11 = textureGather(shadowMaps, vec3((base + vec2(2.0, 2.0)) / size, layer), ref);
+
+        float lit = gatherWeighted(g00, vec2(1.0 - f.x, 1.0), vec2(1.0 - f.y, 1.0))
+                  + gatherWeighted(g10, vec2(1.0, f.x),       vec2(1.0 - f.y, 1.0))
+                  + gatherWeighted(g01, vec2(1.0 - f.x, 1.0), vec2(1.0, f.y))
+                  + gatherWeighted(g11, vec2(1.0, f.x),       vec2(1.0, f.y));
+        return lit / 9.0;
+    }
+
+    if (shadowKernel == SHADOW_KERNEL_POISSON) {
+        // interleaved gradient noise turns the disk per pixel; banding becomes fine grain
+        float noise = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+        float angle = 6.2831853 * noise;
+        mat2 rot = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+        vec2 radius = 1.5 / vec2(textureSize(shadowMaps, 0).xy);
+
+        float lit = 0.0;
+        for (int i = 0; i < 12; i++)
+            lit += texture(shadowMaps, vec4(uv + rot * poissonDisk[i] * radius, layer, ref));
+        return lit / 12.0;
+    }
+
+    return texture(shadowMaps, vec4(uv, layer, ref));
+}
+
+// upper bound on the lit fraction for a depth given its mean and mean square
+float chebyshev(vec2 moments, float depth) {
+    if (depth <= moments.x)
+        return 1.0;
+    float variance = max(moments.y - moments.x * moments.x, 1e-4 * moments.x * moments.x);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    // cut the low tail of the bound, the light bleeding of overlapping casters
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+float momentShadow(vec2 uv, float layer, float depth) {
+    // taken in uniform control flow so the mip and anisotropy footprint are right
+    vec4 moments = texture(shadowMoments, vec3(uv, layer));
+    float d = depth * 2.0 - 1.0;
+    float pos = exp(evsmExponents.x * d);
+    float neg = -exp(-evsmExponents.y * d);
+    return min(chebyshev(moments.xy, pos), chebyshev(moments.zw, neg));
+}
+
+// shadow of a directional light at worldPos, from its matrix and layer; 0 lit, 1 shadowed
+float computeShadow(vec4 worldPos, mat4 LS, int layer) {
+    vec4 fragLS = LS * worldPos;
+    vec3 proj = fragLS.xyz / fragLS.w;
+    proj = proj * 0.5 + 0.5;
+
+    float lit;
+    if (useMomentShadows == 1)
+        lit = momentShadow(proj.xy, float(layer), proj.z);
+    else
+        lit = filterShadow(proj.xy, float(layer), proj.z - 0.002);
+
+    return proj.z > 1.0 ? 0.0 : 1.0 - lit;
+}
+
+// sun shadow from the first cascade whose slice holds the fragment's view depth; the lookup
+// runs for every fragment (past the last split it's discarded) to keep the flow uniform
+float computeSunShadow(vec4 worldPos, float viewDepth) {
+    int cascade = 0;
+    while (cascade < CASCADE_COUNT - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    float shadow = computeShadow(worldPos, cascadeMatrices[cascade], cascade);
+    return viewDepth > cascadeSplits[CASCADE_COUNT - 1] ? 0.0 : shadow;
+}
+
+
+int clusterIndex(float viewDepth) {
+    ivec2 tile = ivec2(gl_FragCoord.xy / viewportSize * vec2(CLUSTER_GRID.xy));
+    int slice = int(log(max(viewDepth, clusterDepthRange.x) / clusterDepthRange.x)
+                    / clusterDepthRange.y * float(CLUSTER_GRID.z));
+    tile = clamp(tile, ivec2(0), CLUSTER_GRID.xy - 1);
+    slice = clamp(slice, 0, CLUSTER_GRID.z - 1);
+    return tile.x + CLUSTER_GRID.x * (tile.y + CLUSTER_GRID.y * slice);
+}
+
+vec3 evalSpotLight(
+    int light,
+    vec3 posEye,
+    vec3 normalEye,
+    vec3 viewDir,
+    vec3 albedo,
+    vec3 specMap,
+    float shininess,
+    float specStrength
+) {
+    vec4 posRange = texelFetch(clusterLights, light * 4);
+    vec4 dirOuter = texelFetch(clusterLights, light * 4 + 1);
+    vec4 colorInner = texelFetch(clusterLights, light * 4 + 2);
+    vec3 attenuation = texelFetch(clusterLights, light * 4 + 3).xyz;
+
+    vec3 L = normalize(posRange.xyz - posEye);
+    float dist = length(posRange.xyz - posEye);
+
+    float theta = dot(L, -dirOuter.xyz);
+    float eps = colorInner.w - dirOuter.w;
+    float cone = clamp((theta - dirOuter.w) / max(eps, 1e-6), 0.0, 1.0);
+
+    // windowed to exactly nothing at the range the clusters were built with
+    float att = 1.0 / (attenuation.x + attenuation.y * dist + attenuation.z * dist * dist);
+    float fade = clamp(1.0 - pow(dist / posRange.w, 4.0), 0.0, 1.0);
+    att *= fade * fade;
+
+    float diff = max(dot(normalEye, L), 0.0);
+
+    vec3 R = reflect(-L, normalEye);
+    float specCoeff = pow(max(dot(viewDir, R), 0.0), shininess);
+
+    vec3 diffuse = diff * albedo * colorInner.rgb;
+    vec3 specular = specStrength * specCoeff * specMap * colorInner.rgb;
+
+    return (diffuse + specular) * att * cone;
+}
+
+// one bilinear PCF tap in the spot's tile; 0 lit, 1 shadowed
+float computeSpotShadow(int i, vec4 worldPos) {
+    vec4 rect = spotShadowRects[i];
+    if (rect.w == 0.0)
+        return 0.0;
+
+    vec4 fragLS = spotShadowMatrices[i] * worldPos;
+    if (fragLS.w <= 0.0)
+        return 0.0;
+    vec3 proj = fragLS.xyz / fragLS.w * 0.5 + 0.5;
+    if (proj.z > 1.0)
+        return 0.0;
+
+    // half a texel inside the tile, the filter never reads a neighbouring light
+    vec2 halfTexel = 0.5 / vec2(textureSize(spotShadowAtlas, 0));
+    vec2 uv = clamp(rect.xy + proj.xy * rect.z, rect.xy + halfTexel, rect.xy + rect.z - halfTexel);
+    return 1.0 - texture(spotShadowAtlas, vec3(uv, proj.z));
+}
+
+
+// ambient, window glow, sun, window light and the spots of the fragment's cluster; the sun
+// shadow lookup stays in uniform control flow for whoever calls it there
+// baked: the lightmap texel in LIGHTMAP variants, which replaces the baked spots
+vec3 shadeSurface(vec3 posEye, vec4 worldPos, vec3 normalEye, vec3 albedo, vec3 specMap, float rough, vec4 baked) {
+    vec3 viewDir = normalize(-posEye);
+    float shininess = mix(128.0, 8.0, rough);
+    float specStrength = mix(1.0, 0.1, rough);
+
+    // directional light
+    vec3 sunDirEye = normalize(vec3(view * vec4(lightDir, 0.0)));
+    float shadowSun = computeSunShadow(worldPos, -posEye.z);
+
+    vec3 sunDiffuse = max(dot(normalEye, sunDirEye), 0.0) * lightColor * albedo;
+    vec3 sunReflect = reflect(-sunDirEye, normalEye);
+    float sunSpecCoeff = pow(max(dot(viewDir, sunReflect), 0.0), shininess);
+    vec3 sunSpecular = specStrength * sunSpecCoeff * lightColor * specMap;
+
+    // window light
+    vec3 winDirEye = normalize(vec3(view * vec4(windowLightDir, 0.0)));
+    float shadowWin = computeShadow(worldPos, windowLightSpaceMatrix, SHADOW_LAYER_WINDOW);
+
+    vec3 winDiffuse = max(dot(normalEye, winDirEye), 0.0) * windowLightColor * albedo;
+    vec3 winReflect = reflect(-winDirEye, normalEye);
+    float winSpecCoeff = pow(max(dot(viewDir, winReflect), 0.0), shininess);
+    vec3 winSpecular = specStrength * winSpecCoeff * windowLightColor * specMap;
+
+    // light volume
+    float zWindowPosition = -8.0;
+    float distToWindow = abs(worldPos.z - zWindowPosition);
+    float windowGlow = clamp(1.0 - (distToWindow / 5.0), 0.0, 1.0);
+    windowGlow = pow(windowGlow, 2.0);
+    vec3 volumeColor = windowLightColor * windowGlow * 0.25;
+
+    // ambient light
+    float ambientStrength = 0.2;
+    vec3 ambient = ambientStrength * albedo;
+#ifdef LIGHTMAP
+    ambient = ambient * baked.a + baked.rgb * albedo;
+#endif
+
+    vec3 color = ambient + volumeColor
+               + (1.0 - shadowSun) * (sunDiffuse + sunSpecular)
+               + (1.0 - shadowWin) * (winDiffuse + winSpecular);
+
+    // spotlights of this fragment's cluster
+    uvec2 cluster = texelFetch(clusterGrid, clusterIndex(-posEye.z)).xy;
+    for (uint k = 0u; k < cluster.y; k++) {
+        int light = int(texelFetch(clusterIndices, int(cluster.x + k)).r);
+#ifdef LIGHTMAP
+        if (light < bakedSpotCount)
+            continue;
+#endif
+        int shadow = int(texelFetch(clusterLights, light * 4 + 3).w);
+        float lit = shadow >= 0 ? 1.0 - computeSpotShadow(shadow, worldPos) : 1.0;
+        color += lit * evalSpotLight(light, posEye, normalEye, viewDir, albedo, specMap, shininess, specStrength);
+    }
+
+    return color;
+}
+
+vec4 applyFog(vec4 color, vec3 posEye) {
+    float fragmentDistance = length(posEye);
+    float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+    fogFactor = clamp(fogFactor, 0.0, 1.0);
+    return mix(vec4(fogColor, 1.0), color, fogFactor);
+}
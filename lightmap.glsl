@@ -0,0 +1,16 @@
+// lightmap coordinates of a vertex (LIGHTMAP variants, see gps::LightmapBaker)
+// a lightmapped entity owns a chart of cells side by side in the atlas, one per planar face,
+// each covering the face's own texture coordinates; rect is the first cell's corner and size,
+// cellStride the step to the next (0 for single face charts)
+
+// cube faces in the order of their vertices: +X -X +Y -Y +Z -Z
+float lightmapCell(vec3 objectNormal) {
+    vec3 a = abs(objectNormal);
+    int axis = a.x > a.y && a.x > a.z ? 0 : (a.y > a.z ? 1 : 2);
+    return float(axis * 2 + (objectNormal[axis] < 0.0 ? 1 : 0));
+}
+
+vec2 lightmapUV(vec4 rect, float cellStride, vec3 objectNormal, vec2 texCoords) {
+    float offset = cellStride > 0.0 ? lightmapCell(objectNormal) * cellStride : 0.0;
+    return rect.xy + vec2(offset, 0.0) + texCoords * rect.zw;
+}
@@ -16,11 +16,39 @@
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "Scene.hpp"
+#include "Material.hpp"
+#include "IndirectRenderer.hpp"
+#include "StreamBuffer.hpp"
+#include "Culling.hpp"
+#include "OcclusionCuller.hpp"
+#include "OcclusionQueries.hpp"
+#include "InstanceCuller.hpp"
+#include "ShadowCache.hpp"
+#include "ShadowCascades.hpp"
+#include "ShadowCasters.hpp"
+#include "ShadowMoments.hpp"
+#include "ShadowAtlas.hpp"
+#include "FragmentCounter.hpp"
+#include "LightClusters.hpp"
+#include "GBuffer.hpp"
+#include "ShaderPermutations.hpp"
+#include "ProgramCache.hpp"
+#include "TriangleBVH.hpp"
+#include "ScenePicker.hpp"
+#include "Collision.hpp"
+#include "LightmapBaker.hpp"
+#include "ThreadPool.hpp"
+#include "ParticleSystem.hpp"
 #include "stb_image.h"
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 
 // FUNCTION PROTOTYPES
 
@@ -28,73 +56,83 @@
 void initOpenGLWindow();
 void initOpenGLState();
 void initShaders();
+void prepareSurfacePrograms();
 void initUniforms();
 void initModels();
 void initQuad();
 void initCube();
 void initShadowMap();
-void initWindowShadowMap();
 void initDust();
+void initMaterials();
+void initScene();
+void initDrawLists();
+void initLightmap();
+std::vector<gps::LightmapFace> lightmapFaces(const float* v, int faceCount, const glm::mat4& M);
+uint32_t addIndirectPrimitive(const float* v, int vertexCount);
+void initPicking();
+void initCollision();
+std::vector<glm::vec3> primitiveTriangles(const float* v, int vertexCount);
 
 // Rendering functions
 void renderScene();
-void renderRoom(gps::Shader& shader);
-void renderObjects(gps::Shader& shader);
-void renderDecor(gps::Shader& shader);
-void renderLampFixtures(gps::Shader& shader);
-void renderDust(gps::Shader& shader);
+void animateScene();
+void uploadFrameUniforms(gps::Shader& shader);
+void renderOpaqueEntities(gps::ShaderPermutations& programs, gps::ShaderPermutations& indirect);
+void renderTransparentEntities(gps::ShaderPermutations& programs);
+void renderDeferred();
+void renderQueriedEntities(gps::ShaderPermutations& programs);
+void renderDepthPrepass();
+void renderDust();
+void reportFrameStats();
+void cullMainPass();
+void cullShadowCasters(const glm::mat4* lightSpaces, unsigned layerMask, gps::ShadowCasterLists& lists);
 
 // Shadow pass rendering
-void renderRoomShadow(gps::Shader& sh);
-void renderObjectsShadow(gps::Shader& sh);
-void renderDecorShadow(gps::Shader& sh);
+void renderSceneShadows(gps::Shader& sh, unsigned layerMask);
+void renderShadowMaps(unsigned layerMask);
+void renderSpotShadows();
 
 // Drawing primitives
-void drawTexturedQuad(
-    gps::Shader& shader, const glm::mat4& M,
-    GLuint diffuseTex, GLuint specTex, GLuint roughTex, GLuint normalTex,
-    glm::vec2 tiling,
-    int isOutside = 0,
-    int isGlass = 0,
-    float glassFactor = 0.25f,
-    GLuint opacityTex = 0       // NEW
-);
-
-void drawTexturedCube(
-    gps::Shader& shader,
-    const glm::mat4& M,
-    GLuint diffuseTex, GLuint specTex, GLuint roughTex, GLuint normalTex,
-    glm::vec2 tiling,
-    int isGlass = 0,
-    float glassFactor = 1.0f,
-    GLuint opacityTex = 0
-);
-
-void drawModel(gps::Shader& shader, gps::Model3D& mdl, const glm::mat4& M);
+uint32_t surfaceKey(uint32_t material);
+void setModelMatrix(gps::Shader& shader, const glm::mat4& M);
+void setLightmapRect(gps::Shader& shader, gps::EntityId id);
+void drawQuad(gps::ShaderPermutations& programs, const glm::mat4& M, uint32_t material, gps::EntityId id);
+void drawCube(gps::ShaderPermutations& programs, const glm::mat4& M, uint32_t material, gps::EntityId id);
+void drawModel(gps::ShaderPermutations& programs, gps::Model3D& mdl, const glm::mat4& M);
+void drawEntity(gps::ShaderPermutations& programs, gps::EntityId id);
 
 // Shadow drawing functions
 void drawShadowQuad(gps::Shader& sh, const glm::mat4& M);
 void drawShadowCube(gps::Shader& sh, const glm::mat4& M);
 void drawShadowModel(gps::Shader& sh, gps::Model3D& mdl, const glm::mat4& M);
+void drawEntityShadow(gps::Shader& sh, gps::EntityId id);
 
 // Light space matrix computation
-glm::mat4 computeLightSpaceMatrix();
+void computeSunCascades();
 glm::mat4 computeWindowLightSpaceMatrix();
+glm::mat4 computeSpotLightSpace(int spot);
+float spotImportance(int spot, const gps::Frustum& viewFrustum);
 
 // Camera and input handling
 void processMovement();
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void mouseCallback(GLFWwindow* window, double xpos, double ypos);
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void turnSelected(float degrees);
 void windowResizeCallback(GLFWwindow* window, int width, int height);
-void clampCameraInsideRoom();
-void clampPersonInsideRoom();
+gps::Capsule cameraCapsule(const glm::vec3& eye);
+gps::Capsule personCapsule(const glm::vec3& feet);
+void collideCamera(const glm::vec3& from);
+void movePerson(const glm::vec3& motion);
 
 // Utilities
 GLenum glCheckError_(const char* file, int line);
 void setWindowCallbacks();
 void cleanup();
-void setAnisotropy(GLuint texId);
 void uploadSpotlights(gps::Shader& shader);
+void addTestSpots(int count);
+void initLightClusters();
+glm::vec3 averageTextureColor(GLuint texture);
 
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
@@ -109,20 +147,105 @@ struct SpotlightCPU {
     float constant;
     float linear;
     float quadratic;
+    float intensity = 2.0f;
+    float range = 8.0f;         // windowed to no light at all past it, so clustering can bound it
 };
 
-// DUST MOTE STRUCTURE
-struct DustMote {
-    glm::vec3 position;
-    float speed;
-    float phase;
+// MATERIAL IDS (created in this order by initMaterials)
+
+enum MaterialId : uint32_t {
+    MAT_MODEL,          // placeholder for model entities, their meshes carry their own materials
+    MAT_FLOOR,
+    MAT_WALL,
+    MAT_WALL_PLAIN,     // wall textures without tiling (pedestals, lamps)
+    MAT_SKY,
+    MAT_GLASS,
+    MAT_COUNT
 };
 
-// GLOBAL VARIABLES - TEXTURES
+// SURFACE SHADER FEATURES (permutation key bits of basic.frag / gbuffer.frag, see surface.glsl)
+
+enum SurfaceFeature : uint32_t {
+    FEATURE_FLAT_SHADING = 1u << 0,
+    FEATURE_NORMAL_MAP   = 1u << 1,
+    FEATURE_ALPHA_TEST   = 1u << 2,
+    FEATURE_GLASS        = 1u << 3,
+    FEATURE_OPACITY_MAP  = 1u << 4,
+    FEATURE_SKY          = 1u << 5,
+    FEATURE_LIGHTMAP     = 1u << 6
+};
+
+// what a variant may be drawn without while it is still compiling in the background (e.g. flat
+// shading right after F2): for a moment smooth shading, vertex normals or unbaked spots instead
+const uint32_t SURFACE_OPTIONAL_FEATURES = FEATURE_FLAT_SHADING | FEATURE_NORMAL_MAP | FEATURE_LIGHTMAP;
+
+const std::vector<std::string> SURFACE_FEATURE_DEFINES = {
+    "FLAT_SHADING", "NORMAL_MAP", "ALPHA_TEST", "GLASS", "OPACITY_MAP", "SKY", "LIGHTMAP"
+};
+
+// GLOBAL VARIABLES - PRIMITIVES
+
+// unit quad and cube, position normal uv; the quad has one face, the cube six in the order
+// +X -X +Y -Y +Z -Z, each with texture coordinates over [0, 1]
+const float QUAD_VERTICES[] = {
+    -0.5f, 0.0f, -0.5f,  0, 1, 0,  0, 0,
+     0.5f, 0.0f, -0.5f,  0, 1, 0,  1, 0,
+     0.5f, 0.0f,  0.5f,  0, 1, 0,  1, 1,
+    -0.5f, 0.0f, -0.5f,  0, 1, 0,  0, 0,
+     0.5f, 0.0f,  0.5f,  0, 1, 0,  1, 1,
+    -0.5f, 0.0f,  0.5f,  0, 1, 0,  0, 1
+};
+
+const float CUBE_VERTICES[] = {
+    // +X
+    0.5f, -0.5f, -0.5f,  1, 0, 0,  0, 0,
+    0.5f, -0.5f,  0.5f,  1, 0, 0,  1, 0,
+    0.5f,  0.5f,  0.5f,  1, 0, 0,  1, 1,
+    0.5f, -0.5f, -0.5f,  1, 0, 0,  0, 0,
+    0.5f,  0.5f,  0.5f,  1, 0, 0,  1, 1,
+    0.5f,  0.5f, -0.5f,  1, 0, 0,  0, 1,
+    // -X
+    -0.5f, -0.5f,  0.5f,  -1, 0, 0,  0, 0,
+    -0.5f, -0.5f, -0.5f,  -1, 0, 0,  1, 0,
+    -0.5f,  0.5f, -0.5f,  -1, 0, 0,  1, 1,
+    -0.5f, -0.5f,  0.5f,  -1, 0, 0,  0, 0,
+    -0.5f,  0.5f, -0.5f,  -1, 0, 0,  1, 1,
+    -0.5f,  0.5f,  0.5f,  -1, 0, 0,  0, 1,
+    // +Y
+    -0.5f,  0.5f, -0.5f,  0, 1, 0,  0, 0,
+     0.5f,  0.5f, -0.5f,  0, 1, 0,  1, 0,
+     0.5f,  0.5f,  0.5f,  0, 1, 0,  1, 1,
+    -0.5f,  0.5f, -0.5f,  0, 1, 0,  0, 0,
+     0.5f,  0.5f,  0.5f,  0, 1, 0,  1, 1,
+    -0.5f,  0.5f,  0.5f,  0, 1, 0,  0, 1,
+    // -Y
+    -0.5f, -0.5f,  0.5f,  0, -1, 0,  0, 0,
+     0.5f, -0.5f,  0.5f,  0, -1, 0,  1, 0,
+     0.5f, -0.5f, -0.5f,  0, -1, 0,  1, 1,
+    -0.5f, -0.5f,  0.5f,  0, -1, 0,  0, 0,
+     0.5f, -0.5f, -0.5f,  0, -1, 0,  1, 1,
+    -0.5f, -0.5f, -0.5f,  0, -1, 0,  0, 1,
+    // +Z
+    -0.5f, -0.5f,  0.5f,  0, 0, 1,  0, 0,
+    -0.5f,  0.5f,  0.5f,  0, 0, 1,  0, 1,
+     0.5f,  0.5f,  0.5f,  0, 0, 1,  1, 1,
+    -0.5f, -0.5f,  0.5f,  0, 0, 1,  0, 0,
+     0.5f,  0.5f,  0.5f,  0, 0, 1,  1, 1,
+     0.5f, -0.5f,  0.5f,  0, 0, 1,  1, 0,
+    // -Z
+     0.5f, -0.5f, -0.5f,  0, 0, -1,  0, 0,
+     0.5f,  0.5f, -0.5f,  0, 0, -1,  0, 1,
+    -0.5f,  0.5f, -0.5f,  0, 0, -1,  1, 1,
+     0.5f, -0.5f, -0.5f,  0, 0, -1,  0, 0,
+    -0.5f,  0.5f, -0.5f,  0, 0, -1,  1, 1,
+    -0.5f, -0.5f, -0.5f,  0, 0, -1,  1, 0
+};
 
 GLuint quadVAO = 0, quadVBO = 0;
 GLuint cubeVAO = 0, cubeVBO = 0;
 
+// GLOBAL VARIABLES - TEXTURES
+
 GLuint floorDiffuse = 0;
 GLuint floorSpecular = 0;
 GLuint floorRoughness = 0;
@@ -161,6 +284,19 @@ double lastX = 512.0, lastY = 384.0;
 bool gWireframe = false;
 int gFlat = 0;
 
+// GLOBAL VARIABLES - SCENE
+
+gps::Scene scene;
+gps::MaterialLibrary materials;
+std::vector<uint32_t> materialFeatures;    // per material, without FEATURE_FLAT_SHADING
+
+const float ROOM_W = 12.0f;
+const float ROOM_D = 16.0f;
+const float ROOM_H = 4.0f;
+
+gps::EntityId statueIds[3] = { gps::NO_ENTITY, gps::NO_ENTITY, gps::NO_ENTITY };
+gps::EntityId personId = gps::NO_ENTITY;
+
 // GLOBAL VARIABLES - MODELS
 
 gps::Model3D teapot;
@@ -177,12 +313,35 @@ float personYaw = 180.0f;
 bool personAnimate = false;
 float personAnimT = 0.0f;
 
-std::vector<DustMote> motes;
+gps::ParticleSystem dust;
 const int NUM_MOTES = 250;
+gps::Shader dustShader;
+GLuint dustVAO = 0;
+const float MOTE_SIZE = 0.008f;
+
+// the motes are frustum culled on the gpu, so their cpu cost doesn't grow with the count
+bool useGpuInstanceCulling = true;
+gps::InstanceCuller dustCuller;
+gps::Shader dustCulledShader;
+
+// GLOBAL VARIABLES - TIMING & WORKERS
+
+gps::ThreadPool workerPool;
+float lastFrameTime = 0.0f;
+double statsStartTime = 0.0;
+float deltaTime = 0.0f;
+
+// per-frame data (draw records, indirect commands, dust positions) goes through this ring
+gps::StreamBuffer frameStream;
+const GLsizeiptr STREAM_FRAME_BYTES = 1 << 20;
 
 // GLOBAL VARIABLES - SPOTLIGHTS
 
-SpotlightCPU spots[3] = {
+// the first SHADOWED_SPOT_COUNT are the pedestal spots, the only ones with shadows; the rest
+// (--test-spots N) hang in a grid under the ceiling to load the clustered light lists
+const int SHADOWED_SPOT_COUNT = 3;
+
+std::vector<SpotlightCPU> spots = {
     {
         glm::vec3(-3.0f, 2.5f, -2.0f),
         glm::vec3(0.0f, -1.0f, 0.0f),
@@ -209,21 +368,114 @@ SpotlightCPU spots[3] = {
     }
 };
 
+int testSpotCount = 0;
+
+// clustered forward shading: per froxel light lists rebuilt every frame on the worker pool,
+// read by basic.frag from buffer textures on units 8-10
+gps::LightClusters lightClusters;
+std::vector<gps::ClusterSpot> clusterSpots;
+
+// GLOBAL VARIABLES - SPOTLIGHT SHADOWS
+
+// every spot gets a tile of one atlas, sized by how much of the screen its cone covers, and
+// kept until the spot or a caster in its cone moves; at most spotShadowBudget tiles are
+// redrawn per frame (--spot-shadow-budget N)
+const GLsizei SPOT_ATLAS_SIZE = 2048;
+const GLsizei SPOT_TILE_MIN = 128;
+const GLsizei SPOT_TILE_MAX = 1024;
+const float SPOT_SHADOW_NEAR = 0.05f;
+const float SPOT_SHADOW_RANGE = 6.0f;      // the spots hang 2.5 m above the floor
+int spotShadowBudget = 1;
+gps::ShadowAtlas spotShadowAtlas;
+gps::ShadowCasterLists spotCasterLists;
+glm::mat4 spotLightSpaces[SHADOWED_SPOT_COUNT];
+
 // GLOBAL VARIABLES - MATRICES & SHADERS
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
 glm::mat3 normalMatrix;
 
-gps::Shader myBasicShader;
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 20.0f;
+
+// every material draws with the variant of its features (surfaceKey), compiled on first use
+gps::ShaderPermutations basicPrograms;
 gps::Shader shadowShader;
+gps::Shader layeredShadowShader;
+
+// GLOBAL VARIABLES - INDIRECT SUBMISSION (GL 4.3+)
+bool useIndirect = false;
+gps::ShaderPermutations indirectPrograms;
+gps::Shader indirectShadowShader;
+
+// optional depth-only pass of the opaque entities (--depth-prepass, F3 toggles); the color
+// pass then shades only the visible fragment of each pixel, testing with GL_EQUAL
+bool useDepthPrepass = false;
+gps::Shader depthPrepassShader;
+gps::Shader indirectDepthPrepassShader;
+
+// deferred path (--deferred): the opaque entities go into a G-buffer and are lit by one full
+// screen pass that shares lighting.glsl with the forward shader; transparents stay forward
+bool useDeferred = false;
+gps::GBuffer gBuffer;
+gps::ShaderPermutations gbufferPrograms;
+gps::ShaderPermutations indirectGbufferPrograms;
+gps::Shader deferredLightShader;
+
+// linked programs from earlier runs (--no-program-cache: always compile from source)
+bool useProgramCache = true;
+gps::ProgramCache programCache;
+
+// fragments shaded by the opaque color pass (the entities the pre-pass covers)
+gps::FragmentCounter shadedFragments;
+gps::IndirectRenderer indirectRenderer;
+uint32_t quadGeometry = 0;
+uint32_t cubeGeometry = 0;
+
+// entity lists of the passes, rebuilt by initDrawLists
+std::vector<gps::EntityId> opaqueEntities;
+std::vector<gps::EntityId> transparentEntities;
+std::vector<gps::EntityId> shadowCasters;
+std::vector<gps::EntityId> staticShadowCasters;
+std::vector<gps::EntityId> dynamicShadowCasters;
+
+// per-light lists over those sets; a light's list is culled again only when its matrix
+// changes or a caster of the set moves
+gps::ShadowCasterLists allCasterLists;
+gps::ShadowCasterLists staticCasterLists;
+gps::ShadowCasterLists dynamicCasterLists;
+
+// GLOBAL VARIABLES - CULLING
+
+enum CullPass {
+    PASS_MAIN,
+    PASS_SUN_SHADOW,
+    PASS_WINDOW_SHADOW,
+    PASS_COUNT
+};
+
+const char* CULL_PASS_NAMES[PASS_COUNT] = { "main", "sun shadow", "window shadow" };
+
+gps::CullingBounds cullBounds;
+std::vector<uint8_t> visibleMask;
+gps::CullStats cullStats[PASS_COUNT];
+
+// walls, pedestals and the big scans hide the rest of the room; tested on the cpu
+bool useOcclusionCulling = true;
+gps::OcclusionCuller occlusionCuller;
+
+// the heavy scans are drawn under hardware occlusion queries of their bounding boxes
+bool useOcclusionQueries = true;
+gps::OcclusionQueries occlusionQueries;
+std::vector<gps::EntityId> queriedEntities;
+
+// what survived culling for the pass being drawn
+std::vector<gps::EntityId> visibleOpaque;
+std::vector<gps::EntityId> visibleTransparent;
+std::vector<gps::EntityId> visibleCasters;
+std::vector<gps::EntityId> visibleQueried;
 
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
 
 glm::vec3 lightDir;
 glm::vec3 lightColor;
@@ -231,19 +483,96 @@ GLfloat angle = 0.0f;
 
 // GLOBAL VARIABLES - SHADOWS
 
-glm::mat4 lightSpaceMatrix;
-GLuint shadowFBO = 0;
-GLuint shadowDepthTex = 0;
-const GLuint SHADOW_SIZE = 2048;
+// every shadow map is a layer of one depth array; a caster is drawn once and the geometry
+// shader fans it out to the layers
+// the sun has CASCADE_COUNT cascades fitted to the camera (layers 0..CASCADE_COUNT-1), the
+// window light one layer fitted to the scene
+const int CASCADE_COUNT = 3;
+
+enum ShadowLayer {
+    SHADOW_LAYER_WINDOW = CASCADE_COUNT,
+    SHADOW_LAYER_COUNT
+};
+
+const unsigned SUN_SHADOW_LAYERS = (1u << CASCADE_COUNT) - 1;
+const unsigned ALL_SHADOW_LAYERS = (1u << SHADOW_LAYER_COUNT) - 1;
+
+// practical split scheme, mostly logarithmic, over the whole camera range
+const float CASCADE_LAMBDA = 0.75f;
+glm::mat4 cascadeMatrices[CASCADE_COUNT];
+float cascadeSplits[CASCADE_COUNT];
 
 glm::mat4 windowLightSpaceMatrix;
-GLuint windowShadowFBO = 0;
-GLuint windowShadowDepthTex = 0;
-const GLuint WINDOW_SHADOW_SIZE = 2048;
+GLuint shadowFBO = 0;
+GLuint shadowArrayTex = 0;
+const GLuint SHADOW_SIZE = 1024;
+
+// world bounds of everything drawn: the window light's box and the cascades' fallback extent
+gps::AABB shadowSceneBounds;
+
+// per entity, the active layers whose light sees it this pass
+std::vector<uint8_t> casterMask;
+
+// static casters are drawn once into a cached array; a frame copies it and adds the moving ones
+bool useShadowCache = true;
+gps::ShadowCache shadowCache;
+
+// the window light's layer may be refreshed only every N frames (needs the cache)
+int windowShadowInterval = 1;
+unsigned windowShadowFrame = 0;
+
+// shadow filter of basic.frag (SHADOW_KERNEL_*): one bilinear compare, four gathers (default)
+// or a rotated 12 tap Poisson disk
+enum ShadowKernel {
+    SHADOW_KERNEL_1TAP,
+    SHADOW_KERNEL_GATHER,
+    SHADOW_KERNEL_POISSON
+};
+
+int shadowKernel = SHADOW_KERNEL_GATHER;
+
+// prefiltered alternative (--evsm): every refreshed layer is turned into blurred, mipmapped
+// EVSM moments once, and a fragment does one filtered fetch instead of a PCF kernel
+bool useMomentShadows = false;
+gps::ShadowMoments shadowMoments;
 
 glm::vec3 windowLightDir = glm::normalize(glm::vec3(0.0f, -0.2f, 1.0f));
 glm::vec3 windowLightColor = glm::vec3(0.6f, 0.7f, 0.9f);
 
+// GLOBAL VARIABLES - LIGHTMAP
+
+// the pedestal spots and the bounced light of every light, baked once for the static quads and
+// cubes (--bake-lightmap) and loaded from LIGHTMAP_FILE on later runs; --no-lightmap skips it
+bool bakeLightmap = false;
+bool useLightmap = true;
+gps::LightmapBaker lightmapBaker;
+GLuint lightmapTexture = 0;
+const GLuint LIGHTMAP_UNIT = 15;
+const char* const LIGHTMAP_FILE = "lightmap.bin";
+
+// per entity, its chart in the lightmap; -1 for the dynamically lit ones
+std::vector<int32_t> entityChart;
+
+// GLOBAL VARIABLES - PICKING
+
+// ray casts against the triangles of the scene: a BVH over the entities' boxes, one triangle
+// BVH per model; the left button selects what the middle of the screen points at (the cursor
+// is captured for mouse look), Q/E turn the selection if it is a statue or the person
+gps::ScenePicker picker;
+gps::EntityId selectedEntity = gps::NO_ENTITY;
+float statueTurn[3] = { 0.0f, 0.0f, 0.0f };     // degrees added to each statue's spin
+
+// GLOBAL VARIABLES - COLLISION
+
+// the static entities as boxes and triangles in a spatial hash; the camera and the person are
+// upright capsules swept through it, kept off the floor by STEP_HEIGHT
+gps::CollisionWorld collisionWorld;
+const float STEP_HEIGHT = 0.3f;
+const float CAMERA_EYE_HEIGHT = 1.6f;
+const float CAMERA_RADIUS = 0.35f;
+const float PERSON_HEIGHT = 1.8f;
+const float PERSON_RADIUS = 0.4f;
+
 // GLOBAL VARIABLES - FOG
 
 float fogDensity = 0.05f;
@@ -277,19 +606,11 @@ GLenum glCheckError_(const char* file, int line) {
     return errorCode;
 }
 
-void setAnisotropy(GLuint texId) {
-    glBindTexture(GL_TEXTURE_2D, texId);
-    if (GLEW_EXT_texture_filter_anisotropic) {
-        float maxA = 0.0f;
-        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxA);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxA);
-    }
-}
-
 // INITIALIZATION FUNCTIONS
 
 void initOpenGLWindow() {
     myWindow.Create(1024, 768, "OpenGL Project Core");
+    useIndirect = useIndirect && myWindow.hasGLVersion(4, 3);
 }
 
 void initOpenGLState() {
@@ -300,41 +621,91 @@ void initOpenGLState() {
     glEnable(GL_FRAMEBUFFER_SRGB);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
+
+    frameStream.init(STREAM_FRAME_BYTES);
+
+    // the programs are issued up front and compiled by the driver's threads while the
+    // textures load; whatever the cache has is not compiled at all
+    if (useProgramCache) {
+        programCache.init("shader_cache");
+        gps::Shader::setProgramCache(&programCache);
+    }
+    gps::Shader::enableParallelCompile();
 }
 
 void initShaders() {
-    myBasicShader.loadShader("shaders/basic.vert", "shaders/basic.frag");
+    // a new variant gets its material slots and this frame's uniforms right away
+    auto setupSurfaceProgram = [](gps::Shader& shader) {
+        gps::MaterialLibrary::setupProgram(shader.shaderProgram);
+        uploadFrameUniforms(shader);
+    };
+
+    basicPrograms.init("shaders/basic.vert", "shaders/basic.frag", SURFACE_FEATURE_DEFINES, setupSurfaceProgram);
     shadowShader.loadShader("shaders/shadow_depth.vert", "shaders/shadow_depth.frag");
-}
+    layeredShadowShader.loadShader("shaders/shadow_layered.vert", "shaders/shadow_layered.geom",
+        "shaders/shadow_depth.frag", {});
+    dustShader.loadShader("shaders/dust.vert", "shaders/dust.frag");
+    depthPrepassShader.loadShader("shaders/depth_prepass.vert", "shaders/shadow_depth.frag");
+
+    if (useGpuInstanceCulling) {
+        if (dustCuller.getPath() == gps::InstanceCuller::PATH_ATOMIC_INDIRECT)
+            dustCulledShader.loadShader("shaders/dust_indirect.vert", "shaders/dust.frag");
+        else
+            dustCulledShader.loadShader("shaders/dust_culled.vert", "shaders/dust_culled.geom", "shaders/dust.frag", {});
+    }
 
-void initUniforms() {
-    myBasicShader.useShaderProgram();
+    if (useIndirect) {
+        indirectPrograms.init("shaders/basic_indirect.vert", "shaders/basic.frag", SURFACE_FEATURE_DEFINES, setupSurfaceProgram);
+        indirectShadowShader.loadShader("shaders/shadow_layered_indirect.vert", "shaders/shadow_layered.geom",
+            "shaders/shadow_depth.frag", {});
+        indirectDepthPrepassShader.loadShader("shaders/depth_prepass_indirect.vert", "shaders/shadow_depth.frag");
+    }
+
+    if (useDeferred) {
+        gbufferPrograms.init("shaders/basic.vert", "shaders/gbuffer.frag", SURFACE_FEATURE_DEFINES, setupSurfaceProgram);
+        deferredLightShader.loadShader("shaders/fullscreen.vert", "shaders/deferred_light.frag");
+        if (useIndirect)
+            indirectGbufferPrograms.init("shaders/basic_indirect.vert", "shaders/gbuffer.frag", SURFACE_FEATURE_DEFINES, setupSurfaceProgram);
+    }
+}
 
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
+// issues the variant of every material in each surface program set in use, so they build
+// side by side instead of one by one as the first frames meet them
+void prepareSurfacePrograms() {
+    gps::ShaderPermutations* sets[] = { &basicPrograms,
+        useIndirect ? &indirectPrograms : nullptr,
+        useDeferred ? &gbufferPrograms : nullptr,
+        useDeferred && useIndirect ? &indirectGbufferPrograms : nullptr };
+
+    for (gps::ShaderPermutations* programs : sets) {
+        if (!programs)
+            continue;
+        programs->setOptionalFeatures(SURFACE_OPTIONAL_FEATURES);
+        for (uint32_t material = 0; material < (uint32_t)materialFeatures.size(); material++)
+            programs->prepare(surfaceKey(material));
+    }
+}
 
+// the surface programs get these with the rest of the frame uniforms (uploadFrameUniforms)
+void initUniforms() {
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::scale(model, glm::vec3(0.3f));
     model = glm::rotate(model, glm::radians(angle), glm::vec3(0, 1, 0));
 
     view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
-        0.1f, 20.0f);
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        CAMERA_NEAR, CAMERA_FAR);
+    lightClusters.setProjection(projection, CAMERA_NEAR, CAMERA_FAR);
 
     lightDir = glm::normalize(glm::vec3(-1.0f, 1.0f, 0.3f));
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
-
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+
+    if (useDeferred) {
+        gBuffer.init(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    }
 }
 
 void initModels() {
@@ -349,21 +720,13 @@ void initModels() {
 }
 
 void initQuad() {
-    float quadVertices[] = {
-        -0.5f, 0.0f, -0.5f,  0, 1, 0,  0, 0,
-         0.5f, 0.0f, -0.5f,  0, 1, 0,  1, 0,
-         0.5f, 0.0f,  0.5f,  0, 1, 0,  1, 1,
-        -0.5f, 0.0f, -0.5f,  0, 1, 0,  0, 0,
-         0.5f, 0.0f,  0.5f,  0, 1, 0,  1, 1,
-        -0.5f, 0.0f,  0.5f,  0, 1, 0,  0, 1
-    };
 
     glGenVertexArrays(1, &quadVAO);
     glGenBuffers(1, &quadVBO);
 
     glBindVertexArray(quadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD_VERTICES), QUAD_VERTICES, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -375,60 +738,19 @@ void initQuad() {
     glEnableVertexAttribArray(2);
 
     glBindVertexArray(0);
+
+    if (useIndirect)
+        quadGeometry = addIndirectPrimitive(QUAD_VERTICES, 6);
 }
 
 void initCube() {
-    float v[] = {
-        // +X
-        0.5f, -0.5f, -0.5f,  1, 0, 0,  0, 0,
-        0.5f, -0.5f,  0.5f,  1, 0, 0,  1, 0,
-        0.5f,  0.5f,  0.5f,  1, 0, 0,  1, 1,
-        0.5f, -0.5f, -0.5f,  1, 0, 0,  0, 0,
-        0.5f,  0.5f,  0.5f,  1, 0, 0,  1, 1,
-        0.5f,  0.5f, -0.5f,  1, 0, 0,  0, 1,
-        // -X
-        -0.5f, -0.5f,  0.5f,  -1, 0, 0,  0, 0,
-        -0.5f, -0.5f, -0.5f,  -1, 0, 0,  1, 0,
-        -0.5f,  0.5f, -0.5f,  -1, 0, 0,  1, 1,
-        -0.5f, -0.5f,  0.5f,  -1, 0, 0,  0, 0,
-        -0.5f,  0.5f, -0.5f,  -1, 0, 0,  1, 1,
-        -0.5f,  0.5f,  0.5f,  -1, 0, 0,  0, 1,
-        // +Y
-        -0.5f,  0.5f, -0.5f,  0, 1, 0,  0, 0,
-         0.5f,  0.5f, -0.5f,  0, 1, 0,  1, 0,
-         0.5f,  0.5f,  0.5f,  0, 1, 0,  1, 1,
-        -0.5f,  0.5f, -0.5f,  0, 1, 0,  0, 0,
-         0.5f,  0.5f,  0.5f,  0, 1, 0,  1, 1,
-        -0.5f,  0.5f,  0.5f,  0, 1, 0,  0, 1,
-        // -Y
-        -0.5f, -0.5f,  0.5f,  0, -1, 0,  0, 0,
-         0.5f, -0.5f,  0.5f,  0, -1, 0,  1, 0,
-         0.5f, -0.5f, -0.5f,  0, -1, 0,  1, 1,
-        -0.5f, -0.5f,  0.5f,  0, -1, 0,  0, 0,
-         0.5f, -0.5f, -0.5f,  0, -1, 0,  1, 1,
-        -0.5f, -0.5f, -0.5f,  0, -1, 0,  0, 1,
-        // +Z
-        -0.5f, -0.5f,  0.5f,  0, 0, 1,  0, 0,
-        -0.5f,  0.5f,  0.5f,  0, 0, 1,  0, 1,
-         0.5f,  0.5f,  0.5f,  0, 0, 1,  1, 1,
-        -0.5f, -0.5f,  0.5f,  0, 0, 1,  0, 0,
-         0.5f,  0.5f,  0.5f,  0, 0, 1,  1, 1,
-         0.5f, -0.5f,  0.5f,  0, 0, 1,  1, 0,
-         // -Z
-          0.5f, -0.5f, -0.5f,  0, 0, -1,  0, 0,
-          0.5f,  0.5f, -0.5f,  0, 0, -1,  0, 1,
-         -0.5f,  0.5f, -0.5f,  0, 0, -1,  1, 1,
-          0.5f, -0.5f, -0.5f,  0, 0, -1,  0, 0,
-         -0.5f,  0.5f, -0.5f,  0, 0, -1,  1, 1,
-         -0.5f, -0.5f, -0.5f,  0, 0, -1,  1, 0
-    };
 
     glGenVertexArrays(1, &cubeVAO);
     glGenBuffers(1, &cubeVBO);
 
     glBindVertexArray(cubeVAO);
     glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_VERTICES), CUBE_VERTICES, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -440,407 +762,872 @@ void initCube() {
     glEnableVertexAttribArray(2);
 
     glBindVertexArray(0);
+
+    if (useIndirect)
+        cubeGeometry = addIndirectPrimitive(CUBE_VERTICES, 36);
+}
+
+// interleaved pos/normal/uv floats (the layout of gps::Vertex) into the shared indirect buffers
+uint32_t addIndirectPrimitive(const float* v, int vertexCount) {
+    std::vector<gps::Vertex> vertices(vertexCount);
+    std::vector<GLuint> indices(vertexCount);
+    for (int i = 0; i < vertexCount; i++) {
+        const float* p = v + i * 8;
+        vertices[i].Position = glm::vec3(p[0], p[1], p[2]);
+        vertices[i].Normal = glm::vec3(p[3], p[4], p[5]);
+        vertices[i].TexCoords = glm::vec2(p[6], p[7]);
+        indices[i] = (GLuint)i;
+    }
+    return indirectRenderer.addGeometry(vertices, indices);
 }
 
 void initShadowMap() {
     glGenFramebuffers(1, &shadowFBO);
 
-    glGenTextures(1, &shadowDepthTex);
-    glBindTexture(GL_TEXTURE_2D, shadowDepthTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_SIZE, SHADOW_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    // compared in hardware: basic.frag samples it as a sampler2DArrayShadow, and linear
+    // filtering makes every fetch a bilinear 2x2 PCF
+    glGenTextures(1, &shadowArrayTex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowArrayTex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+        SHADOW_SIZE, SHADOW_SIZE, SHADOW_LAYER_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     float border[] = { 1, 1, 1, 1 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
 
+    // layered attachment: gl_Layer in the geometry shader picks the light
     glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowDepthTex, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowArrayTex, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void initWindowShadowMap() {
-    glGenFramebuffers(1, &windowShadowFBO);
 
-    glGenTextures(1, &windowShadowDepthTex);
-    glBindTexture(GL_TEXTURE_2D, windowShadowDepthTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        WINDOW_SHADOW_SIZE, WINDOW_SHADOW_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float border[] = { 1, 1, 1, 1 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+    shadowCache.init(SHADOW_SIZE, SHADOW_LAYER_COUNT);
+    if (useMomentShadows)
+        shadowMoments.init(SHADOW_SIZE, SHADOW_LAYER_COUNT);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, windowShadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, windowShadowDepthTex, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    spotShadowAtlas.init(SPOT_ATLAS_SIZE, SPOT_TILE_MIN, SPOT_TILE_MAX, SHADOWED_SPOT_COUNT);
+    shadedFragments.init();
 }
 
 void initDust() {
-    for (int i = 0; i < NUM_MOTES; i++) {
-        DustMote m;
-        m.position = glm::vec3(
-            ((rand() % 100) / 10.0f) - 5.0f,
-            ((rand() % 40) / 10.0f),
-            ((rand() % 100) / 10.0f) - 8.0f
-        );
-        m.speed = ((rand() % 100) / 2000.0f) + 0.005f;
-        m.phase = (rand() % 100) / 10.0f;
-        motes.push_back(m);
-    }
-}
+    // same volume and speeds the per-frame motes used, expressed per second (60 Hz reference)
+    gps::ParticleEmitter e;
+    e.boxMin = glm::vec3(-5.0f, 0.0f, -8.0f);
+    e.boxMax = glm::vec3(5.0f, 4.0f, 2.0f);
+    e.respawnOnTop = true;
+    e.velocityMin = glm::vec3(0.0f, -3.3f, 0.0f);
+    e.velocityMax = glm::vec3(0.0f, -0.3f, 0.0f);
+    e.lifeMin = 20.0f;
+    e.lifeMax = 40.0f;
+    e.swayAmplitude = 0.06f;
+    e.swayFrequency = 1.0f;
+    e.floorY = 0.0f;
+
+    dust.init(NUM_MOTES, e, (uint32_t)rand());
+
+    // the unit quad per mote, instanced; the per-mote x/y/z attributes are
+    // pointed at this frame's slice of the stream buffer in renderDust
+    glGenVertexArrays(1, &dustVAO);
+    glBindVertexArray(dustVAO);
 
-void setWindowCallbacks() {
-    glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
-    glfwSetKeyCallback(myWindow.getWindow(), keyboardCallback);
-    glfwSetCursorPosCallback(myWindow.getWindow(), mouseCallback);
-}
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
 
-// INPUT & CALLBACK FUNCTIONS
+    for (GLuint loc = 1; loc <= 3; loc++) {
+        glEnableVertexAttribArray(loc);
+        glVertexAttribDivisor(loc, 1);
+    }
 
-void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
-    if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
-        gFlat = 1 - gFlat;
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    if (key >= 0 && key < 1024) {
-        if (action == GLFW_PRESS)
-            pressedKeys[key] = true;
-        else if (action == GLFW_RELEASE)
-            pressedKeys[key] = false;
-    }
+    if (useGpuInstanceCulling)
+        dustCuller.init(NUM_MOTES, myWindow.hasGLVersion(4, 3), quadVBO, 8 * sizeof(float), 6);
+}
 
-    if (action == GLFW_PRESS) {
-        if (key == GLFW_KEY_F1) {
-            gWireframe = !gWireframe;
-            glPolygonMode(GL_FRONT_AND_BACK, gWireframe ? GL_LINE : GL_FILL);
-        }
-    }
+void initMaterials() {
+    const glm::vec2 WIN_UV_MIN(0.14648f, 0.24707f);
+    const glm::vec2 WIN_UV_MAX(0.85254f, 0.75195f);
 
-    if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-        if (key == GLFW_KEY_LEFT)
-            personYaw += 3.0f;
-        if (key == GLFW_KEY_RIGHT)
-            personYaw -= 3.0f;
+    materials.init();
 
-        float speed = 0.1f;
-        if (key == GLFW_KEY_UP) {
-            personPos.x += sin(glm::radians(personYaw)) * speed;
-            personPos.z += cos(glm::radians(personYaw)) * speed;
-        }
-        if (key == GLFW_KEY_DOWN) {
-            personPos.x -= sin(glm::radians(personYaw)) * speed;
-            personPos.z -= cos(glm::radians(personYaw)) * speed;
-        }
+    gps::SamplerDesc repeatAniso;
+    repeatAniso.anisotropic = true;
+    gps::SamplerDesc clamp;
+    clamp.wrap = GL_CLAMP_TO_EDGE;
 
-        if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
-            personAnimate = !personAnimate;
-    }
+    auto setSamplers = [](gps::Material& m, const gps::SamplerDesc& s) {
+        for (int i = 0; i < gps::MATERIAL_SLOT_COUNT; i++)
+            m.samplers[i] = s;
+        };
 
-    if (action == GLFW_RELEASE)
-        pressedKeys[key] = false;
+    gps::Material modelDefault;
+
+    gps::Material floor;
+    floor.textures[gps::SLOT_DIFFUSE] = floorDiffuse;
+    floor.textures[gps::SLOT_SPECULAR] = floorSpecular;
+    floor.textures[gps::SLOT_ROUGHNESS] = floorRoughness;
+    floor.textures[gps::SLOT_NORMAL] = floorNormal;
+    floor.samplers[gps::SLOT_DIFFUSE] = repeatAniso;
+    floor.params.uvTiling = glm::vec2(6.0f, 6.0f);
+
+    gps::Material wall;
+    wall.textures[gps::SLOT_DIFFUSE] = wallDiffuse;
+    wall.textures[gps::SLOT_SPECULAR] = wallSpecular;
+    wall.textures[gps::SLOT_ROUGHNESS] = wallRoughness;
+    wall.textures[gps::SLOT_NORMAL] = wallNormal;
+    wall.samplers[gps::SLOT_DIFFUSE] = repeatAniso;
+    wall.params.uvTiling = glm::vec2(4.0f, 2.0f);
+
+    gps::Material wallPlain = wall;
+    wallPlain.params.uvTiling = glm::vec2(1.0f);
+
+    gps::Material sky;
+    sky.textures[gps::SLOT_DIFFUSE] = outsideTex;
+    setSamplers(sky, clamp);
+    sky.params.isOutside = 1;
+
+    gps::Material glass;
+    glass.textures[gps::SLOT_DIFFUSE] = glassDiffuse;
+    glass.textures[gps::SLOT_SPECULAR] = glassSpec;
+    glass.textures[gps::SLOT_ROUGHNESS] = glassRough;
+    glass.textures[gps::SLOT_NORMAL] = glassNormal;
+    glass.textures[gps::SLOT_OPACITY] = glassOpacity;
+    glass.samplers[gps::SLOT_DIFFUSE] = clamp;
+    glass.samplers[gps::SLOT_DIFFUSE].anisotropic = true;
+    glass.samplers[gps::SLOT_NORMAL] = clamp;
+    glass.samplers[gps::SLOT_OPACITY] = clamp;
+    glass.samplers[gps::SLOT_OPACITY].minFilter = GL_NEAREST;
+    glass.samplers[gps::SLOT_OPACITY].magFilter = GL_NEAREST;
+    glass.params.uvMin = WIN_UV_MIN;
+    glass.params.uvMax = WIN_UV_MAX;
+    glass.params.isGlass = 1;
+    glass.params.glassFactor = 0.4f;
+    glass.alphaTested = true;
+
+    const gps::Material* table[MAT_COUNT] = { &modelDefault, &floor, &wall, &wallPlain, &sky, &glass };
+    for (uint32_t i = 0; i < MAT_COUNT; i++)
+        materials.create(*table[i]);
+
+    // every mesh of every model gets its own material from its .mtl entry
+    gps::Model3D* models[] = { &statueAntonius, &statueJudas, &statueKrieger,
+        &egyptDoor, &museumEntrance, &horrorPainting, &person };
+    for (gps::Model3D* m : models) {
+        for (gps::Mesh& mesh : m->getMeshes())
+            mesh.materialId = materials.create(mesh.material);
+    }
 
-    myBasicShader.useShaderProgram();
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "useFlatShading"), gFlat);
+    // the shader features each material needs, resolved once instead of branched on per pixel
+    materialFeatures.resize(materials.size());
+    for (uint32_t id = 0; id < (uint32_t)materials.size(); id++) {
+        const gps::Material& m = materials.get(id);
+        uint32_t features = 0;
+        if (m.params.useNormalMap)
+            features |= FEATURE_NORMAL_MAP;
+        if (m.alphaTested)
+            features |= FEATURE_ALPHA_TEST;
+        if (m.params.isGlass)
+            features |= FEATURE_GLASS;
+        if (m.params.useOpacityMap)
+            features |= FEATURE_OPACITY_MAP;
+        if (m.params.isOutside)
+            features |= FEATURE_SKY;
+        materialFeatures[id] = features;
+    }
 }
 
-void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
-    if (firstMouse) {
-        lastX = xpos;
-        lastY = ypos;
-        firstMouse = false;
-    }
+void initScene() {
+    const float W = ROOM_W, D = ROOM_D, H = ROOM_H;
+    const gps::MeshRef quad = { gps::MESH_QUAD, nullptr };
+    const gps::MeshRef cube = { gps::MESH_CUBE, nullptr };
+    const gps::MeshRef none = { gps::MESH_NONE, nullptr };
+    const uint32_t STATIC = gps::ENTITY_VISIBLE;
+    const uint32_t CASTER = gps::ENTITY_VISIBLE | gps::ENTITY_CAST_SHADOW;
+    const uint32_t OCCLUDER = gps::ENTITY_OCCLUDER;
+    const uint32_t QUERIED = gps::ENTITY_QUERIED;
 
-    float xoffset = float(xpos - lastX);
-    float yoffset = float(lastY - ypos);
+    auto model = [](gps::Model3D& m) { return gps::MeshRef{ gps::MESH_MODEL, &m }; };
 
-    lastX = xpos;
-    lastY = ypos;
+    gps::EntityId room = scene.addEntity("room", none, MAT_MODEL, glm::mat4(1.0f), STATIC);
 
-    float sensitivity = 0.08f;
-    xoffset *= sensitivity;
-    yoffset *= sensitivity;
+    // Floor (the only room surface in the shadow maps; walls and ceiling would block both lights)
+    {
+        glm::mat4 M = glm::scale(glm::mat4(1.0f), glm::vec3(W, 1.0f, D));
+        scene.addEntity("floor", quad, MAT_FLOOR, M, CASTER, room);
+    }
 
-    yaw += xoffset;
-    pitch += yoffset;
-    pitch = std::clamp(pitch, -89.0f, 89.0f);
+    // Ceiling
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(0.0f, H, 0.0f));
+        M = glm::rotate(M, glm::radians(180.0f), glm::vec3(1, 0, 0));
+        M = glm::scale(M, glm::vec3(W, 1.0f, D));
+        scene.addEntity("ceiling", quad, MAT_WALL, M, STATIC, room);
+    }
 
-    myCamera.rotate(pitch, yaw);
-    view = myCamera.getViewMatrix();
+    // Front wall
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(0.0f, H * 0.5f, D * 0.5f));
+        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(1, 0, 0));
+        M = glm::scale(M, glm::vec3(W, 1.0f, H));
+        scene.addEntity("wall_front", quad, MAT_WALL, M, STATIC | OCCLUDER, room);
+    }
 
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-}
+    // Left wall
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(-W * 0.5f, H * 0.5f, 0.0f));
+        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(0, 0, 1));
+        M = glm::scale(M, glm::vec3(H, 1.0f, D));
+        scene.addEntity("wall_left", quad, MAT_WALL, M, STATIC | OCCLUDER, room);
+    }
 
-void windowResizeCallback(GLFWwindow* window, int width, int height) {
-    fprintf(stdout, "Window resized! New width: %d, height: %d\n", width, height);
+    // Right wall
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(W * 0.5f, H * 0.5f, 0.0f));
+        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(0, 0, 1));
+        M = glm::scale(M, glm::vec3(H, 1.0f, D));
+        scene.addEntity("wall_right", quad, MAT_WALL, M, STATIC | OCCLUDER, room);
+    }
 
-    glViewport(0, 0, width, height);
-    projection = glm::perspective(glm::radians(45.0f),
-        (float)width / (float)height, 0.1f, 20.0f);
+    // Back wall with window hole
+    float zBack = -D * 0.5f;
+    float winW = 4.5f;
+    float winH = 2.2f;
+    float winBottom = 1.2f;
+    float winTop = winBottom + winH;
 
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-}
+    auto backPiece = [&](const char* name, float xCenter, float yCenter, float xSize, float ySize) {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(xCenter, yCenter, zBack));
+        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
+        M = glm::scale(M, glm::vec3(xSize, 1.0f, ySize));
+        scene.addEntity(name, quad, MAT_WALL, M, STATIC | OCCLUDER, room);
+        };
 
-void processMovement() {
-    bool moved = false;
+    float sideW = (W - winW) * 0.5f;
+    backPiece("wall_back_left", -W * 0.5f + sideW * 0.5f, H * 0.5f, sideW, H);
+    backPiece("wall_back_right", W * 0.5f - sideW * 0.5f, H * 0.5f, sideW, H);
+    backPiece("wall_back_bottom", 0.0f, winBottom * 0.5f, winW, winBottom);
+    backPiece("wall_back_top", 0.0f, (winTop + H) * 0.5f, winW, (H - winTop));
 
-    if (pressedKeys[GLFW_KEY_W]) {
-        myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
-        moved = true;
-    }
-    if (pressedKeys[GLFW_KEY_S]) {
-        myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
-        moved = true;
-    }
-    if (pressedKeys[GLFW_KEY_A]) {
-        myCamera.move(gps::MOVE_LEFT, cameraSpeed);
-        moved = true;
-    }
-    if (pressedKeys[GLFW_KEY_D]) {
-        myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
-        moved = true;
+    // Sky background
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(0.0f, winBottom + winH * 0.5f, zBack - 0.5f));
+        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
+        M = glm::scale(M, glm::vec3(winW * 1.2f, 1.0f, winH * 1.2f));
+        scene.addEntity("sky", quad, MAT_SKY, M, STATIC, room);
     }
 
-    if (moved) {
-        clampCameraInsideRoom();
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    // Window pane (transparent)
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(0.0f, winBottom + winH * 0.5f, zBack + 0.01f));
+        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
+        M = glm::scale(M, glm::vec3(winW, 1.0f, winH));
+        scene.addEntity("window_glass", quad, MAT_GLASS, M, STATIC | gps::ENTITY_TRANSPARENT, room);
     }
 
-    if (pressedKeys[GLFW_KEY_Q]) {
-        angle -= 1.0f;
-        model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    }
-    if (pressedKeys[GLFW_KEY_E]) {
-        angle += 1.0f;
-        model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    // Lamp fixtures above the spotlights
+    for (int i = 0; i < SHADOWED_SPOT_COUNT; i++) {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, spots[i].position + glm::vec3(0.0f, H - spots[i].position.y - 0.1f, 0.0f));
+        M = glm::scale(M, glm::vec3(0.4f, 0.05f, 0.4f));
+        scene.addEntity("lamp_" + std::to_string(i), cube, MAT_WALL_PLAIN, M, CASTER, room);
     }
-}
-
-void clampCameraInsideRoom() {
-    const float W = 12.0f, D = 16.0f;
-    const float margin = 0.35f;
-    glm::vec3 p = myCamera.getPosition();
-
-    p.x = std::clamp(p.x, -W * 0.5f + margin, W * 0.5f - margin);
-    p.z = std::clamp(p.z, -D * 0.5f + margin, D * 0.5f - margin);
-    p.y = 1.6f;
 
+    // Exhibits: a group node per pedestal, the statue is animated relative to it
     glm::vec3 objPos[3] = {
         glm::vec3(-3.0f, 0.0f, -2.0f),
         glm::vec3(2.0f, 0.0f, -2.0f),
         glm::vec3(4.0f, 0.0f, -2.0f)
     };
+    gps::Model3D* statues[3] = { &statueAntonius, &statueJudas, &statueKrieger };
 
-    float hSize = 0.45f + margin;
+    glm::vec3 pedestalScale(0.9f, 1.2f, 0.9f);
+    float pedestalCenterY = 0.6f;
 
     for (int i = 0; i < 3; i++) {
-        float dx = p.x - objPos[i].x;
-        float dz = p.z - objPos[i].z;
+        std::string n = std::to_string(i);
+        gps::EntityId exhibit = scene.addEntity("exhibit_" + n, none, MAT_MODEL,
+            glm::translate(glm::mat4(1.0f), objPos[i]), STATIC, room);
 
-        if (std::abs(dx) < hSize && std::abs(dz) < hSize) {
-            if (std::abs(dx) > std::abs(dz)) {
-                p.x = objPos[i].x + (dx > 0 ? hSize : -hSize);
-            }
-            else {
-                p.z = objPos[i].z + (dz > 0 ? hSize : -hSize);
-            }
-        }
+        glm::mat4 P(1.0f);
+        P = glm::translate(P, glm::vec3(0.0f, pedestalCenterY, 0.0f));
+        P = glm::scale(P, pedestalScale);
+        scene.addEntity("pedestal_" + n, cube, MAT_WALL_PLAIN, P, CASTER | OCCLUDER, exhibit);
+
+        statueIds[i] = scene.addEntity("statue_" + n, model(*statues[i]), MAT_MODEL,
+            glm::mat4(1.0f), CASTER | gps::ENTITY_DYNAMIC, exhibit);
     }
 
-    myCamera.setPosition(p);
+    const float wallOffset = 0.3f;
+
+    // Egyptian door
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(W * 0.5f - wallOffset, 1.5f, 2.0f));
+        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(0, 1, 0));
+        M = glm::scale(M, glm::vec3(4.0f));
+        scene.addEntity("egypt_door", model(egyptDoor), MAT_MODEL, M, CASTER | OCCLUDER | QUERIED, room);
+    }
+
+    // Museum entrance
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(-2.0f, 0.8f, D * 0.5f - 1.5));
+        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(1, 0, 0));
+        M = glm::rotate(M, glm::radians(180.0f), glm::vec3(0, 0, 1));
+        M = glm::scale(M, glm::vec3(0.1f));
+        scene.addEntity("museum_entrance", model(museumEntrance), MAT_MODEL, M, CASTER | OCCLUDER | QUERIED, room);
+    }
+
+    // Horror painting
+    {
+        glm::mat4 M(1.0f);
+        M = glm::translate(M, glm::vec3(-W * 0.5f + wallOffset, 1.3f, 0.0f));
+        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(0, 1, 0));
+        M = glm::scale(M, glm::vec3(0.2f));
+        scene.addEntity("horror_painting", model(horrorPainting), MAT_MODEL, M, CASTER | QUERIED, room);
+    }
+
+    personId = scene.addEntity("person", model(person), MAT_MODEL, glm::mat4(1.0f),
+        CASTER | gps::ENTITY_DYNAMIC);
+
+    animateScene();
 }
 
-void clampPersonInsideRoom() {
-    const float W = 12.0f, D = 16.0f;
-    const float pMargin = 0.5f;
+void initDrawLists() {
+    opaqueEntities.clear();
+    transparentEntities.clear();
+    shadowCasters.clear();
+    staticShadowCasters.clear();
+    dynamicShadowCasters.clear();
+    queriedEntities.clear();
+    shadowSceneBounds = gps::AABB();
+
+    for (gps::EntityId id = 0; id < (gps::EntityId)scene.size(); id++) {
+        if (scene.meshes[id].kind == gps::MESH_NONE || !scene.hasFlags(id, gps::ENTITY_VISIBLE))
+            continue;
+
+        if (scene.worldBounds[id].isValid())
+            shadowSceneBounds.expand(scene.worldBounds[id]);
+
+        if (scene.hasFlags(id, gps::ENTITY_TRANSPARENT))
+            transparentEntities.push_back(id);
+        else if (useOcclusionQueries && scene.hasFlags(id, gps::ENTITY_QUERIED))
+            queriedEntities.push_back(id);
+        else
+            opaqueEntities.push_back(id);
+
+        if (scene.hasFlags(id, gps::ENTITY_CAST_SHADOW)) {
+            shadowCasters.push_back(id);
+            if (scene.hasFlags(id, gps::ENTITY_DYNAMIC))
+                dynamicShadowCasters.push_back(id);
+            else
+                staticShadowCasters.push_back(id);
+        }
+    }
 
-    personPos.x = std::clamp(personPos.x, -W * 0.5f + pMargin, W * 0.5f - pMargin);
-    personPos.z = std::clamp(personPos.z, -D * 0.5f + pMargin, D * 0.5f - pMargin);
-    personPos.y = 0.0f;
+    allCasterLists.init(shadowCasters, scene.size(), SHADOW_LAYER_COUNT);
+    staticCasterLists.init(staticShadowCasters, scene.size(), SHADOW_LAYER_COUNT);
+    dynamicCasterLists.init(dynamicShadowCasters, scene.size(), SHADOW_LAYER_COUNT);
+    spotCasterLists.init(shadowCasters, scene.size(), SHADOWED_SPOT_COUNT);
 
-    glm::vec3 objPos[3] = {
-        glm::vec3(-3.0f, 0.0f, -2.0f),
-        glm::vec3(2.0f, 0.0f, -2.0f),
-        glm::vec3(4.0f, 0.0f, -2.0f)
-    };
+    occlusionCuller.build(scene);
+    if (useOcclusionQueries)
+        occlusionQueries.init(scene, myWindow.hasGLVersion(4, 3) || GLEW_ARB_ES3_compatibility);
 
-    float hSize = 0.45f + pMargin;
+    if (useIndirect) {
+        indirectRenderer.build(scene, materials, quadGeometry, cubeGeometry, &frameStream);
+        std::cout << "Indirect path: " << indirectRenderer.getDrawCount() << " draws, "
+            << materials.getBindGroupCount() << " material bind groups" << std::endl;
+    }
+}
 
-    for (int i = 0; i < 3; i++) {
-        float dx = personPos.x - objPos[i].x;
-        float dz = personPos.z - objPos[i].z;
+// LIGHTMAP
+
+// the world space faces of a quad/cube mesh (6 vertices of QUAD_VERTICES/CUBE_VERTICES layout
+// per face): the texture coordinate to position map solved from each face's first triangle
+std::vector<gps::LightmapFace> lightmapFaces(const float* v, int faceCount, const glm::mat4& M) {
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(M));
+    std::vector<gps::LightmapFace> faces(faceCount);
+
+    for (int f = 0; f < faceCount; f++) {
+        const float* a = v + f * 48;
+        const float* b = a + 8;
+        const float* c = a + 16;
+        glm::vec3 p0(a[0], a[1], a[2]);
+        glm::vec2 t0(a[6], a[7]);
+        glm::vec3 dp1 = glm::vec3(b[0], b[1], b[2]) - p0, dp2 = glm::vec3(c[0], c[1], c[2]) - p0;
+        glm::vec2 dt1 = glm::vec2(b[6], b[7]) - t0, dt2 = glm::vec2(c[6], c[7]) - t0;
+
+        float det = dt1.x * dt2.y - dt2.x * dt1.y;
+        glm::vec3 axisS = (dp1 * dt2.y - dp2 * dt1.y) / det;
+        glm::vec3 axisT = (dp2 * dt1.x - dp1 * dt2.x) / det;
+        glm::vec3 origin = p0 - t0.x * axisS - t0.y * axisT;
+
+        faces[f].origin = glm::vec3(M * glm::vec4(origin, 1.0f));
+        faces[f].axisS = glm::mat3(M) * axisS;
+        faces[f].axisT = glm::mat3(M) * axisT;
+        faces[f].normal = glm::normalize(normalMatrix * glm::vec3(a[3], a[4], a[5]));
+    }
+    return faces;
+}
 
-        if (std::abs(dx) < hSize && std::abs(dz) < hSize) {
-            if (std::abs(dx) > std::abs(dz)) {
-                personPos.x = objPos[i].x + (dx > 0 ? hSize : -hSize);
-            }
-            else {
-                personPos.z = objPos[i].z + (dz > 0 ? hSize : -hSize);
+// linear average of an sRGB texture from its 1x1 mip level; mid grey without a texture
+glm::vec3 averageTextureColor(GLuint texture) {
+    if (!texture)
+        return glm::vec3(0.5f);
+
+    // a unit of its own, so the material bindings on 0-4 stay what MaterialLibrary thinks they are
+    glActiveTexture(GL_TEXTURE0 + LIGHTMAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    GLint width = 0, height = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    int top = (int)std::floor(std::log2((float)std::max(std::max(width, height), 1)));
+
+    float texel[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    glGetTexImage(GL_TEXTURE_2D, top, GL_RGBA, GL_FLOAT, texel);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    return glm::pow(glm::vec3(texel[0], texel[1], texel[2]), glm::vec3(2.2f));
+}
+
+// charts for the static quads and cubes, the static models as occluders only (they have no
+// second uv set), then the atlas from LIGHTMAP_FILE or a fresh bake; needs the draw lists and
+// the light directions (initUniforms)
+void initLightmap() {
+    // the G-buffer has no place for the baked light, the deferred path stays fully dynamic
+    if (!useLightmap || useDeferred)
+        return;
+
+    auto albedoOf = [](uint32_t material) {
+        const gps::Material& m = materials.get(material);
+        return averageTextureColor(m.textures[gps::SLOT_DIFFUSE]) * m.diffuse;
+    };
+
+    entityChart.assign(scene.size(), -1);
+    for (gps::EntityId id = 0; id < (gps::EntityId)scene.size(); id++) {
+        const gps::MeshRef& mesh = scene.meshes[id];
+        const glm::mat4& M = scene.worldTransforms[id];
+        if (!scene.hasFlags(id, gps::ENTITY_VISIBLE) || scene.hasFlags(id, gps::ENTITY_TRANSPARENT))
+            continue;
+
+        if (mesh.kind == gps::MESH_QUAD || mesh.kind == gps::MESH_CUBE) {
+            uint32_t material = scene.materials[id];
+            if (scene.hasFlags(id, gps::ENTITY_DYNAMIC) || (materialFeatures[material] & (FEATURE_SKY | FEATURE_GLASS)))
+                continue;
+            std::vector<gps::LightmapFace> faces = mesh.kind == gps::MESH_QUAD
+                ? lightmapFaces(QUAD_VERTICES, 1, M) : lightmapFaces(CUBE_VERTICES, 6, M);
+            entityChart[id] = (int32_t)lightmapBaker.addChart(faces, albedoOf(material));
+        }
+        // the statues in their rest pose; the person walks around too much to leave a trace
+        else if (mesh.kind == gps::MESH_MODEL && id != personId) {
+            for (const gps::Mesh& m : mesh.model->getMeshes()) {
+                std::vector<glm::vec3> triangles(m.indices.size());
+                for (size_t i = 0; i < m.indices.size(); i++)
+                    triangles[i] = glm::vec3(M * glm::vec4(m.vertices[m.indices[i]].Position, 1.0f));
+                lightmapBaker.addOccluder(triangles, albedoOf(m.materialId));
             }
         }
     }
+
+    // sun and window light stay in the shader for the shadows of whatever moves, only their
+    // bounces are baked; the pedestal spots are baked entirely
+    gps::BakeLight sun;
+    sun.direction = lightDir;
+    sun.color = lightColor;
+    sun.direct = false;
+    lightmapBaker.addLight(sun);
+
+    gps::BakeLight window;
+    window.direction = windowLightDir;
+    window.color = windowLightColor;
+    window.direct = false;
+    lightmapBaker.addLight(window);
+
+    for (int i = 0; i < SHADOWED_SPOT_COUNT; i++) {
+        const SpotlightCPU& s = spots[i];
+        gps::BakeLight spot;
+        spot.kind = gps::BakeLight::SPOT;
+        spot.position = s.position;
+        spot.direction = glm::normalize(s.direction);
+        spot.color = s.color * s.intensity;
+        spot.cosInner = s.cutoff;
+        spot.cosOuter = s.outerCutoff;
+        spot.constant = s.constant;
+        spot.linear = s.linear;
+        spot.quadratic = s.quadratic;
+        spot.range = s.range;
+        lightmapBaker.addLight(spot);
+    }
+
+    gps::LightmapSettings settings;
+    settings.skyRadiance = averageTextureColor(outsideTex);
+    if (!lightmapBaker.pack(settings)) {
+        std::cout << "Lightmap: " << lightmapBaker.getChartCount() << " charts don't fit the atlas" << std::endl;
+        entityChart.clear();
+        return;
+    }
+
+    if (bakeLightmap) {
+        double start = glfwGetTime();
+        lightmapBaker.bake(workerPool);
+        lightmapBaker.save(LIGHTMAP_FILE);
+        std::cout << "Lightmap: baked " << lightmapBaker.getChartCount() << " charts at "
+            << lightmapBaker.getTexelsPerMeter() << " texels/m in " << (glfwGetTime() - start) << " s" << std::endl;
+    }
+    else if (!lightmapBaker.load(LIGHTMAP_FILE)) {
+        std::cout << "Lightmap: " << LIGHTMAP_FILE << " missing or out of date, run with --bake-lightmap" << std::endl;
+        entityChart.clear();
+        return;
+    }
+
+    int size = lightmapBaker.getAtlasSize();
+    glGenTextures(1, &lightmapTexture);
+    glActiveTexture(GL_TEXTURE0 + LIGHTMAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D, lightmapTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, lightmapBaker.getTexels().data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (gps::EntityId id = 0; id < (gps::EntityId)scene.size(); id++) {
+        if (entityChart[id] >= 0 && useIndirect)
+            indirectRenderer.setLightmap(id, lightmapBaker.getChartRect(entityChart[id]),
+                lightmapBaker.getCellStride(entityChart[id]));
+    }
+
+    // a material turns to its LIGHTMAP variant only if everything drawn with it has a chart
+    std::vector<uint8_t> charted(materials.size(), 1);
+    for (gps::EntityId id = 0; id < (gps::EntityId)scene.size(); id++) {
+        gps::MeshKind kind = scene.meshes[id].kind;
+        if ((kind == gps::MESH_QUAD || kind == gps::MESH_CUBE) && entityChart[id] < 0)
+            charted[scene.materials[id]] = 0;
+        else if (kind == gps::MESH_MODEL) {
+            for (const gps::Mesh& m : scene.meshes[id].model->getMeshes())
+                charted[m.materialId] = 0;
+        }
+    }
+    for (gps::EntityId id = 0; id < (gps::EntityId)scene.size(); id++) {
+        if (entityChart[id] >= 0 && charted[scene.materials[id]])
+            materialFeatures[scene.materials[id]] |= FEATURE_LIGHTMAP;
+    }
 }
 
-// DRAWING FUNCTIONS
+// PICKING
 
-void drawTexturedQuad(
-    gps::Shader& shader,
-    const glm::mat4& M,
-    GLuint diffuseTex, GLuint specTex, GLuint roughTex, GLuint normalTex,
-    glm::vec2 tiling,
-    int isOutside,
-    int isGlass,
-    float glassFactor,
-    GLuint opacityTex,
-    glm::vec2 uvMin = glm::vec2(0.0f, 0.0f),
-    glm::vec2 uvMax = glm::vec2(1.0f, 1.0f),
-    glm::vec2 uvOffset = glm::vec2(0.0f, 0.0f)
-)
-{
-    shader.useShaderProgram();
+// the triangles of a QUAD_VERTICES/CUBE_VERTICES style array, positions only
+std::vector<glm::vec3> primitiveTriangles(const float* v, int vertexCount) {
+    std::vector<glm::vec3> triangles(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+        triangles[i] = glm::vec3(v[i * 8], v[i * 8 + 1], v[i * 8 + 2]);
+    return triangles;
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(M));
-    glm::mat3 NM = glm::mat3(glm::inverseTranspose(view * M));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(NM));
+void initPicking() {
+    double start = glfwGetTime();
+    picker.build(scene, primitiveTriangles(QUAD_VERTICES, 6), primitiveTriangles(CUBE_VERTICES, 36), &workerPool);
+    std::cout << "Picking: " << picker.getTriangleCount() << " triangles in " << picker.getShapeCount()
+        << " shapes, built in " << (glfwGetTime() - start) << " s" << std::endl;
+}
 
-    // UV controls 
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvTiling"), 1, glm::value_ptr(tiling));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvOffset"), 1, glm::value_ptr(uvOffset));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMin"), 1, glm::value_ptr(uvMin));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMax"), 1, glm::value_ptr(uvMax));
+// COLLISION
 
-    // textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "diffuseTexture"), 0);
+void initCollision() {
+    collisionWorld.addEntities(scene, gps::ENTITY_VISIBLE, gps::ENTITY_DYNAMIC);
+    collisionWorld.build();
+    std::cout << "Collision: " << collisionWorld.getColliderCount() << " colliders in "
+        << collisionWorld.getCellCount() << " cells" << std::endl;
+}
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, specTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "specularTexture"), 1);
+gps::Capsule cameraCapsule(const glm::vec3& eye) {
+    float feet = eye.y - CAMERA_EYE_HEIGHT;
+    return { glm::vec3(eye.x, feet + STEP_HEIGHT + CAMERA_RADIUS, eye.z),
+        glm::vec3(eye.x, eye.y + 0.1f, eye.z), CAMERA_RADIUS };
+}
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, roughTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "roughnessTexture"), 2);
+gps::Capsule personCapsule(const glm::vec3& feet) {
+    return { feet + glm::vec3(0.0f, STEP_HEIGHT + PERSON_RADIUS, 0.0f),
+        feet + glm::vec3(0.0f, PERSON_HEIGHT - PERSON_RADIUS, 0.0f), PERSON_RADIUS };
+}
 
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, normalTex ? normalTex : 0);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "normalTexture"), 3);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "useNormalMap"), normalTex ? 1 : 0);
+// the camera walks at eye height: the move it was just given, from where it stood, made
+// horizontal and swept
+void collideCamera(const glm::vec3& from) {
+    glm::vec3 motion = myCamera.getPosition() - from;
+    motion.y = 0.0f;
 
-    // flags
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isOutside"), isOutside);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isGlass"), isGlass);
-    glUniform1f(glGetUniformLocation(shader.shaderProgram, "glassFactor"), glassFactor);
+    glm::vec3 p = from + collisionWorld.move(cameraCapsule(from), motion);
+    p.y = CAMERA_EYE_HEIGHT;
+    myCamera.setPosition(p);
+}
 
-    // opacity map only for glass
-    int useOp = (isGlass == 1 && opacityTex != 0) ? 1 : 0;
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "useOpacityMap"), useOp);
+void movePerson(const glm::vec3& motion) {
+    personPos += collisionWorld.move(personCapsule(personPos), glm::vec3(motion.x, 0.0f, motion.z));
+    personPos.y = 0.0f;
+}
 
-    if (useOp)
-    {
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, opacityTex);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "opacityTexture"), 4);
+void setWindowCallbacks() {
+    glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
+    glfwSetKeyCallback(myWindow.getWindow(), keyboardCallback);
+    glfwSetCursorPosCallback(myWindow.getWindow(), mouseCallback);
+    glfwSetMouseButtonCallback(myWindow.getWindow(), mouseButtonCallback);
+}
+
+// INPUT & CALLBACK FUNCTIONS
+
+void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+        gFlat = 1 - gFlat;
+
+    if (key >= 0 && key < 1024) {
+        if (action == GLFW_PRESS)
+            pressedKeys[key] = true;
+        else if (action == GLFW_RELEASE)
+            pressedKeys[key] = false;
     }
 
-    glBindVertexArray(quadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    if (action == GLFW_PRESS) {
+        if (key == GLFW_KEY_F1) {
+            gWireframe = !gWireframe;
+            glPolygonMode(GL_FRONT_AND_BACK, gWireframe ? GL_LINE : GL_FILL);
+        }
+        if (key == GLFW_KEY_F3) {
+            useDepthPrepass = !useDepthPrepass;
+            shadedFragments.resetStats();
+            std::cout << "Depth pre-pass " << (useDepthPrepass ? "on" : "off") << std::endl;
+        }
+    }
+
+    if (action == GLFW_PRESS || action == GLFW_REPEAT) {
+        if (key == GLFW_KEY_LEFT)
+            personYaw += 3.0f;
+        if (key == GLFW_KEY_RIGHT)
+            personYaw -= 3.0f;
+
+        float speed = 0.1f;
+        glm::vec3 forward(sin(glm::radians(personYaw)), 0.0f, cos(glm::radians(personYaw)));
+        if (key == GLFW_KEY_UP)
+            movePerson(forward * speed);
+        if (key == GLFW_KEY_DOWN)
+            movePerson(-forward * speed);
+
+        if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+            personAnimate = !personAnimate;
+    }
+
+    if (action == GLFW_RELEASE)
+        pressedKeys[key] = false;
 }
 
+void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
+    if (firstMouse) {
+        lastX = xpos;
+        lastY = ypos;
+        firstMouse = false;
+    }
+
+    float xoffset = float(xpos - lastX);
+    float yoffset = float(lastY - ypos);
 
-void drawTexturedCube(
-    gps::Shader& shader,
-    const glm::mat4& M,
-    GLuint diffuseTex, GLuint specTex, GLuint roughTex, GLuint normalTex,
-    glm::vec2 tiling,
-    int isGlass,
-    float glassFactor,
-    GLuint opacityTex) {
+    lastX = xpos;
+    lastY = ypos;
 
-    shader.useShaderProgram();
+    float sensitivity = 0.08f;
+    xoffset *= sensitivity;
+    yoffset *= sensitivity;
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(M));
-    glm::mat3 NM = glm::mat3(glm::inverseTranspose(view * M));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(NM));
+    yaw += xoffset;
+    pitch += yoffset;
+    pitch = std::clamp(pitch, -89.0f, 89.0f);
 
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvTiling"), 1, glm::value_ptr(tiling));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMin"), 1, glm::value_ptr(glm::vec2(0.0f)));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMax"), 1, glm::value_ptr(glm::vec2(1.0f)));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvOffset"), 1, glm::value_ptr(glm::vec2(0.0f)));
+    myCamera.rotate(pitch, yaw);
+    view = myCamera.getViewMatrix();
+}
 
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isOutside"), 0);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isGlass"), isGlass);
-    glUniform1f(glGetUniformLocation(shader.shaderProgram, "glassFactor"), glassFactor);
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+        return;
+
+    gps::Ray ray;
+    ray.origin = myCamera.getPosition();
+    ray.direction = myCamera.getRayDirection(glm::vec2(0.0f), projection);
+    ray.tMax = CAMERA_FAR;
+
+    gps::PickHit hit;
+    double start = glfwGetTime();
+    bool found = picker.pick(ray, hit);
+    double micros = (glfwGetTime() - start) * 1e6;
+
+    selectedEntity = found ? hit.entity : gps::NO_ENTITY;
+    if (found)
+        std::cout << "Picked " << scene.names[hit.entity] << ": mesh " << hit.mesh << ", triangle " << hit.triangle
+            << ", " << hit.distance << " m away (" << micros << " us)" << std::endl;
+    else
+        std::cout << "Picked nothing (" << micros << " us)" << std::endl;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "diffuseTexture"), 0);
+void windowResizeCallback(GLFWwindow* window, int width, int height) {
+    fprintf(stdout, "Window resized! New width: %d, height: %d\n", width, height);
+
+    // renderScene's viewport and the deferred pass's viewportSize read the size from here
+    myWindow.setWindowDimensions({ width, height });
+    glViewport(0, 0, width, height);
+    projection = glm::perspective(glm::radians(45.0f),
+        (float)width / (float)height, CAMERA_NEAR, CAMERA_FAR);
+    lightClusters.setProjection(projection, CAMERA_NEAR, CAMERA_FAR);
+    if (useDeferred)
+        gBuffer.resize(width, height);
+}
+
+void processMovement() {
+    bool moved = false;
+    glm::vec3 from = myCamera.getPosition();
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, specTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "specularTexture"), 1);
+    if (pressedKeys[GLFW_KEY_W]) {
+        myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
+        moved = true;
+    }
+    if (pressedKeys[GLFW_KEY_S]) {
+        myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
+        moved = true;
+    }
+    if (pressedKeys[GLFW_KEY_A]) {
+        myCamera.move(gps::MOVE_LEFT, cameraSpeed);
+        moved = true;
+    }
+    if (pressedKeys[GLFW_KEY_D]) {
+        myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
+        moved = true;
+    }
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, roughTex);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "roughnessTexture"), 2);
+    if (moved) {
+        collideCamera(from);
+        view = myCamera.getViewMatrix();
+        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    }
 
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, normalTex ? normalTex : 0);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "normalTexture"), 3);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "useNormalMap"), normalTex ? 1 : 0);
+    if (pressedKeys[GLFW_KEY_Q])
+        turnSelected(-1.0f);
+    if (pressedKeys[GLFW_KEY_E])
+        turnSelected(1.0f);
+}
 
-    int useOp = (isGlass == 1 && opacityTex != 0) ? 1 : 0;
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "useOpacityMap"), useOp);
-    if (useOp) {
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, opacityTex);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "opacityTexture"), 4);
+// only what animateScene moves can turn; the rest is static (shadow cache, lightmap, collision)
+void turnSelected(float degrees) {
+    if (selectedEntity == gps::NO_ENTITY)
+        return;
+    if (selectedEntity == personId)
+        personYaw += degrees;
+    for (int i = 0; i < 3; i++) {
+        if (selectedEntity == statueIds[i])
+            statueTurn[i] += degrees;
     }
+}
+
+// DRAWING FUNCTIONS
+
+// the permutation key of a material: its own features plus the global flat shading toggle,
+// which makes the normal map irrelevant
+uint32_t surfaceKey(uint32_t material) {
+    uint32_t key = materialFeatures[material];
+    if (gFlat)
+        key = (key & ~FEATURE_NORMAL_MAP) | FEATURE_FLAT_SHADING;
+    return key;
+}
+
+void setModelMatrix(gps::Shader& shader, const glm::mat4& M) {
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(M));
+    glm::mat3 NM = glm::mat3(glm::inverseTranspose(view * M));
+    glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(NM));
+}
+
+// the entity's chart for the LIGHTMAP variants (the indirect path has it in the draw records)
+void setLightmapRect(gps::Shader& shader, gps::EntityId id) {
+    if (id >= (gps::EntityId)entityChart.size() || entityChart[id] < 0)
+        return;
+    glm::vec4 rect = lightmapBaker.getChartRect(entityChart[id]);
+    glUniform4fv(glGetUniformLocation(shader.shaderProgram, "lightmapRect"), 1, glm::value_ptr(rect));
+    glUniform1f(glGetUniformLocation(shader.shaderProgram, "lightmapCellStride"),
+        lightmapBaker.getCellStride(entityChart[id]));
+}
+
+void drawQuad(gps::ShaderPermutations& programs, const glm::mat4& M, uint32_t material, gps::EntityId id) {
+    gps::Shader& shader = programs.get(surfaceKey(material));
+    shader.useShaderProgram();
+    setModelMatrix(shader, M);
+    setLightmapRect(shader, id);
+    materials.bind(material);
+
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+}
+
+void drawCube(gps::ShaderPermutations& programs, const glm::mat4& M, uint32_t material, gps::EntityId id) {
+    gps::Shader& shader = programs.get(surfaceKey(material));
+    shader.useShaderProgram();
+    setModelMatrix(shader, M);
+    setLightmapRect(shader, id);
+    materials.bind(material);
 
     glBindVertexArray(cubeVAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
 }
 
+// meshes may need different variants; the model matrix goes to each program it switches to
 void drawModel(
-    gps::Shader& shader,
+    gps::ShaderPermutations& programs,
     gps::Model3D& mdl,
     const glm::mat4& M) {
 
-    shader.useShaderProgram();
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(M));
-    glm::mat3 NM = glm::mat3(glm::inverseTranspose(view * M));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(NM));
-
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvTiling"), 1, glm::value_ptr(glm::vec2(1.0f)));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvOffset"), 1, glm::value_ptr(glm::vec2(0.0f)));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMin"), 1, glm::value_ptr(glm::vec2(0.0f)));
-    glUniform2fv(glGetUniformLocation(shader.shaderProgram, "uvMax"), 1, glm::value_ptr(glm::vec2(1.0f)));
-
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isOutside"), 0);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isGlass"), 0);
-    glUniform1f(glGetUniformLocation(shader.shaderProgram, "glassFactor"), 1.0f);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "useOpacityMap"), 0);
+    gps::Shader* current = nullptr;
+    for (gps::Mesh& mesh : mdl.getMeshes()) {
+        gps::Shader& shader = programs.get(surfaceKey(mesh.materialId));
+        if (&shader != current) {
+            shader.useShaderProgram();
+            setModelMatrix(shader, M);
+            current = &shader;
+        }
+        materials.bind(mesh.materialId);
+        mesh.DrawGeometry();
+    }
+}
 
-    mdl.Draw(shader);
+void drawEntity(gps::ShaderPermutations& programs, gps::EntityId id) {
+    const gps::MeshRef& mesh = scene.meshes[id];
+    const glm::mat4& M = scene.worldTransforms[id];
+
+    switch (mesh.kind) {
+    case gps::MESH_QUAD:
+        drawQuad(programs, M, scene.materials[id], id);
+        break;
+    case gps::MESH_CUBE:
+        drawCube(programs, M, scene.materials[id], id);
+        break;
+    case gps::MESH_MODEL:
+        drawModel(programs, *mesh.model, M);
+        break;
+    default:
+        break;
+    }
 }
 
 // SHADOW DRAWING FUNCTIONS
@@ -864,324 +1651,337 @@ void drawShadowCube(gps::Shader& sh, const glm::mat4& M) {
 void drawShadowModel(gps::Shader& sh, gps::Model3D& mdl, const glm::mat4& M) {
     sh.useShaderProgram();
     glUniformMatrix4fv(glGetUniformLocation(sh.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(M));
-    mdl.Draw(sh);
+    for (gps::Mesh& mesh : mdl.getMeshes())
+        mesh.DrawGeometry();
 }
 
-// LIGHT SPACE MATRIX COMPUTATION
+void drawEntityShadow(gps::Shader& sh, gps::EntityId id) {
+    const gps::MeshRef& mesh = scene.meshes[id];
+    const glm::mat4& M = scene.worldTransforms[id];
+
+    switch (mesh.kind) {
+    case gps::MESH_QUAD:
+        drawShadowQuad(sh, M);
+        break;
+    case gps::MESH_CUBE:
+        drawShadowCube(sh, M);
+        break;
+    case gps::MESH_MODEL:
+        drawShadowModel(sh, *mesh.model, M);
+        break;
+    default:
+        break;
+    }
+}
 
-glm::mat4 computeLightSpaceMatrix() {
-    glm::vec3 center(0.0f, 1.5f, 0.0f);
-    glm::vec3 lightPos = center - lightDir * 10.0f;
-    glm::mat4 lightView = glm::lookAt(lightPos, center, glm::vec3(0, 1, 0));
+// LIGHT SPACE MATRIX COMPUTATION
 
-    float orthoSize = 12.0f;
-    glm::mat4 lightProj = glm::ortho(
-        -orthoSize, orthoSize,
-        -orthoSize, orthoSize,
-        1.0f, 25.0f
-    );
+// camera frustum split into CASCADE_COUNT slices, each with its own tightly fitted sun matrix
+void computeSunCascades() {
+    gps::practicalSplits(CAMERA_NEAR, CAMERA_FAR, CASCADE_COUNT, CASCADE_LAMBDA, cascadeSplits);
 
-    return lightProj * lightView;
+    glm::mat4 invViewProjection = glm::inverse(projection * view);
+    float sliceNear = CAMERA_NEAR;
+    for (int c = 0; c < CASCADE_COUNT; c++) {
+        cascadeMatrices[c] = gps::fitCascade(lightDir, invViewProjection, CAMERA_NEAR, CAMERA_FAR,
+            sliceNear, cascadeSplits[c], shadowSceneBounds, SHADOW_SIZE);
+        sliceNear = cascadeSplits[c];
+    }
 }
 
+// the window light covers the whole room in its single layer
 glm::mat4 computeWindowLightSpaceMatrix() {
-    glm::vec3 center(0.0f, 1.5f, 0.0f);
-    glm::vec3 lightPos = center - windowLightDir * 10.0f;
-    glm::mat4 lightView = glm::lookAt(lightPos, center, glm::vec3(0, 1, 0));
+    return gps::fitSceneBounds(windowLightDir, shadowSceneBounds);
+}
+
+// perspective over the spot's outer cone, a little wider so the filter has room at the edge
+glm::mat4 computeSpotLightSpace(int spot) {
+    const SpotlightCPU& s = spots[spot];
+    glm::vec3 dir = glm::normalize(s.direction);
+    glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    float fov = 2.0f * std::acos(s.outerCutoff) + glm::radians(2.0f);
 
-    float orthoSize = 10.0f;
-    glm::mat4 lightProj = glm::ortho(
-        -orthoSize, orthoSize,
-        -orthoSize, orthoSize,
-        1.0f, 25.0f
-    );
+    return glm::perspective(fov, 1.0f, SPOT_SHADOW_NEAR, SPOT_SHADOW_RANGE)
+        * glm::lookAt(s.position, s.position + dir, up);
+}
 
-    return lightProj * lightView;
+// roughly the share of the screen the spot's lit volume covers: the bounding sphere of its
+// cone over the distance to the camera, a quarter of that while the sphere is off screen
+float spotImportance(int spot, const gps::Frustum& viewFrustum) {
+    const SpotlightCPU& s = spots[spot];
+    float half = SPOT_SHADOW_RANGE * 0.5f;
+    float coneRadius = SPOT_SHADOW_RANGE * std::tan(std::acos(s.outerCutoff));
+    glm::vec3 center = s.position + glm::normalize(s.direction) * half;
+    float radius = std::sqrt(half * half + coneRadius * coneRadius);
+
+    float distance = std::max(glm::length(center - myCamera.getPosition()), radius);
+    float importance = radius / distance;
+
+    for (const glm::vec4& plane : viewFrustum.planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius * glm::length(glm::vec3(plane)))
+            return importance * 0.25f;
+    }
+    return importance;
 }
 
 void uploadSpotlights(gps::Shader& shader) {
     shader.useShaderProgram();
+    GLuint program = shader.shaderProgram;
+
+    // the lights themselves come from the cluster buffers; here only where to find a fragment's
+    // cluster and the shadowed spots
+    glUniform2f(glGetUniformLocation(program, "viewportSize"),
+        (float)myWindow.getWindowDimensions().width, (float)myWindow.getWindowDimensions().height);
+    glUniform2f(glGetUniformLocation(program, "clusterDepthRange"),
+        lightClusters.getNearPlane(), std::log(lightClusters.getFarPlane() / lightClusters.getNearPlane()));
+    glUniform1i(glGetUniformLocation(program, "clusterLights"), 8);
+    glUniform1i(glGetUniformLocation(program, "clusterGrid"), 9);
+    glUniform1i(glGetUniformLocation(program, "clusterIndices"), 10);
+
+    for (int i = 0; i < SHADOWED_SPOT_COUNT; i++) {
+        // the matrix and tile the spot's shadow was last drawn with; w = 0: no shadow yet
+        glm::vec4 rect(spotShadowAtlas.getRect(i), spotShadowAtlas.hasShadow(i) ? 1.0f : 0.0f);
+        glUniformMatrix4fv(glGetUniformLocation(program, ("spotShadowMatrices[" + std::to_string(i) + "]").c_str()),
+            1, GL_FALSE, glm::value_ptr(spotShadowAtlas.getLightSpace(i)));
+        glUniform4fv(glGetUniformLocation(program, ("spotShadowRects[" + std::to_string(i) + "]").c_str()),
+            1, glm::value_ptr(rect));
+    }
+}
 
-    const int N = 3;
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "numSpots"), N);
-
-    float intensity[N] = { 2.0f, 2.0f, 2.0f };
-
-    for (int i = 0; i < N; i++) {
-        glUniform3fv(glGetUniformLocation(shader.shaderProgram, ("spotPos[" + std::to_string(i) + "]").c_str()),
-            1, glm::value_ptr(spots[i].position));
-
-        glUniform3fv(glGetUniformLocation(shader.shaderProgram, ("spotDir[" + std::to_string(i) + "]").c_str()),
-            1, glm::value_ptr(glm::normalize(spots[i].direction)));
+// dim, narrow spots on a grid under the ceiling, pointing down
+void addTestSpots(int count) {
+    int columns = std::max(1, (int)std::ceil(std::sqrt((float)count * ROOM_W / ROOM_D)));
+    int rows = (count + columns - 1) / columns;
+
+    for (int i = 0; i < count; i++) {
+        float u = (i % columns + 0.5f) / (float)columns;
+        float v = (i / columns + 0.5f) / (float)rows;
+
+        SpotlightCPU s;
+        s.position = glm::vec3((u - 0.5f) * (ROOM_W - 1.0f), ROOM_H - 0.2f, (v - 0.5f) * (ROOM_D - 1.0f));
+        s.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+        s.color = glm::vec3(0.6f + 0.4f * u, 0.8f, 1.0f - 0.4f * v);
+        s.cutoff = glm::cos(glm::radians(15.0f));
+        s.outerCutoff = glm::cos(glm::radians(25.0f));
+        s.constant = 1.0f;
+        s.linear = 0.35f;
+        s.quadratic = 0.44f;
+        s.intensity = 0.4f;
+        s.range = 4.5f;
+        spots.push_back(s);
+    }
+}
 
-        glUniform3fv(glGetUniformLocation(shader.shaderProgram, ("spotColor[" + std::to_string(i) + "]").c_str()),
-            1, glm::value_ptr(spots[i].color));
+// the spots never move, so their cluster form is built once
+void initLightClusters() {
+    clusterSpots.clear();
+    for (size_t i = 0; i < spots.size(); i++) {
+        const SpotlightCPU& s = spots[i];
+        gps::ClusterSpot c;
+        c.position = s.position;
+        c.direction = glm::normalize(s.direction);
+        c.color = s.color * s.intensity;
+        c.cosInner = s.cutoff;
+        c.cosOuter = s.outerCutoff;
+        c.constant = s.constant;
+        c.linear = s.linear;
+        c.quadratic = s.quadratic;
+        c.range = s.range;
+        c.shadow = i < (size_t)SHADOWED_SPOT_COUNT ? (int)i : -1;
+        clusterSpots.push_back(c);
+    }
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotCutOff[" + std::to_string(i) + "]").c_str()),
-            spots[i].cutoff);
+    lightClusters.init();
+    lightClusters.setProjection(projection, CAMERA_NEAR, CAMERA_FAR);
+}
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotOuterCutOff[" + std::to_string(i) + "]").c_str()),
-            spots[i].outerCutoff);
+// RENDERING FUNCTIONS
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotIntensity[" + std::to_string(i) + "]").c_str()),
-            intensity[i]);
+void animateScene() {
+    float t = (float)glfwGetTime();
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotConstant[" + std::to_string(i) + "]").c_str()),
-            spots[i].constant);
+    // statues bob and spin on top of their pedestals
+    float statueScale[3] = { 0.20f, 0.22f, 0.09f };
+    float pedestalTopY = 0.6f + 1.2f * 0.5f;
+    float statueLift = 0.02f;
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotLinear[" + std::to_string(i) + "]").c_str()),
-            spots[i].linear);
+    for (int i = 0; i < 3; i++) {
+        float spin = t * (40.0f + 15.0f * i) + statueTurn[i];
+        float bob = 0.05f * sin(t * 2.0f + (float)i);
 
-        glUniform1f(glGetUniformLocation(shader.shaderProgram, ("spotQuadratic[" + std::to_string(i) + "]").c_str()),
-            spots[i].quadratic);
+        glm::mat4 S(1.0f);
+        S = glm::translate(S, glm::vec3(0.0f, pedestalTopY + statueLift + bob, 0.0f));
+        S = glm::rotate(S, glm::radians(spin), glm::vec3(0, 1, 0));
+        S = glm::scale(S, glm::vec3(statueScale[i]));
+        scene.setLocalTransform(statueIds[i], S);
     }
-}
-
-// RENDERING FUNCTIONS
-
-void renderRoom(gps::Shader& shader) {
-    float W = 12.0f;
-    float D = 16.0f;
-    float H = 4.0f;
 
-    glm::vec2 tileFloor(6.0f, 6.0f);
-    glm::vec2 tileWall(4.0f, 2.0f);
+    // person
+    if (personAnimate)
+        personAnimT += 0.02f;
 
-    const glm::vec2 WIN_UV_MIN(0.14648f, 0.24707f);
-    const glm::vec2 WIN_UV_MAX(0.85254f, 0.75195f);
+    float walk = personAnimate ? 0.25f * sin(personAnimT) : 0.0f;
+    glm::mat4 mPerson(1.0f);
+    mPerson = glm::translate(mPerson, personPos + glm::vec3(0.0f, 0.0f, walk));
+    mPerson = glm::rotate(mPerson, glm::radians(personYaw), glm::vec3(0, 1, 0));
+    mPerson = glm::scale(mPerson, glm::vec3(0.01f));
+    scene.setLocalTransform(personId, mPerson);
 
-    auto drawWallQuad = [&](const glm::mat4& M, glm::vec2 tiling) {
-        drawTexturedQuad(shader, M,
-            wallDiffuse, wallSpecular, wallRoughness, wallNormal,
-            tiling, 0, 0, 1.0f, 0,
-            glm::vec2(0.0f), glm::vec2(1.0f));
-        };
+    scene.updateTransforms();
+}
 
+// programs draw per entity, indirect are the variants of the multi-draw path
+void renderOpaqueEntities(gps::ShaderPermutations& programs, gps::ShaderPermutations& indirect) {
     // Opaque pass
     glDisable(GL_BLEND);
     glDepthMask(GL_TRUE);
 
-    // Floor
-    {
-        glm::mat4 M(1.0f);
-        M = glm::scale(M, glm::vec3(W, 1.0f, D));
-        drawTexturedQuad(shader, M,
-            floorDiffuse, floorSpecular, floorRoughness, floorNormal,
-            tileFloor, 0, 0, 1.0f, 0,
-            glm::vec2(0.0f), glm::vec2(1.0f));
+    // with the pre-pass the depth is final: only the fragment that wins each pixel is shaded
+    if (useDepthPrepass) {
+        renderDepthPrepass();
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
     }
 
-    // Ceiling
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(0.0f, H, 0.0f));
-        M = glm::rotate(M, glm::radians(180.0f), glm::vec3(1, 0, 0));
-        M = glm::scale(M, glm::vec3(W, 1.0f, D));
-        drawWallQuad(M, tileWall);
+    shadedFragments.begin();
+    if (useIndirect) {
+        indirectRenderer.draw(visibleOpaque, &materials, [&indirect](uint32_t material) {
+            indirect.get(surfaceKey(material)).useShaderProgram();
+        });
     }
-
-    // Front wall
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(0.0f, H * 0.5f, D * 0.5f));
-        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-        M = glm::scale(M, glm::vec3(W, 1.0f, H));
-        drawWallQuad(M, tileWall);
+    else {
+        for (gps::EntityId id : visibleOpaque)
+            drawEntity(programs, id);
     }
 
-    // Left wall
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(-W * 0.5f, H * 0.5f, 0.0f));
-        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(0, 0, 1));
-        M = glm::scale(M, glm::vec3(H, 1.0f, D));
-        drawWallQuad(M, tileWall);
-    }
-
-    // Right wall
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(W * 0.5f, H * 0.5f, 0.0f));
-        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(0, 0, 1));
-        M = glm::scale(M, glm::vec3(H, 1.0f, D));
-        drawWallQuad(M, tileWall);
-    }
-
-    // Back wall with window hole
-    float zBack = -D * 0.5f;
-    float winW = 4.5f;
-    float winH = 2.2f;
-    float winBottom = 1.2f;
-    float winTop = winBottom + winH;
-
-    auto backPiece = [&](float xCenter, float yCenter, float xSize, float ySize) {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(xCenter, yCenter, zBack));
-        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
-        M = glm::scale(M, glm::vec3(xSize, 1.0f, ySize));
-        drawWallQuad(M, tileWall);
-        };
-
-    float sideW = (W - winW) * 0.5f;
-    backPiece(-W * 0.5f + sideW * 0.5f, H * 0.5f, sideW, H);
-    backPiece(W * 0.5f - sideW * 0.5f, H * 0.5f, sideW, H);
-    backPiece(0.0f, winBottom * 0.5f, winW, winBottom);
-    backPiece(0.0f, (winTop + H) * 0.5f, winW, (H - winTop));
-
-    // Sky background
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(0.0f, winBottom + winH * 0.5f, zBack - 0.5f));
-        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
-        M = glm::scale(M, glm::vec3(winW * 1.2f, 1.0f, winH * 1.2f));
+    shadedFragments.end();
 
-        drawTexturedQuad(shader, M,
-            outsideTex, 0, 0, 0,
-            glm::vec2(1.0f, 1.0f), 1, 0, 1.0f, 0,
-            glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f));
-    }
+    // the queried models stay out of the pre-pass, so they keep their conditional draws
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    if (!visibleQueried.empty())
+        renderQueriedEntities(programs);
+}
 
-    // Window pane (transparent)
+void renderTransparentEntities(gps::ShaderPermutations& programs) {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDepthMask(GL_FALSE);
 
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(0.0f, winBottom + winH * 0.5f, zBack + 0.01f));
-        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(1, 0, 0));
-        M = glm::scale(M, glm::vec3(winW, 1.0f, winH));
+    for (gps::EntityId id : visibleTransparent)
+        drawEntity(programs, id);
 
-        drawTexturedQuad(shader, M,
-            glassDiffuse, glassSpec, glassRough, glassNormal,
-            glm::vec2(1.0f, 1.0f), 0, 1, 0.4f,
-            glassOpacity,
-            WIN_UV_MIN, WIN_UV_MAX);
-    }
     glDepthMask(GL_TRUE);
 }
 
-void renderLampFixtures(gps::Shader& shader) {
-    shader.useShaderProgram();
-
-    float H = 4.0f;
-
-    for (int i = 0; i < 3; i++) {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, spots[i].position + glm::vec3(0.0f, H - spots[i].position.y - 0.1f, 0.0f));
-        M = glm::scale(M, glm::vec3(0.4f, 0.05f, 0.4f));
-
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "isOutside"), 0);
-        drawTexturedCube(shader, M, wallDiffuse, wallSpecular, wallRoughness, wallNormal, glm::vec2(1.0f));
+// depth of the visible opaque entities through the depth only fragment shader; the vertex
+// shaders repeat the color pass position math exactly
+void renderDepthPrepass() {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    if (useIndirect) {
+        indirectDepthPrepassShader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(indirectDepthPrepassShader.shaderProgram, "view"),
+            1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(indirectDepthPrepassShader.shaderProgram, "projection"),
+            1, GL_FALSE, glm::value_ptr(projection));
+        indirectRenderer.draw(visibleOpaque, nullptr);
+    }
+    else {
+        depthPrepassShader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "view"),
+            1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "projection"),
+            1, GL_FALSE, glm::value_ptr(projection));
+        for (gps::EntityId id : visibleOpaque)
+            drawEntityShadow(depthPrepassShader, id);
     }
-}
-
-void renderObjects(gps::Shader& shader) {
-    float t = (float)glfwGetTime();
 
-    glm::vec3 objPos[3] = {
-        glm::vec3(-3.0f, 0.0f, -2.0f),
-        glm::vec3(2.0f, 0.0f, -2.0f),
-        glm::vec3(4.0f, 0.0f, -2.0f)
-    };
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
 
-    glm::vec3 pedestalScale(0.9f, 1.2f, 0.9f);
-    float pedestalCenterY = 0.6f;
-    float pedestalTopY = pedestalCenterY + pedestalScale.y * 0.5f;
+// the heavy models go out under last frame's query of their bounding box, then the boxes are
+// queried again against the finished opaque depth for the next frame
+void renderQueriedEntities(gps::ShaderPermutations& programs) {
+    for (gps::EntityId id : visibleQueried) {
+        occlusionQueries.beginDraw(id);
+        drawEntity(programs, id);
+        occlusionQueries.endDraw();
+    }
 
-    GLuint diff = wallDiffuse;
-    GLuint spec = wallSpecular;
-    GLuint rough = wallRoughness;
-    GLuint norm = wallNormal;
+    // the depth only shader draws the boxes; nothing is written, only samples counted
+    glm::mat4 viewProj = projection * view;
+    shadowShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(shadowShader.shaderProgram, "lightSpaceMatrix"),
+        1, GL_FALSE, glm::value_ptr(viewProj));
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
 
-    for (int i = 0; i < 3; i++) {
-        float spin = t * (40.0f + 15.0f * i);
-        float bob = 0.05f * sin(t * 2.0f + (float)i);
+    glm::vec3 eye = myCamera.getPosition();
+    const float nearMargin = 0.15f;
 
-        // Pedestal
-        {
-            glm::mat4 M(1.0f);
-            M = glm::translate(M, objPos[i] + glm::vec3(0.0f, pedestalCenterY, 0.0f));
-            M = glm::scale(M, pedestalScale);
-            drawTexturedCube(shader, M, diff, spec, rough, norm, glm::vec2(1.0f), 0, 1.0f, 0);
-        }
+    for (gps::EntityId id : visibleQueried) {
+        const gps::AABB& b = scene.worldBounds[id];
 
-        // Statue
-        gps::Model3D* statue = nullptr;
-        float statueScale = 0.25f;
-        float statueLift = 0.02f;
-
-        if (i == 0) { statue = &statueAntonius; statueScale = 0.20f; }
-        if (i == 1) { statue = &statueJudas;    statueScale = 0.22f; }
-        if (i == 2) { statue = &statueKrieger;  statueScale = 0.09f; }
-
-        if (statue) {
-            glm::mat4 S(1.0f);
-            S = glm::translate(S, objPos[i] + glm::vec3(0.0f, pedestalTopY + statueLift + bob, 0.0f));
-            S = glm::rotate(S, glm::radians(spin), glm::vec3(0, 1, 0));
-            S = glm::scale(S, glm::vec3(statueScale));
-            drawModel(shader, *statue, S);
+        // with the camera (almost) inside the box the near plane cuts its front faces away
+        if (glm::all(glm::greaterThan(eye, b.minCorner - nearMargin)) &&
+            glm::all(glm::lessThan(eye, b.maxCorner + nearMargin))) {
+            occlusionQueries.record(id, true);
+            continue;
         }
-    }
-}
-
-void renderDecor(gps::Shader& shader) {
-    float W = 12.0f;
-    float D = 16.0f;
-    const float wallOffset = 0.3f;
 
-    glDisable(GL_CULL_FACE);
+        glm::mat4 M = glm::translate(glm::mat4(1.0f), b.center());
+        M = glm::scale(M, glm::max(b.extents() * 2.0f, glm::vec3(0.001f)));
 
-    // Egyptian door
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(W * 0.5f - wallOffset, 1.5f, 2.0f));
-        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-        M = glm::scale(M, glm::vec3(4.0f));
-        drawModel(shader, egyptDoor, M);
+        occlusionQueries.beginQuery(id);
+        drawShadowCube(shadowShader, M);
+        occlusionQueries.endQuery();
     }
 
-    // Museum entrance
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(-2.0f, 0.8f, D * 0.5f - 1.5));
-        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-        M = glm::rotate(M, glm::radians(180.0f), glm::vec3(0, 0, 1));
-        M = glm::scale(M, glm::vec3(0.1f));
-        drawModel(shader, museumEntrance, M);
-    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+}
 
-    // Horror painting
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(-W * 0.5f + wallOffset, 1.3f, 0.0f));
-        M = glm::rotate(M, glm::radians(90.0f), glm::vec3(0, 1, 0));
-        M = glm::scale(M, glm::vec3(0.2f));
-        drawModel(shader, horrorPainting, M);
+void renderDust() {
+    dust.update(deltaTime, (float)glfwGetTime(), &workerPool);
+
+    // positions go up straight from the SoA streams, one float attribute each
+    GLsizeiptr bytes = (GLsizeiptr)(dust.size() * sizeof(float));
+    GLintptr xs = frameStream.upload(dust.getPositionsX(), bytes);
+    GLintptr ys = frameStream.upload(dust.getPositionsY(), bytes);
+    GLintptr zs = frameStream.upload(dust.getPositionsZ(), bytes);
+    if (xs < 0 || ys < 0 || zs < 0)
+        return;
+
+    // the culled path tests the motes (bounding sphere of the quad) before anything is drawn
+    if (useGpuInstanceCulling) {
+        GLintptr offsets[3] = { xs, ys, zs };
+        dustCuller.cull(gps::Frustum::fromMatrix(projection * view), frameStream.getBuffer(), offsets,
+            (GLsizei)dust.size(), MOTE_SIZE * 0.71f);
     }
-}
 
-void renderDust(gps::Shader& shader) {
+    gps::Shader& shader = useGpuInstanceCulling ? dustCulledShader : dustShader;
     shader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1f(glGetUniformLocation(shader.shaderProgram, "moteSize"), MOTE_SIZE);
 
     glEnable(GL_BLEND);
     glDepthMask(GL_FALSE);
 
-    for (auto& m : motes) {
-        m.position.y -= m.speed;
-        m.position.x += sin(glfwGetTime() + m.phase) * 0.001f;
-
-        if (m.position.y < 0.0f)
-            m.position.y = 4.0f;
-
-        glm::mat4 M = glm::translate(glm::mat4(1.0f), m.position);
-        M = glm::scale(M, glm::vec3(0.008f));
-
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(M));
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "isOutside"), 1);
-
-        glBindVertexArray(quadVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (useGpuInstanceCulling) {
+        dustCuller.draw();
+    }
+    else {
+        glBindVertexArray(dustVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, frameStream.getBuffer());
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)xs);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, (void*)ys);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, 0, (void*)zs);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)dust.size());
+        glBindVertexArray(0);
     }
 
     glDepthMask(GL_TRUE);
@@ -1190,175 +1990,475 @@ void renderDust(gps::Shader& shader) {
 
 // SHADOW RENDERING FUNCTIONS
 
-void renderRoomShadow(gps::Shader& sh) {
-    float W = 12.0f, D = 16.0f;
+void renderSceneShadows(gps::Shader& sh, unsigned layerMask) {
+    if (useIndirect) {
+        indirectRenderer.draw(visibleCasters, nullptr);
+        return;
+    }
 
-    glm::mat4 M(1.0f);
-    M = glm::scale(M, glm::vec3(W, 1.0f, D));
-    drawShadowQuad(sh, M);
+    // one draw at a time, so each caster only goes to the layers whose light sees it
+    GLint layerMaskLoc = glGetUniformLocation(sh.shaderProgram, "layerMask");
+    for (gps::EntityId id : visibleCasters) {
+        glUniform1i(layerMaskLoc, (GLint)(casterMask[id] & layerMask));
+        drawEntityShadow(sh, id);
+    }
 }
 
-void renderObjectsShadow(gps::Shader& sh) {
-    float t = (float)glfwGetTime();
+// every light's depth layer in one pass; with the cache only the moving casters are drawn
+// every frame, and only into the layers in layerMask
+void renderShadowMaps(unsigned layerMask) {
+    glm::mat4 lightSpaces[SHADOW_LAYER_COUNT];
+    for (int c = 0; c < CASCADE_COUNT; c++)
+        lightSpaces[c] = cascadeMatrices[c];
+    lightSpaces[SHADOW_LAYER_WINDOW] = windowLightSpaceMatrix;
+    gps::Shader& depthShader = useIndirect ? indirectShadowShader : layeredShadowShader;
 
-    glm::vec3 objPos[3] = {
-        glm::vec3(-3.0f, 0.0f, -2.0f),
-        glm::vec3(2.0f, 0.0f, -2.0f),
-        glm::vec3(4.0f, 0.0f, -2.0f)
-    };
+    glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
+    // casters between a cascade and the light are flattened onto its near plane
+    glEnable(GL_DEPTH_CLAMP);
+    depthShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(depthShader.shaderProgram, "lightSpaceMatrices"),
+        SHADOW_LAYER_COUNT, GL_FALSE, glm::value_ptr(lightSpaces[0]));
+    GLint layerMaskLoc = glGetUniformLocation(depthShader.shaderProgram, "layerMask");
+
+    // a clear wipes every layer, so without the cache all of them are redrawn
+    if (!useShadowCache) {
+        glUniform1i(layerMaskLoc, (GLint)ALL_SHADOW_LAYERS);
+        cullShadowCasters(lightSpaces, ALL_SHADOW_LAYERS, allCasterLists);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        renderSceneShadows(depthShader, ALL_SHADOW_LAYERS);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDisable(GL_DEPTH_CLAMP);
+        if (useMomentShadows)
+            shadowMoments.update(shadowArrayTex, ALL_SHADOW_LAYERS);
+        return;
+    }
 
-    glm::vec3 pedestalScale(0.9f, 1.2f, 0.9f);
-    float pedestalCenterY = 0.6f;
-    float pedestalTopY = pedestalCenterY + pedestalScale.y * 0.5f;
+    // cascades that moved with the camera get their static casters redrawn
+    unsigned stale = shadowCache.staleLayers(lightSpaces);
+    if (stale != 0) {
+        glUniform1i(layerMaskLoc, (GLint)stale);
+        cullShadowCasters(lightSpaces, stale, staticCasterLists);
+        shadowCache.beginRebuild(lightSpaces, stale);
+        renderSceneShadows(depthShader, stale);
+        shadowCache.endRebuild();
+        layerMask |= stale;
+    }
 
-    for (int i = 0; i < 3; i++) {
-        float bob = 0.05f * sin(t * 2.0f + (float)i);
+    shadowCache.restore(shadowArrayTex, layerMask);
 
-        // Pedestal
-        {
-            glm::mat4 M(1.0f);
-            M = glm::translate(M, objPos[i] + glm::vec3(0.0f, pedestalCenterY, 0.0f));
-            M = glm::scale(M, pedestalScale);
-            drawShadowCube(sh, M);
-        }
+    glUniform1i(layerMaskLoc, (GLint)layerMask);
+    cullShadowCasters(lightSpaces, layerMask, dynamicCasterLists);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+    renderSceneShadows(depthShader, layerMask);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_DEPTH_CLAMP);
+    if (useMomentShadows)
+        shadowMoments.update(shadowArrayTex, layerMask);
+}
 
-        // Statues
-        gps::Model3D* statue = nullptr;
-        float s = 0.2f;
-        if (i == 0) { statue = &statueAntonius; s = 0.20f; }
-        if (i == 1) { statue = &statueJudas;    s = 0.22f; }
-        if (i == 2) { statue = &statueKrieger;  s = 0.18f; }
-
-        if (statue) {
-            glm::mat4 S(1.0f);
-            S = glm::translate(S, objPos[i] + glm::vec3(0.0f, pedestalTopY + 0.02f + bob, 0.0f));
-            S = glm::scale(S, glm::vec3(s));
-            drawShadowModel(sh, *statue, S);
-        }
+// spot tiles that are out of date, within the frame's budget; one light at a time through the
+// single map depth shader
+void renderSpotShadows() {
+    gps::Frustum viewFrustum = gps::Frustum::fromMatrix(projection * view);
+    float importance[SHADOWED_SPOT_COUNT];
+    for (int i = 0; i < SHADOWED_SPOT_COUNT; i++) {
+        spotLightSpaces[i] = computeSpotLightSpace(i);
+        importance[i] = spotImportance(i, viewFrustum);
     }
-}
+    spotShadowAtlas.allocate(importance);
 
-void renderDecorShadow(gps::Shader& sh) {
-    float W = 12.0f;
-    float D = 16.0f;
-    const float wallOffset = 0.3f;
+    const std::vector<int>& updates = spotShadowAtlas.selectUpdates(spotLightSpaces, spotShadowBudget);
+    if (updates.empty())
+        return;
 
-    // Egyptian door
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(W * 0.5f - wallOffset, 0.8f, 2.0f));
-        M = glm::rotate(M, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-        M = glm::scale(M, glm::vec3(1.5f));
-        drawShadowModel(sh, egyptDoor, M);
+    shadowShader.useShaderProgram();
+    GLint lightSpaceLoc = glGetUniformLocation(shadowShader.shaderProgram, "lightSpaceMatrix");
+    // perspective depth is too uneven for a constant bias in the shader
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    for (int light : updates) {
+        const std::vector<gps::EntityId>& casters = spotCasterLists.update(light, spotLightSpaces[light], cullBounds);
+        spotShadowAtlas.beginTile(light, spotLightSpaces[light]);
+        glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(spotLightSpaces[light]));
+        for (gps::EntityId id : casters)
+            drawEntityShadow(shadowShader, id);
     }
 
-    // Museum entrance
-    {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, glm::vec3(-3.0f, 0.0f, D * 0.5f - wallOffset));
-        M = glm::rotate(M, glm::radians(180.0f), glm::vec3(0, 1, 0));
-        M = glm::scale(M, glm::vec3(0.6f));
-        drawShadowModel(sh, museumEntrance, M);
-    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    spotShadowAtlas.endUpdates();
 }
 
 // RENDER SCENE
 
+void uploadFrameUniforms(gps::Shader& shader) {
+    shader.useShaderProgram();
+    uploadSpotlights(shader);
+
+    GLuint program = shader.shaderProgram;
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform3fv(glGetUniformLocation(program, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(lightColor));
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "cascadeMatrices"),
+        CASCADE_COUNT, GL_FALSE, glm::value_ptr(cascadeMatrices[0]));
+    glUniform1fv(glGetUniformLocation(program, "cascadeSplits"), CASCADE_COUNT, cascadeSplits);
+    glUniform1f(glGetUniformLocation(program, "fogDensity"), fogDensity);
+    glUniform3fv(glGetUniformLocation(program, "fogColor"),
+        1, glm::value_ptr(fogColor));
+
+    glUniform1i(glGetUniformLocation(program, "shadowMaps"), 5);
+    glUniform1i(glGetUniformLocation(program, "shadowKernel"), shadowKernel);
+    glUniform1i(glGetUniformLocation(program, "shadowMoments"), 6);
+    glUniform1i(glGetUniformLocation(program, "useMomentShadows"), useMomentShadows ? 1 : 0);
+    glUniform1i(glGetUniformLocation(program, "spotShadowAtlas"), 7);
+    glUniform2f(glGetUniformLocation(program, "evsmExponents"),
+        gps::ShadowMoments::POSITIVE_EXPONENT, gps::ShadowMoments::NEGATIVE_EXPONENT);
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "windowLightSpaceMatrix"),
+        1, GL_FALSE, glm::value_ptr(windowLightSpaceMatrix));
+
+    glUniform3fv(glGetUniformLocation(program, "windowLightDir"),
+        1, glm::value_ptr(windowLightDir));
+    glUniform3fv(glGetUniformLocation(program, "windowLightColor"),
+        1, glm::value_ptr(windowLightColor));
+
+    glUniform1i(glGetUniformLocation(program, "lightmap"), LIGHTMAP_UNIT);
+    glUniform1i(glGetUniformLocation(program, "bakedSpotCount"), lightmapTexture ? SHADOWED_SPOT_COUNT : 0);
+}
+
 void renderScene() {
-    // Shadow pass
-    lightSpaceMatrix = computeLightSpaceMatrix();
+    frameStream.beginFrame();
+    if (useOcclusionQueries)
+        occlusionQueries.beginFrame();
+
+    animateScene();
+    picker.update(scene);
+    if (useIndirect)
+        indirectRenderer.update(scene);
+    cullBounds.sync(scene);
+
+    // a caster that moved makes its caster lists stale, a static one the cached shadow layers
+    allCasterLists.invalidateMoved(scene);
+    staticCasterLists.invalidateMoved(scene);
+    dynamicCasterLists.invalidateMoved(scene);
+    spotCasterLists.invalidateMoved(scene);
+    spotShadowAtlas.invalidateMoved(scene);
+    for (gps::EntityId id : scene.getLastUpdated()) {
+        if (scene.hasFlags(id, gps::ENTITY_CAST_SHADOW) && !scene.hasFlags(id, gps::ENTITY_DYNAMIC)) {
+            shadowCache.invalidate();
+            break;
+        }
+    }
 
-    glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    // Shadow pass: sun every frame, the window light time sliced (in between its layer keeps
+    // its last contents)
+    computeSunCascades();
+    windowLightSpaceMatrix = computeWindowLightSpaceMatrix();
 
-    shadowShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(shadowShader.shaderProgram, "lightSpaceMatrix"),
-        1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    unsigned shadowLayers = SUN_SHADOW_LAYERS;
+    if (windowShadowFrame++ % (unsigned)windowShadowInterval == 0)
+        shadowLayers |= 1u << SHADOW_LAYER_WINDOW;
+    renderShadowMaps(shadowLayers);
+    renderSpotShadows();
+    lightClusters.update(clusterSpots, view, &workerPool);
 
-    if (personAnimate)
-        personAnimT += 0.02f;
+    // Normal rendering pass
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    float walk = personAnimate ? 0.25f * sin(personAnimT) : 0.0f;
-    glm::mat4 mPerson(1.0f);
-    mPerson = glm::translate(mPerson, personPos + glm::vec3(0.0f, 0.0f, walk));
-    mPerson = glm::rotate(mPerson, glm::radians(personYaw), glm::vec3(0, 1, 0));
-    mPerson = glm::scale(mPerson, glm::vec3(0.01f));
+    basicPrograms.forEach(uploadFrameUniforms);
+    indirectPrograms.forEach(uploadFrameUniforms);
+    gbufferPrograms.forEach(uploadFrameUniforms);
+    indirectGbufferPrograms.forEach(uploadFrameUniforms);
+    if (useDeferred)
+        uploadFrameUniforms(deferredLightShader);
+    materials.invalidate();
+    cullMainPass();
 
-    renderRoomShadow(shadowShader);
-    renderObjectsShadow(shadowShader);
-    renderDecorShadow(shadowShader);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowArrayTex);
+    if (useMomentShadows) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMoments.getTexture());
+    }
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, spotShadowAtlas.getTexture());
+    lightClusters.bind(8);
+    if (lightmapTexture) {
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_UNIT);
+        glBindTexture(GL_TEXTURE_2D, lightmapTexture);
+    }
+    glActiveTexture(GL_TEXTURE0);
 
-    for (int i = 0; i < 3; i++) {
-        glm::mat4 M(1.0f);
-        M = glm::translate(M, spots[i].position + glm::vec3(0.0f, 4.0f - spots[i].position.y - 0.1f, 0.0f));
-        M = glm::scale(M, glm::vec3(0.4f, 0.05f, 0.4f));
-        drawShadowCube(shadowShader, M);
+    if (useDeferred) {
+        renderDeferred();
+    }
+    else {
+        renderOpaqueEntities(basicPrograms, indirectPrograms);
+        renderTransparentEntities(basicPrograms);
+        renderDust();
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    frameStream.endFrame();
+    reportFrameStats();
+}
 
-    // Window shadow pass
-    windowLightSpaceMatrix = computeWindowLightSpaceMatrix();
+// geometry pass into the G-buffer, the lighting of every opaque pixel in one full screen pass,
+// then the transparent entities and the dust forward against the G-buffer depth
+void renderDeferred() {
+    gBuffer.beginGeometry();
+    renderOpaqueEntities(gbufferPrograms, indirectGbufferPrograms);
 
-    glViewport(0, 0, WINDOW_SHADOW_SIZE, WINDOW_SHADOW_SIZE);
-    glBindFramebuffer(GL_FRAMEBUFFER, windowShadowFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    // G-buffer on units 11-14, clear of the shadow and cluster units
+    gBuffer.beginLighting(11);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
 
-    shadowShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(shadowShader.shaderProgram, "lightSpaceMatrix"),
-        1, GL_FALSE, glm::value_ptr(windowLightSpaceMatrix));
+    GLuint program = deferredLightShader.shaderProgram;
+    deferredLightShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(program, "gAlbedo"), 11 + gps::GBuffer::TARGET_ALBEDO);
+    glUniform1i(glGetUniformLocation(program, "gNormal"), 11 + gps::GBuffer::TARGET_NORMAL);
+    glUniform1i(glGetUniformLocation(program, "gMaterial"), 11 + gps::GBuffer::TARGET_MATERIAL);
+    glUniform1i(glGetUniformLocation(program, "gDepth"), 11 + gps::GBuffer::TARGET_DEPTH);
+    glUniformMatrix4fv(glGetUniformLocation(program, "inverseProjection"),
+        1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+    glUniformMatrix4fv(glGetUniformLocation(program, "inverseView"),
+        1, GL_FALSE, glm::value_ptr(glm::inverse(view)));
+    gBuffer.drawFullscreen();
 
-    renderRoomShadow(shadowShader);
-    renderObjectsShadow(shadowShader);
-    renderDecorShadow(shadowShader);
+    glEnable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE0);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gBuffer.beginForward();
+    renderTransparentEntities(basicPrograms);
+    renderDust();
+    gBuffer.present();
+}
 
-    // Normal rendering pass
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// CULLING
 
-    myBasicShader.useShaderProgram();
-    uploadSpotlights(myBasicShader);
+// camera frustum against the opaque and transparent lists
+void cullMainPass() {
+    gps::Frustum frustum = gps::Frustum::fromMatrix(projection * view);
+    cullBounds.testFrustum(frustum, visibleMask);
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceMatrix"),
-        1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity"), fogDensity);
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "fogColor"),
-        1, glm::value_ptr(fogColor));
+    visibleOpaque.clear();
+    visibleTransparent.clear();
+    gps::filterVisible(opaqueEntities, visibleMask, visibleOpaque, cullStats[PASS_MAIN]);
+    gps::filterVisible(transparentEntities, visibleMask, visibleTransparent, cullStats[PASS_MAIN]);
 
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, shadowDepthTex);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 5);
+    visibleQueried.clear();
+    gps::filterVisible(queriedEntities, visibleMask, visibleQueried, cullStats[PASS_MAIN]);
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "windowLightSpaceMatrix"),
-        1, GL_FALSE, glm::value_ptr(windowLightSpaceMatrix));
+    if (useOcclusionCulling) {
+        occlusionCuller.render(scene, projection * view, &workerPool);
+        occlusionCuller.filter(scene, visibleOpaque, cullStats[PASS_MAIN]);
+        occlusionCuller.filter(scene, visibleTransparent, cullStats[PASS_MAIN]);
+        occlusionCuller.filter(scene, visibleQueried, cullStats[PASS_MAIN]);
+    }
 
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "windowLightDir"),
-        1, glm::value_ptr(windowLightDir));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "windowLightColor"),
-        1, glm::value_ptr(windowLightColor));
+    // queried entities dropped on the cpu still get this frame's (hidden) sample;
+    // both lists are in entity order
+    size_t next = 0;
+    for (gps::EntityId id : queriedEntities) {
+        if (next < visibleQueried.size() && visibleQueried[next] == id)
+            next++;
+        else
+            occlusionQueries.record(id, false);
+    }
+}
 
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, windowShadowDepthTex);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "windowShadowMap"), 6);
+// the caster lists of the active layers; a caster is drawn once if any of their lights sees
+// it, and casterMask remembers which
+// the stats count every caster once per light, however many cascades it went through: culled
+// means no active layer of that light saw it
+void cullShadowCasters(const glm::mat4* lightSpaces, unsigned layerMask, gps::ShadowCasterLists& lists) {
+    casterMask.assign(scene.size(), 0);
+    const std::vector<gps::EntityId>& casters = lists.getCasters();
+
+    for (int layer = 0; layer < SHADOW_LAYER_COUNT; layer++) {
+        if ((layerMask & (1u << layer)) == 0)
+            continue;
+
+        const std::vector<gps::EntityId>& seen = lists.update(layer, lightSpaces[layer], cullBounds);
+        for (gps::EntityId id : seen)
+            casterMask[id] |= (uint8_t)(1u << layer);
+    }
 
-    clampPersonInsideRoom();
-    drawModel(myBasicShader, person, mPerson);
-    renderRoom(myBasicShader);
-    renderObjects(myBasicShader);
-    renderDecor(myBasicShader);
-    renderLampFixtures(myBasicShader);
-    renderDust(myBasicShader);
+    const uint8_t sunLayers = (uint8_t)(layerMask & ~(1u << SHADOW_LAYER_WINDOW));
+    const uint8_t windowLayer = (uint8_t)(layerMask & (1u << SHADOW_LAYER_WINDOW));
+    visibleCasters.clear();
+    for (gps::EntityId id : casters) {
+        if (casterMask[id])
+            visibleCasters.push_back(id);
+        if (sunLayers && !(casterMask[id] & sunLayers))
+            cullStats[PASS_SUN_SHADOW].culled++;
+        if (windowLayer && !(casterMask[id] & windowLayer))
+            cullStats[PASS_WINDOW_SHADOW].culled++;
+    }
+    if (sunLayers)
+        cullStats[PASS_SUN_SHADOW].submitted += (unsigned)casters.size();
+    if (windowLayer)
+        cullStats[PASS_WINDOW_SHADOW].submitted += (unsigned)casters.size();
+}
+
+// every 600 frames: submitted/culled entities per pass, and how long the cpu was
+// blocked on the stream buffer fences (it ran 3 frames ahead of the gpu)
+void reportFrameStats() {
+    unsigned frames = frameStream.getFrameCount();
+    if (frames < 600)
+        return;
+
+    // wall clock per frame, to compare the forward and deferred paths on the same camera path
+    double now = glfwGetTime();
+    std::cout << "Frame time: " << (now - statsStartTime) * 1000.0 / frames << " ms average ("
+        << (useDeferred ? "deferred" : "forward") << " path)" << std::endl;
+    statsStartTime = now;
+
+    std::cout << "Surface shader variants compiled: " << basicPrograms.getVariantCount() + indirectPrograms.getVariantCount()
+        << " forward, " << gbufferPrograms.getVariantCount() + indirectGbufferPrograms.getVariantCount() << " G-buffer" << std::endl;
+
+    std::cout << "Culling over " << frames << " frames:";
+    for (int p = 0; p < PASS_COUNT; p++) {
+        std::cout << " " << CULL_PASS_NAMES[p] << " " << cullStats[p].culled
+            << "/" << cullStats[p].submitted << " culled";
+        if (cullStats[p].occluded > 0)
+            std::cout << " (+" << cullStats[p].occluded << " occluded)";
+        std::cout << (p + 1 < PASS_COUNT ? "," : "");
+        cullStats[p] = gps::CullStats();
+    }
+    std::cout << std::endl;
+
+    if (frameStream.getWaitCount() > 0 || frameStream.getOverflowCount() > 0) {
+        std::cout << "Stream buffer: waited " << frameStream.getWaitCount() << " times in "
+            << frames << " frames, " << frameStream.getTotalWaitMs() << " ms total";
+        if (frameStream.getOverflowCount() > 0)
+            std::cout << ", " << frameStream.getOverflowCount() << " uploads did not fit";
+        std::cout << std::endl;
+    }
+    frameStream.resetStats();
+
+    if (useShadowCache) {
+        std::cout << "Shadow cache: static layers rebuilt " << shadowCache.getRebuildCount() << " times" << std::endl;
+        shadowCache.resetStats();
+    }
+
+    if (shadedFragments.getFrames() > 0) {
+        std::cout << "Opaque pass: " << shadedFragments.getTotal() / shadedFragments.getFrames()
+            << (shadedFragments.countsInvocations() ? " fragments shaded" : " samples passed")
+            << " per frame, depth pre-pass " << (useDepthPrepass ? "on" : "off") << std::endl;
+    }
+    shadedFragments.resetStats();
+
+    std::cout << "Spot shadow atlas: " << spotShadowAtlas.getUpdateCount() << " tiles redrawn, "
+        << spotShadowAtlas.getDeferredCount() << " left for later frames (budget " << spotShadowBudget << ")" << std::endl;
+    spotShadowAtlas.resetStats();
+
+    std::cout << "Light clusters: " << lightClusters.getLightCount() << " spots, "
+        << lightClusters.getIndexCount() << " light / cluster pairs, at most "
+        << lightClusters.getMaxClusterLights() << " spots in one cluster" << std::endl;
+
+    std::cout << "Shadow caster lists: culled " << staticCasterLists.getRebuildCount() << " times (static), "
+        << dynamicCasterLists.getRebuildCount() << " (moving), " << allCasterLists.getRebuildCount()
+        << " (uncached)" << std::endl;
+    allCasterLists.resetStats();
+    staticCasterLists.resetStats();
+    dynamicCasterLists.resetStats();
+
+    if (useOcclusionQueries && !occlusionQueries.getEntities().empty()) {
+        std::cout << "Occlusion queries: " << occlusionQueries.getQueryCount() << " issued, "
+            << occlusionQueries.getConditionalCount() << " conditional draws, "
+            << occlusionQueries.getStallCount() << " stalls;";
+        for (gps::EntityId id : occlusionQueries.getEntities()) {
+            std::cout << " " << scene.names[id];
+            if (occlusionQueries.wasVisible(id))
+                std::cout << " visible";
+            else
+                std::cout << " hidden for " << occlusionQueries.getHiddenFrames(id) << " frames";
+        }
+        std::cout << std::endl;
+        occlusionQueries.resetStats();
+    }
 }
 
 void cleanup() {
+    occlusionQueries.destroy();
+    dustCuller.destroy();
+    shadowCache.destroy();
+    shadowMoments.destroy();
+    spotShadowAtlas.destroy();
+    lightClusters.destroy();
+    gBuffer.destroy();
+    shadedFragments.destroy();
+    frameStream.destroy();
+    glDeleteTextures(1, &lightmapTexture);
     myWindow.Delete();
 }
 
 
 int main(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--bench-particles") == 0) {
+            size_t n = (i + 1 < argc) ? (size_t)std::strtoull(argv[i + 1], nullptr, 10) : 0;
+            gps::ParticleSystem::runBenchmark(n ? n : 4000000, workerPool);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    // the statue scans need a GL context to load, so this one runs after the window is up
+    bool benchBVH = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--bench-bvh") == 0)
+            benchBVH = true;
+    }
+
+    // multi-draw indirect submission, occlusion culling and queries unless switched off
+    useIndirect = true;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--no-indirect") == 0)
+            useIndirect = false;
+        if (std::strcmp(argv[i], "--no-occlusion") == 0)
+            useOcclusionCulling = false;
+        if (std::strcmp(argv[i], "--no-queries") == 0)
+            useOcclusionQueries = false;
+        if (std::strcmp(argv[i], "--no-gpu-cull") == 0)
+            useGpuInstanceCulling = false;
+        if (std::strcmp(argv[i], "--no-shadow-cache") == 0)
+            useShadowCache = false;
+        if (std::strcmp(argv[i], "--window-shadow-interval") == 0 && i + 1 < argc)
+            windowShadowInterval = std::max(1, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--shadow-kernel") == 0 && i + 1 < argc) {
+            const char* kernel = argv[++i];
+            if (std::strcmp(kernel, "1tap") == 0)
+                shadowKernel = SHADOW_KERNEL_1TAP;
+            else if (std::strcmp(kernel, "poisson") == 0)
+                shadowKernel = SHADOW_KERNEL_POISSON;
+            else
+                shadowKernel = SHADOW_KERNEL_GATHER;
+        }
+        if (std::strcmp(argv[i], "--evsm") == 0)
+            useMomentShadows = true;
+        if (std::strcmp(argv[i], "--depth-prepass") == 0)
+            useDepthPrepass = true;
+        if (std::strcmp(argv[i], "--spot-shadow-budget") == 0 && i + 1 < argc)
+            spotShadowBudget = std::max(1, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--deferred") == 0)
+            useDeferred = true;
+        if (std::strcmp(argv[i], "--no-program-cache") == 0)
+            useProgramCache = false;
+        if (std::strcmp(argv[i], "--bake-lightmap") == 0)
+            bakeLightmap = true;
+        if (std::strcmp(argv[i], "--no-lightmap") == 0)
+            useLightmap = false;
+        if (std::strcmp(argv[i], "--test-spots") == 0 && i + 1 < argc)
+            testSpotCount = std::max(0, std::atoi(argv[++i]));
+    }
+
     try {
         initOpenGLWindow();
     }
@@ -1368,12 +2468,19 @@ int main(int argc, const char* argv[]) {
     }
 
     initOpenGLState();
-    initDust();
     initModels();
+    if (benchBVH) {
+        gps::TriangleBVH::runBenchmark(
+            { statueAntonius.getTriangles(), statueJudas.getTriangles(), statueKrieger.getTriangles() },
+            { "Antonius", "Judas", "Kriegerdenkmal" }, workerPool);
+        cleanup();
+        return EXIT_SUCCESS;
+    }
     initQuad();
     initCube();
+    initDust();
     initShadowMap();
-    initWindowShadowMap();
+    initShaders();
 
     // Load textures
     gps::Texture floorDiff = teapot.LoadTexture("models/teapot/marble_01_diff_4k.jpg", "diffuseTexture");
@@ -1401,10 +2508,6 @@ int main(int argc, const char* argv[]) {
     gps::Texture outside = teapot.LoadTexture("models/teapot/blue-sky-with-windy-clouds-vertical-shot.jpg", "diffuseTexture");
     outsideTex = outside.id;
 
-    glBindTexture(GL_TEXTURE_2D, outsideTex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     gps::Texture glassBase = teapot.LoadTexture("models/teapot/Window_001_basecolor.jpg", "diffuseTexture");
     gps::Texture glassRgh = teapot.LoadTexture("models/teapot/Window_001_roughness.jpg", "roughnessTexture");
     gps::Texture glassMet = teapot.LoadTexture("models/teapot/Window_001_metallic.jpg", "specularTexture");
@@ -1417,33 +2520,34 @@ int main(int argc, const char* argv[]) {
     glassOpacity = glassOp.id;
     glassNormal = glassNor.id;
 
-    setAnisotropy(floorDiffuse);
-    setAnisotropy(wallDiffuse);
-    setAnisotropy(glassDiffuse);
-
-    auto clampTex = [](GLuint id) {
-        glBindTexture(GL_TEXTURE_2D, id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        };
-
-    clampTex(glassDiffuse);
-    clampTex(glassOpacity);
-    clampTex(glassNormal);
-
-    glBindTexture(GL_TEXTURE_2D, glassOpacity);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    initShaders();
+    initMaterials();
+    initScene();
+    initDrawLists();
+    initPicking();
+    initCollision();
     initUniforms();
+    initLightmap();
+    prepareSurfacePrograms();
+    if (programCache.isEnabled())
+        std::cout << "Program cache: " << programCache.getHitCount() << " loaded, " << programCache.getMissCount()
+            << " compiled, " << programCache.getRejectCount() << " stale or refused" << std::endl;
+
+    addTestSpots(testSpotCount);
+    initLightClusters();
     setWindowCallbacks();
     glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     glCheckError();
 
+    lastFrameTime = (float)glfwGetTime();
+    statsStartTime = glfwGetTime();
+
     // Application loop
     while (!glfwWindowShouldClose(myWindow.getWindow())) {
+        float now = (float)glfwGetTime();
+        deltaTime = std::min(now - lastFrameTime, 0.1f);
+        lastFrameTime = now;
+
         processMovement();
         renderScene();
 
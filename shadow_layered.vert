@@ -0,0 +1,9 @@
+#version 410 core
+layout(location=0) in vec3 aPos;
+
+uniform mat4 model;
+
+// world space; shadow_layered.geom projects it once per light
+void main() {
+    gl_Position = model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,20 @@
+#version 430 core
+layout(location=0) in vec3 aPos;
+layout(location=3) in uint drawId;
+
+struct DrawRecord {
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 lightmapRect;
+    uint material;
+    float lightmapCellStride;
+};
+
+layout(std430, binding = 0) readonly buffer DrawRecords {
+    DrawRecord draws[];
+};
+
+// world space; shadow_layered.geom projects it once per light
+void main() {
+    gl_Position = draws[drawId].model * vec4(aPos, 1.0);
+}
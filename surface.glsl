@@ -0,0 +1,68 @@
+// material inputs and surface normals, shared by the forward pass and the G-buffer pass
+// the material flags come in as #defines (gps::ShaderPermutations, see SurfaceFeature in
+// main.cpp), so every variant only contains the paths its materials take:
+//   FLAT_SHADING  face normals from derivatives        NORMAL_MAP   tangent space normal map
+//   ALPHA_TEST    discard below alpha 0.1              GLASS        transparent, glassFactor
+//   OPACITY_MAP   glass alpha from the opacity map     SKY          unlit albedo
+//   LIGHTMAP      baked light of the static surfaces (lightmap.glsl, lighting.glsl)
+// the including shader declares fPosEye, fNormalEye and fTexCoords
+
+uniform sampler2D diffuseTexture;
+uniform sampler2D specularTexture;
+uniform sampler2D roughnessTexture;
+
+uniform sampler2D normalTexture;
+uniform sampler2D opacityTexture;
+
+// per-material parameters (one slice of the material UBO, see gps::MaterialParams)
+layout(std140) uniform MaterialBlock {
+    vec2  uvTiling;
+    vec2  uvOffset;
+    vec2  uvMin;
+    vec2  uvMax;
+    int   useNormalMap;
+    int   useOpacityMap;
+    int   isGlass;
+    int   isOutside;
+    float glassFactor;
+};
+
+vec3 getNormalEye(vec3 normalEye, vec3 posEye, vec2 uv) {
+#ifndef NORMAL_MAP
+    return normalize(normalEye);
+#else
+    vec3 nMap = texture(normalTexture, uv).xyz * 2.0 - 1.0;
+
+    vec3 dp1 = dFdx(posEye);
+    vec3 dp2 = dFdy(posEye);
+    vec2 duv1 = dFdx(uv);
+    vec2 duv2 = dFdy(uv);
+
+    vec3 N = normalize(normalEye);
+
+    float det = duv1.x * duv2.y - duv1.y * duv2.x;
+    if (abs(det) < 1e-8)
+        return N;
+
+    vec3 T = (dp1 * duv2.y - dp2 * duv1.y) / det;
+    T = normalize(T - N * dot(N, T));
+    vec3 B = normalize(cross(N, T));
+
+    mat3 TBN = mat3(T, B, N);
+    return normalize(TBN * nMap);
+#endif
+}
+
+vec3 getFlatNormal(vec3 posEye) {
+    vec3 dx = dFdx(posEye);
+    vec3 dy = dFdy(posEye);
+    return normalize(cross(dx, dy));
+}
+
+vec3 getSurfaceNormal() {
+#ifdef FLAT_SHADING
+    return getFlatNormal(fPosEye);
+#else
+    return getNormalEye(fNormalEye, fPosEye, fTexCoords);
+#endif
+}